@@ -9,8 +9,10 @@
 #ifndef PARA_HPP_p57t4wkn
 #define PARA_HPP_p57t4wkn
 
+#include <para/atomic.hpp>
 #include <para/locking.hpp>
 #include <para/lfds.hpp>
+#include <para/pipe.hpp>
 #include <para/process.hpp>
 
 #endif
@@ -4,9 +4,273 @@
 /*!
 \file
 \brief Atomic operations based on the C++0x standard.
+
+para::atomic<T> has the interface of the C++0x std::atomic for the parts we
+use: load(), store(), exchange(), the compare_exchange functions and, for
+integers and pointers, the fetch_ functions and operators, each taking an
+explicit memory_order.  atomic_thread_fence() and atomic_signal_fence() are
+the fences.  Until the compilers we build with all have <atomic>, this is
+implemented with the GCC builtins: the __atomic ones where the compiler has
+them (GCC 4.7 and clang), otherwise the older __sync ones, which are always
+full barriers so every order is treated as memory_order_seq_cst.
+
+T must be an integer, a pointer, or bool, of at most 8 bytes, so that
+every operation is lock-free and safe to use in a signal handler or the
+audio callback.
+
+Unlike std::atomic the default constructor sets the value to T(), so an
+atomic member can't be accidentally left uninitialised.
+
+aligned_atomic<T> is the same but on a cache line of its own, for values
+which different threads write often; see \ref para::cache_line_size.
 */
 
 #ifndef PARA_ATOMIC_HPP_cs3vxgy5
 #define PARA_ATOMIC_HPP_cs3vxgy5
 
+#include <boost/noncopyable.hpp>
+#include <boost/static_assert.hpp>
+
+#include <cstddef>
+
+#if defined(__ATOMIC_RELAXED)
+#  define PARA_ATOMIC_BUILTINS 1
+#elif ! defined(__GNUC__)
+#  error "para::atomic needs the GCC atomic builtins"
+#endif
+
+namespace para {
+  //! \brief Assumed size of a cache line, for padding.
+  const std::size_t cache_line_size = 64;
+
+  //! \brief As std::memory_order.
+  enum memory_order {
+    memory_order_relaxed,
+    memory_order_consume,
+    memory_order_acquire,
+    memory_order_release,
+    memory_order_acq_rel,
+    memory_order_seq_cst
+  };
+
+  namespace detail {
+#ifdef PARA_ATOMIC_BUILTINS
+    inline int builtin_order(memory_order o) {
+      switch (o) {
+        case memory_order_relaxed: return __ATOMIC_RELAXED;
+        case memory_order_consume: return __ATOMIC_CONSUME;
+        case memory_order_acquire: return __ATOMIC_ACQUIRE;
+        case memory_order_release: return __ATOMIC_RELEASE;
+        case memory_order_acq_rel: return __ATOMIC_ACQ_REL;
+        case memory_order_seq_cst:
+        default: return __ATOMIC_SEQ_CST;
+      }
+    }
+#endif
+
+    //! \brief The strongest order a failed compare_exchange can have given
+    //! the order of a successful one; as in C++0x.
+    inline memory_order failure_order(memory_order o) {
+      if (o == memory_order_acq_rel) return memory_order_acquire;
+      if (o == memory_order_release) return memory_order_relaxed;
+      return o;
+    }
+
+    //! \brief What adding 1 adds: 1 for integers, the object size for pointers.
+    template <class T> struct atomic_step { static const std::ptrdiff_t value = 1; };
+    template <class T> struct atomic_step<T *> { static const std::ptrdiff_t value = sizeof(T); };
+  }
+
+  //! \brief As std::atomic_thread_fence.
+  inline void atomic_thread_fence(memory_order o) {
+#ifdef PARA_ATOMIC_BUILTINS
+    __atomic_thread_fence(detail::builtin_order(o));
+#else
+    if (o != memory_order_relaxed) __sync_synchronize();
+#endif
+  }
+
+  //! \brief As std::atomic_signal_fence: only stops the compiler reordering,
+  //! for sharing with a signal handler on the same thread.
+  inline void atomic_signal_fence(memory_order o) {
+#ifdef PARA_ATOMIC_BUILTINS
+    __atomic_signal_fence(detail::builtin_order(o));
+#else
+    if (o != memory_order_relaxed) __asm__ __volatile__("" ::: "memory");
+#endif
+  }
+
+  //! \brief As std::atomic, for integers, pointers and bool.
+  template <class T>
+  class atomic : boost::noncopyable {
+    BOOST_STATIC_ASSERT(sizeof(T) <= 8);
+
+    public:
+      typedef T value_type;
+
+      atomic() : v_() {}
+      atomic(T v) : v_(v) {}
+
+      //! \name Any T
+      //@{
+      T load(memory_order o = memory_order_seq_cst) const {
+#ifdef PARA_ATOMIC_BUILTINS
+        return __atomic_load_n(&v_, detail::builtin_order(o));
+#else
+        (void) o;
+        __sync_synchronize();
+        const T v = *static_cast<const volatile T *>(&v_);
+        __sync_synchronize();
+        return v;
+#endif
+      }
+
+      void store(T v, memory_order o = memory_order_seq_cst) {
+#ifdef PARA_ATOMIC_BUILTINS
+        __atomic_store_n(&v_, v, detail::builtin_order(o));
+#else
+        (void) o;
+        __sync_synchronize();
+        *static_cast<volatile T *>(&v_) = v;
+        __sync_synchronize();
+#endif
+      }
+
+      T exchange(T v, memory_order o = memory_order_seq_cst) {
+#ifdef PARA_ATOMIC_BUILTINS
+        return __atomic_exchange_n(&v_, v, detail::builtin_order(o));
+#else
+        (void) o;
+        T cur = v_;
+        while (! compare_exchange_weak(cur, v)) {}
+        return cur;
+#endif
+      }
+
+      //! \brief If it's \p expected, make it \p desired and return true.
+      //! Otherwise set \p expected to what it is.  Can fail spuriously.
+      bool compare_exchange_weak(T &expected, T desired, memory_order success, memory_order failure) {
+        return compare_exchange(expected, desired, true, success, failure);
+      }
+
+      bool compare_exchange_weak(T &expected, T desired, memory_order o = memory_order_seq_cst) {
+        return compare_exchange(expected, desired, true, o, detail::failure_order(o));
+      }
+
+      //! \brief The same, but never fails spuriously.
+      bool compare_exchange_strong(T &expected, T desired, memory_order success, memory_order failure) {
+        return compare_exchange(expected, desired, false, success, failure);
+      }
+
+      bool compare_exchange_strong(T &expected, T desired, memory_order o = memory_order_seq_cst) {
+        return compare_exchange(expected, desired, false, o, detail::failure_order(o));
+      }
+
+      operator T() const { return load(); }
+      T operator=(T v) { store(v); return v; }
+
+      //! \brief Always true for the types allowed.
+      bool is_lock_free() const { return true; }
+      //@}
+
+      //! \name Integers and pointers
+      //! These return the old value.  For pointers \p n is in objects, as with
+      //! pointer arithmetic.
+      //@{
+      T fetch_add(std::ptrdiff_t n, memory_order o = memory_order_seq_cst) {
+        const std::ptrdiff_t step = n * detail::atomic_step<T>::value;
+#ifdef PARA_ATOMIC_BUILTINS
+        return __atomic_fetch_add(&v_, step, detail::builtin_order(o));
+#else
+        (void) o;
+        return __sync_fetch_and_add(&v_, step);
+#endif
+      }
+
+      T fetch_sub(std::ptrdiff_t n, memory_order o = memory_order_seq_cst) {
+        const std::ptrdiff_t step = n * detail::atomic_step<T>::value;
+#ifdef PARA_ATOMIC_BUILTINS
+        return __atomic_fetch_sub(&v_, step, detail::builtin_order(o));
+#else
+        (void) o;
+        return __sync_fetch_and_sub(&v_, step);
+#endif
+      }
+
+      T operator++() { return fetch_add(1) + 1; }
+      T operator++(int) { return fetch_add(1); }
+      T operator--() { return fetch_sub(1) - 1; }
+      T operator--(int) { return fetch_sub(1); }
+      T operator+=(std::ptrdiff_t n) { return fetch_add(n) + n; }
+      T operator-=(std::ptrdiff_t n) { return fetch_sub(n) - n; }
+      //@}
+
+      //! \name Integers only
+      //@{
+      T fetch_and(T v, memory_order o = memory_order_seq_cst) {
+#ifdef PARA_ATOMIC_BUILTINS
+        return __atomic_fetch_and(&v_, v, detail::builtin_order(o));
+#else
+        (void) o;
+        return __sync_fetch_and_and(&v_, v);
+#endif
+      }
+
+      T fetch_or(T v, memory_order o = memory_order_seq_cst) {
+#ifdef PARA_ATOMIC_BUILTINS
+        return __atomic_fetch_or(&v_, v, detail::builtin_order(o));
+#else
+        (void) o;
+        return __sync_fetch_and_or(&v_, v);
+#endif
+      }
+
+      T fetch_xor(T v, memory_order o = memory_order_seq_cst) {
+#ifdef PARA_ATOMIC_BUILTINS
+        return __atomic_fetch_xor(&v_, v, detail::builtin_order(o));
+#else
+        (void) o;
+        return __sync_fetch_and_xor(&v_, v);
+#endif
+      }
+      //@}
+
+    private:
+      bool compare_exchange(T &expected, T desired, bool weak, memory_order success, memory_order failure) {
+#ifdef PARA_ATOMIC_BUILTINS
+        return __atomic_compare_exchange_n(&v_, &expected, desired, weak,
+                                           detail::builtin_order(success),
+                                           detail::builtin_order(failure));
+#else
+        (void) weak; (void) success; (void) failure;
+        const T old = __sync_val_compare_and_swap(&v_, expected, desired);
+        if (old == expected) return true;
+        expected = old;
+        return false;
+#endif
+      }
+
+      T v_;
+  };
+
+  /*!
+  \brief An atomic<T> alone on its cache line.
+
+  The alignment only holds where the compiler places the object (statics,
+  the stack, and members of those); operator new might not align it.  The
+  padding after it always stops the next object sharing the line.
+  */
+  template <class T>
+  class aligned_atomic : public atomic<T> {
+    public:
+      aligned_atomic() {}
+      aligned_atomic(T v) : atomic<T>(v) {}
+
+      using atomic<T>::operator=;
+
+    private:
+      char pad_[cache_line_size - sizeof(atomic<T>)];
+  } __attribute__((aligned(cache_line_size)));
+}
+
 #endif
@@ -668,11 +668,72 @@ cat * | preprocessor | compiler
  * The lfds module aims to provide a generic lock-free library analagous to the
  * standard template library's structures.
  *
+ * Rather than blocking, operations return false when they can't be done
+ * right now, which is the same bool get(T &ret) form as an adaptor over a
+ * locked container.  The caller decides whether to spin, sleep or give up.
+ *
+ * - \ref para::lfds::spsc_ring "lfds::spsc_ring" -- a bounded, wait-free
+ *   queue between exactly one producer and one consumer thread.
+ * - \ref para::lfds::mpmc_queue "lfds::mpmc_queue" -- a bounded queue for
+ *   any number of producer and consumer threads.
+ * - \ref para::lfds::stack "lfds::stack" -- an unbounded Treiber stack for any
+ *   number of threads.
+ * - \ref para::lfds::index_stack "lfds::index_stack" -- a fixed stack of
+ *   indices with a versioned top, for free lists of pre-allocated objects.
+ * - \ref para::lfds::list "lfds::list" -- a sorted set which can be read
+ *   without writing shared memory.
+ *
+ * Structures which allocate nodes free them through an
+ * \ref para::lfds::epoch_domain "lfds::epoch_domain", which only deletes a
+ * node once no thread can still be reading it.
+ *
+ * When a thread would rather wait, wrap the queue in a
+ * \ref para::lfds::blocking_adaptor "lfds::blocking_adaptor", which only
+ * touches its lock and condition (from para::sync_traits) when a side is
+ * actually waiting.  \ref para::lfds::locked_queue "lfds::locked_queue" has
+ * the same interface over a plain lock, for comparison or where a lock is
+ * fine.
+ *
  * TODO:
- *   this.
+ *   the rest of this.
  *
  */
 
+/*!
+ * \page pg_pipe Pipelines
+ *
+ * \section s_pipe_intro Introduction
+ *
+ * A \ref para::pipeline "pipeline" is a line of stages, each on its own
+ * thread, joined by bounded \ref para::pipe "pipes".  A stage pops a value,
+ * processes it and pushes the result; when a pipe is full the stage before
+ * it waits, so no stage can run away from the others.
+ *
+ * \code
+ * para::pipe<block> raw(4), filtered(4);
+ * para::pipeline line;
+ * line.source("read", reader(file), raw);
+ * line.filter("filter", low_pass(), raw, filtered);
+ * line.sink("write", writer(out), filtered);
+ * line.run();
+ * \endcode
+ *
+ * Adding a stage costs one thread and one pipe, and the pipeline does the
+ * starting, stopping, flushing and counting for it.
+ *
+ * - Pipes are made of an lfds queue, or a std::queue under a lock, chosen by
+ *   the channel: para::spsc_channel (the default), para::mpmc_channel or
+ *   para::locked_channel.
+ * - \ref para::branch_stage "branch()" gives each value to several pipes.
+ *   With a reference counted handle for T the data is shared, not copied,
+ *   and each branch either waits for room or drops (para::branch_policy).
+ * - \ref para::pipeline::flush() "flush()" drops everything between the
+ *   stages without waiting for them.
+ * - \ref para::pipeline::pause() "pause()" waits until no stage is working.
+ * - \ref para::pipeline::stats() "stats()" counts each stage's values and
+ *   how often it waited for input or for room in its output.
+ */
+
 /******************
  * Namespace Docs *
  ******************/
@@ -698,6 +759,12 @@ cat * | preprocessor | compiler
 \brief Private implementation.
 */
 
+/*!
+\namespace para::lfds
+\brief Lock-free data structures.
+\ingroup grp_lfds
+*/
+
 /**********************
  * Module Definitions *
  **********************/
@@ -737,4 +804,9 @@ cat * | preprocessor | compiler
  * \brief Generic lock-free structures.
  */
 
+/*!
+ * \defgroup grp_pipe Pipelines
+ * \brief Stages on their own threads joined by bounded pipes.
+ */
+
 #error This file is just for documentation.
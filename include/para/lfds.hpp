@@ -10,6 +10,11 @@
 #ifndef PARA_LFDS_HPP_7r4fe8iy
 #define PARA_LFDS_HPP_7r4fe8iy
 
+#include <para/lfds/epoch.hpp>
 #include <para/lfds/list.hpp>
+#include <para/lfds/mpmc_queue.hpp>
+#include <para/lfds/adaptors.hpp>
+#include <para/lfds/stack.hpp>
+#include <para/lfds/spsc_ring.hpp>
 
 #endif
@@ -0,0 +1,241 @@
+// Copyright (C) 2008-2009, James Webber.
+// Distributed under a 3-clause BSD license.  See COPYING.
+
+/*!
+\file
+\ingroup grp_lfds
+\brief Waiting on the lock-free queues, and a locked queue with their interface.
+*/
+
+#ifndef PARA_LFDS_ADAPTORS_HPP_v3j8ny1f
+#define PARA_LFDS_ADAPTORS_HPP_v3j8ny1f
+
+#include <para/atomic.hpp>
+#include <para/locking/traits.hpp>
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread.hpp>
+
+#include <queue>
+#include <cstddef>
+#include <utility>
+
+namespace para {
+  namespace lfds {
+    //! \ingroup grp_lfds
+    //! \brief The sync_traits the adaptors use unless told otherwise.
+    template <class T>
+    struct default_sync_traits {
+      typedef sync_traits<T, boost::mutex, boost::unique_lock<boost::mutex>, boost::condition_variable> type;
+    };
+
+    /*!
+    \ingroup grp_lfds
+    \brief Blocking push() and pop() over a queue whose own push() and pop()
+    fail instead of waiting (mpmc_queue, spsc_ring, locked_queue).
+
+    try_push() and try_pop() go straight to the queue.  push() and pop() try
+    first, and only when that fails take the lock from the Traits (a
+    para::sync_traits) and wait on a condition.  The other side only locks to
+    notify when a counter says somebody is waiting, so while nobody waits an
+    item costs the queue's own operation and one fence.
+
+    close() ends the stream: pushes fail from then on, and pops fail once
+    what was already queued is gone.  Everything waiting is woken.
+
+    The Queue's threading rules still hold: with an spsc_ring only one thread
+    may push and one pop.
+    */
+    template <class Queue, class Traits = typename default_sync_traits<typename Queue::value_type>::type>
+    class blocking_adaptor : boost::noncopyable {
+      public:
+        typedef typename Queue::value_type value_type;
+        typedef Queue queue_type;
+        typedef typename Traits::lockable_type lockable_type;
+        typedef typename Traits::lock_type lock_type;
+        typedef typename Traits::condition_type condition_type;
+
+        explicit blocking_adaptor(std::size_t capacity) : queue_(capacity) {}
+
+        //! \name Never wait
+        //@{
+        bool try_push(const value_type &v) { return ! closed() && pushed(queue_.push(v)); }
+        bool try_push(value_type &&v) { return ! closed() && pushed(queue_.push(std::move(v))); }
+        bool try_pop(value_type &ret) { return popped(queue_.pop(ret)); }
+        //@}
+
+        //! \name Wait while full or empty
+        //! These only fail once it's closed.
+        //@{
+        bool push(const value_type &v) {
+          if (try_push(v)) return true;
+          {
+            lock_type lk(mutex_);
+            waiter w(push_waiters_);
+            for (;;) {
+              // Before each try: try_push() may have failed only because it
+              // was closed, and there could be room.
+              if (closed()) return false;
+              if (queue_.push(v)) break;
+              not_full_.wait(lk);
+            }
+          }
+          return pushed(true);
+        }
+
+        bool push(value_type &&v) {
+          if (try_push(std::move(v))) return true;
+          {
+            lock_type lk(mutex_);
+            waiter w(push_waiters_);
+            for (;;) {
+              // Before each try: try_push() may have failed only because it
+              // was closed, and there could be room.
+              if (closed()) return false;
+              if (queue_.push(std::move(v))) break;
+              not_full_.wait(lk);
+            }
+          }
+          return pushed(true);
+        }
+
+        bool pop(value_type &ret) {
+          if (try_pop(ret)) return true;
+          {
+            lock_type lk(mutex_);
+            waiter w(pop_waiters_);
+            while (! queue_.pop(ret)) {
+              if (closed()) return false;
+              not_empty_.wait(lk);
+            }
+          }
+          return popped(true);
+        }
+
+        //! \brief False if nothing came before \p deadline.
+        template <class AbsoluteTime>
+        bool timed_pop(value_type &ret, const AbsoluteTime &deadline) {
+          if (try_pop(ret)) return true;
+          bool got;
+          {
+            lock_type lk(mutex_);
+            waiter w(pop_waiters_);
+            while (! (got = queue_.pop(ret)) && ! closed() && not_empty_.timed_wait(lk, deadline)) {}
+          }
+          return popped(got);
+        }
+        //@}
+
+        //! \brief No more pushes; wake everyone.  Any thread, any number of times.
+        void close() {
+          closed_.store(true, memory_order_seq_cst);
+          { lock_type lk(mutex_); }
+          not_empty_.notify_all();
+          not_full_.notify_all();
+        }
+
+        bool closed() const { return closed_.load(memory_order_acquire); }
+
+        Queue &queue() { return queue_; }
+        const Queue &queue() const { return queue_; }
+
+      private:
+        //! \brief Counts itself as waiting while it exists.
+        struct waiter {
+          explicit waiter(atomic<unsigned int> &n) : n(n) { n.fetch_add(1, memory_order_seq_cst); }
+          ~waiter() { n.fetch_sub(1, memory_order_relaxed); }
+          atomic<unsigned int> &n;
+        };
+
+        // Never call these with mutex_ held.
+        bool pushed(bool ok) {
+          if (ok) wake(pop_waiters_, not_empty_);
+          return ok;
+        }
+
+        bool popped(bool ok) {
+          if (ok) wake(push_waiters_, not_full_);
+          return ok;
+        }
+
+        void wake(atomic<unsigned int> &waiters, condition_type &c) {
+          // Pairs with the waiter's increment: either we see the waiter or its
+          // retry sees our change.
+          atomic_thread_fence(memory_order_seq_cst);
+          if (waiters.load(memory_order_relaxed)) {
+            // Taking the lock means the waiter is either before its retry or
+            // inside wait().
+            { lock_type lk(mutex_); }
+            c.notify_all();
+          }
+        }
+
+        Queue queue_;
+
+        lockable_type mutex_;
+        condition_type not_empty_;
+        condition_type not_full_;
+        // Read on every push and pop, so away from the lock's line.
+        char pad0_[cache_line_size];
+        atomic<unsigned int> push_waiters_;
+        atomic<unsigned int> pop_waiters_;
+        atomic<bool> closed_;
+    };
+
+    /*!
+    \ingroup grp_lfds
+    \brief A bounded std::queue behind the Traits' lock, with the same
+    failing push() and pop() as the lock-free queues.
+
+    For where a lock is fine, or to compare against, without changing the
+    code which uses the queue.
+    */
+    template <class T, class Traits = typename default_sync_traits<T>::type>
+    class locked_queue : boost::noncopyable {
+      public:
+        typedef T value_type;
+        typedef typename Traits::lockable_type lockable_type;
+        typedef typename Traits::lock_type lock_type;
+
+        explicit locked_queue(std::size_t capacity) : capacity_(capacity) {}
+
+        bool push(const T &v) {
+          lock_type lk(mutex_);
+          if (queue_.size() >= capacity_) return false;
+          queue_.push(v);
+          return true;
+        }
+
+        bool push(T &&v) {
+          lock_type lk(mutex_);
+          if (queue_.size() >= capacity_) return false;
+          queue_.push(std::move(v));
+          return true;
+        }
+
+        bool pop(T &ret) {
+          lock_type lk(mutex_);
+          if (queue_.empty()) return false;
+          ret = std::move(queue_.front());
+          queue_.pop();
+          return true;
+        }
+
+        std::size_t size() const {
+          lock_type lk(mutex_);
+          return queue_.size();
+        }
+
+        bool empty() const { return size() == 0; }
+
+        std::size_t capacity() const { return capacity_; }
+
+      private:
+        const std::size_t capacity_;
+        mutable lockable_type mutex_;
+        std::queue<T> queue_;
+    };
+  }
+}
+
+#endif
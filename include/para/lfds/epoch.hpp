@@ -0,0 +1,245 @@
+// Copyright (C) 2008-2009, James Webber.
+// Distributed under a 3-clause BSD license.  See COPYING.
+
+/*!
+\file
+\ingroup grp_lfds
+\brief Epoch based reclamation of memory unlinked from lock-free structures.
+*/
+
+#ifndef PARA_LFDS_EPOCH_HPP_q7d2mx5c
+#define PARA_LFDS_EPOCH_HPP_q7d2mx5c
+
+#include <para/atomic.hpp>
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/tss.hpp>
+
+#include <vector>
+#include <stdexcept>
+#include <cstddef>
+#include <cassert>
+
+#include <stdint.h>
+
+namespace para {
+  namespace lfds {
+    /*!
+    \ingroup grp_lfds
+    \brief Decides when memory which was unlinked from a lock-free structure
+    can't be seen by any thread any more, and frees it then.
+
+    Every access to the shared nodes is made inside a guard, which pins the
+    thread to the current epoch.  A node which has been unlinked is retire()d
+    rather than deleted.  The global epoch only advances when every pinned
+    thread has seen it, so once it has moved on twice since a node was
+    retired nobody can still be holding the node, and it's deleted.
+
+    Because nothing is freed while a thread which might hold it is pinned, an
+    address can't be reused under a reader either, which also rules out the
+    ABA problem for structures which allocate their nodes.
+
+    Pinning and unpinning are a few atomic operations and never block or
+    allocate, except that a thread's first guard registers it, which does
+    allocate; do that before entering a real-time thread's loop if it
+    matters.  retire() may allocate.  Freed memory is deleted on the thread
+    which retired it, the next time it pins or retires, so a thread which only
+    reads never frees anything.
+
+    At most max_threads threads may use a domain at once; registering another
+    throws std::runtime_error.  A thread's registration is returned when it
+    exits, so the domain must outlive every thread which used it.
+    */
+    class epoch_domain : boost::noncopyable {
+        struct thread_record;
+
+      public:
+        static const unsigned int max_threads = 32;
+
+        //! \brief Retirements by one thread between attempts to advance.
+        static const std::size_t collect_interval = 64;
+
+        //! \brief Pins the calling thread for its lifetime.  Guards nest.
+        class guard : boost::noncopyable {
+          public:
+            explicit guard(epoch_domain &d) : r_(d.local()) { d.pin(r_); }
+            ~guard() { epoch_domain::unpin(r_); }
+
+          private:
+            thread_record &r_;
+        };
+
+        epoch_domain() : id_(next_id()), local_(&release_record) {}
+
+        //! \brief Frees everything still retired.  No thread may be using any
+        //! structure in the domain.
+        ~epoch_domain() {
+          for (unsigned int i = 0; i < max_threads; ++i) {
+            for (unsigned int b = 0; b < 3; ++b) free_all(records_[i].limbo[b]);
+          }
+        }
+
+        //! \brief Shared by every structure which isn't given its own.
+        static epoch_domain &global() {
+          static epoch_domain d;
+          return d;
+        }
+
+        //! \brief Delete \p p with \p deleter once no thread can hold it.  The
+        //! caller must have unlinked it already.
+        void retire(void *p, void (*deleter)(void *)) {
+          thread_record &r = local();
+          // The unlink must come before the epoch we tag with, or a reader
+          // which pinned in a later epoch could still find the node after
+          // it's freed.
+          atomic_thread_fence(memory_order_seq_cst);
+          const unsigned int e = epoch_.load(memory_order_relaxed);
+          r.limbo[e % 3].push_back(retired(p, deleter));
+          if (++r.retired_since_collect >= collect_interval) {
+            r.retired_since_collect = 0;
+            try_advance();
+            collect(r, epoch_.load(memory_order_acquire));
+          }
+        }
+
+        template <class T>
+        void retire(T *p) { retire(p, &delete_object<T>); }
+
+        //! \brief Try to move the epoch on and free what the calling thread has
+        //! retired that is now safe.  Call it from a thread which retired
+        //! things and is about to go quiet.
+        void collect() {
+          thread_record &r = local();
+          for (int i = 0; i < 3; ++i) {
+            try_advance();
+            collect(r, epoch_.load(memory_order_acquire));
+          }
+        }
+
+        //! \brief Nodes retired by the calling thread and not yet freed.
+        std::size_t pending() {
+          thread_record &r = local();
+          return r.limbo[0].size() + r.limbo[1].size() + r.limbo[2].size();
+        }
+
+        //! \brief The global epoch.  For tests.
+        unsigned int epoch() const { return epoch_.load(memory_order_relaxed); }
+
+      private:
+        struct retired {
+          retired(void *p, void (*d)(void *)) : ptr(p), deleter(d) {}
+
+          void *ptr;
+          void (*deleter)(void *);
+        };
+
+        typedef std::vector<retired> limbo_type;
+
+        // One per registered thread, each on its own lines.
+        struct thread_record {
+          thread_record() : nesting(0), seen(0), retired_since_collect(0) {}
+
+          //! \brief Epoch << 1, with the low bit set while pinned.
+          aligned_atomic<unsigned int> state;
+          atomic<bool> claimed;
+
+          // Owner only.
+          unsigned int nesting;
+          unsigned int seen;
+          std::size_t retired_since_collect;
+          limbo_type limbo[3];
+        } __attribute__((aligned(cache_line_size)));
+
+        friend class guard;
+
+        template <class T>
+        static void delete_object(void *p) { delete static_cast<T *>(p); }
+
+        static uint64_t next_id() {
+          static atomic<uint64_t> id(0);
+          return id.fetch_add(1, memory_order_relaxed) + 1;
+        }
+
+        static void free_all(limbo_type &l) {
+          for (std::size_t i = 0; i < l.size(); ++i) l[i].deleter(l[i].ptr);
+          l.clear();
+        }
+
+        // Called by thread_specific_ptr when a thread exits.  The record stays
+        // in the domain, retired nodes and all, for the next thread.
+        static void release_record(thread_record *r) {
+          assert(r->nesting == 0);
+          r->claimed.store(false, memory_order_release);
+        }
+
+        //! \brief The calling thread's record, registering it the first time.
+        thread_record &local() {
+          // thread_specific_ptr is a map lookup; remember the last domain used.
+          static __thread uint64_t cached_id = 0;
+          static __thread thread_record *cached = NULL;
+          if (cached_id == id_) return *cached;
+
+          thread_record *r = local_.get();
+          if (! r) {
+            r = claim();
+            local_.reset(r);
+          }
+          cached_id = id_;
+          cached = r;
+          return *r;
+        }
+
+        thread_record *claim() {
+          for (unsigned int i = 0; i < max_threads; ++i) {
+            bool expected = false;
+            if (records_[i].claimed.compare_exchange_strong(expected, true, memory_order_acquire)) {
+              return &records_[i];
+            }
+          }
+          throw std::runtime_error("para::lfds::epoch_domain: too many threads");
+        }
+
+        void pin(thread_record &r) {
+          if (r.nesting++) return;
+          const unsigned int e = epoch_.load(memory_order_relaxed);
+          // Must be visible before we read any node, so it's a full barrier.
+          // An exchange rather than a store so try_advance() reading it also
+          // synchronises with our unpin before.
+          r.state.exchange((e << 1) | 1, memory_order_seq_cst);
+          // Acquire: whatever we free was unlinked before the epoch moved on.
+          collect(r, epoch_.load(memory_order_acquire));
+        }
+
+        static void unpin(thread_record &r) {
+          assert(r.nesting > 0);
+          if (--r.nesting) return;
+          r.state.store(r.state.load(memory_order_relaxed) & ~1u, memory_order_release);
+        }
+
+        //! \brief Advance if every pinned thread is in the current epoch.
+        bool try_advance() {
+          unsigned int e = epoch_.load(memory_order_relaxed);
+          atomic_thread_fence(memory_order_seq_cst);
+          for (unsigned int i = 0; i < max_threads; ++i) {
+            const unsigned int s = records_[i].state.load(memory_order_acquire);
+            if ((s & 1) && (s >> 1) != e) return false;
+          }
+          return epoch_.compare_exchange_strong(e, e + 1, memory_order_acq_rel, memory_order_relaxed);
+        }
+
+        //! \brief Free what \p r retired two epochs before \p e.
+        static void collect(thread_record &r, unsigned int e) {
+          if (e == r.seen) return;
+          r.seen = e;
+          free_all(r.limbo[(e + 1) % 3]);
+        }
+
+        thread_record records_[max_threads];
+        aligned_atomic<unsigned int> epoch_;
+        const uint64_t id_;
+        boost::thread_specific_ptr<thread_record> local_;
+    };
+  }
+}
+
+#endif
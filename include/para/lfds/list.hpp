@@ -3,10 +3,193 @@
 
 /*!
 \file
+\ingroup grp_lfds
 \brief Generic lock-free list.
 */
 
 #ifndef PARA_LFDF_LIST_HPP_061jqym9
 #define PARA_LFDF_LIST_HPP_061jqym9
 
+#include <para/atomic.hpp>
+#include <para/lfds/epoch.hpp>
+
+#include <boost/noncopyable.hpp>
+
+#include <functional>
+#include <cstddef>
+
+#include <stdint.h>
+
+namespace para {
+  namespace lfds {
+    /*!
+    \ingroup grp_lfds
+    \brief Sorted set as a lock-free linked list (Harris, with Michael's
+    changes for safe reclamation).
+
+    erase() first marks the node's next link, which stops anything being
+    inserted after it, then unlinks it.  Any traversal which meets a marked
+    node helps unlink it.  Unlinked nodes are retired to the epoch_domain.
+
+    insert() and erase() are lock-free; contains() and for_each() are
+    wait-free apart from the length of the list, never write shared memory,
+    and never allocate once the thread is registered with the domain, so the
+    audio thread can look at the set while another thread changes it.
+    Values are never changed in place; to change one, erase it and insert the
+    new one.
+    */
+    template <class T, class Compare = std::less<T> >
+    class list : boost::noncopyable {
+      public:
+        typedef T value_type;
+
+        explicit list(epoch_domain &domain = epoch_domain::global(), const Compare &less = Compare())
+        : domain_(domain), less_(less), head_(0) {}
+
+        //! \brief No other thread may be using it.
+        ~list() {
+          node *n = ptr(head_.load(memory_order_relaxed));
+          while (n) {
+            node *next = ptr(n->next.load(memory_order_relaxed));
+            delete n;
+            n = next;
+          }
+        }
+
+        //! \brief False if an equal value is there already.  Throws std::bad_alloc.
+        bool insert(const T &v) {
+          epoch_domain::guard g(domain_);
+          node *n = NULL;
+          for (;;) {
+            atomic<uintptr_t> *prev;
+            node *cur;
+            if (find(v, prev, cur)) {
+              delete n;
+              return false;
+            }
+
+            if (! n) n = new node(v);
+            n->next.store(reinterpret_cast<uintptr_t>(cur), memory_order_relaxed);
+            uintptr_t expected = reinterpret_cast<uintptr_t>(cur);
+            if (prev->compare_exchange_strong(expected, reinterpret_cast<uintptr_t>(n),
+                                              memory_order_release, memory_order_relaxed)) {
+              return true;
+            }
+          }
+        }
+
+        //! \brief False if it wasn't there.
+        bool erase(const T &v) {
+          epoch_domain::guard g(domain_);
+          for (;;) {
+            atomic<uintptr_t> *prev;
+            node *cur;
+            if (! find(v, prev, cur)) return false;
+
+            uintptr_t next = cur->next.load(memory_order_acquire);
+            if (marked(next)) continue;
+            // Logically deleted once this is done; whoever marks it owns the erase.
+            if (! cur->next.compare_exchange_strong(next, next | 1, memory_order_acq_rel, memory_order_relaxed)) {
+              continue;
+            }
+
+            uintptr_t expected = reinterpret_cast<uintptr_t>(cur);
+            if (prev->compare_exchange_strong(expected, next, memory_order_acq_rel, memory_order_relaxed)) {
+              domain_.retire(cur);
+            }
+            else {
+              // Somebody changed prev; a search unlinks it for us.
+              find(v, prev, cur);
+            }
+            return true;
+          }
+        }
+
+        bool contains(const T &v) const {
+          epoch_domain::guard g(domain_);
+          node *cur = ptr(head_.load(memory_order_acquire));
+          while (cur && less_(cur->value, v)) {
+            cur = ptr(cur->next.load(memory_order_acquire));
+          }
+          return cur && ! less_(v, cur->value) && ! marked(cur->next.load(memory_order_acquire));
+        }
+
+        //! \brief Call \p f with each value in order.  Values inserted or erased
+        //! meanwhile may or may not be seen.  Don't change the list from \p f.
+        template <class F>
+        void for_each(F f) const {
+          epoch_domain::guard g(domain_);
+          for (node *cur = ptr(head_.load(memory_order_acquire)); cur;) {
+            const uintptr_t next = cur->next.load(memory_order_acquire);
+            if (! marked(next)) f(cur->value);
+            cur = ptr(next);
+          }
+        }
+
+        //! \brief Counts them, so a snapshot at best.
+        std::size_t size() const {
+          std::size_t n = 0;
+          for_each(counter(n));
+          return n;
+        }
+
+        bool empty() const { return ptr(head_.load(memory_order_acquire)) == NULL; }
+
+      private:
+        struct node {
+          explicit node(const T &v) : value(v) {}
+
+          const T value;
+          //! \brief The next node, with the low bit set once this one is erased.
+          atomic<uintptr_t> next;
+        };
+
+        struct counter {
+          explicit counter(std::size_t &n) : n(n) {}
+          void operator()(const T &) { ++n; }
+          std::size_t &n;
+        };
+
+        static node *ptr(uintptr_t p) { return reinterpret_cast<node *>(p & ~(uintptr_t) 1); }
+        static bool marked(uintptr_t p) { return p & 1; }
+
+        /*!
+        \brief Find the first node not less than \p v, unlinking marked nodes on
+        the way.  \p cur is that node or NULL and \p prev the unmarked link to
+        it.  Returns whether \p cur equals \p v.  Must be pinned.
+        */
+        bool find(const T &v, atomic<uintptr_t> *&prev, node *&cur) {
+        retry:
+          prev = &head_;
+          cur = ptr(prev->load(memory_order_acquire));
+          while (cur) {
+            const uintptr_t next = cur->next.load(memory_order_acquire);
+            if (marked(next)) {
+              uintptr_t expected = reinterpret_cast<uintptr_t>(cur);
+              // Fails if prev's node is being erased too, or prev has moved.
+              if (! prev->compare_exchange_strong(expected, next & ~(uintptr_t) 1,
+                                                  memory_order_acq_rel, memory_order_acquire)) {
+                goto retry;
+              }
+              domain_.retire(cur);
+              cur = ptr(next);
+              continue;
+            }
+
+            if (! less_(cur->value, v)) {
+              return ! less_(v, cur->value);
+            }
+            prev = &cur->next;
+            cur = ptr(next);
+          }
+          return false;
+        }
+
+        epoch_domain &domain_;
+        Compare less_;
+        aligned_atomic<uintptr_t> head_;
+    };
+  }
+}
+
 #endif
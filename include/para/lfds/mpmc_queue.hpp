@@ -0,0 +1,164 @@
+// Copyright (C) 2008-2009, James Webber.
+// Distributed under a 3-clause BSD license.  See COPYING.
+
+/*!
+\file
+\ingroup grp_lfds
+\brief Bounded multi-producer, multi-consumer array queue.
+*/
+
+#ifndef PARA_LFDS_MPMC_QUEUE_HPP_b6rn0e4x
+#define PARA_LFDS_MPMC_QUEUE_HPP_b6rn0e4x
+
+#include <para/atomic.hpp>
+
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_array.hpp>
+
+#include <cstddef>
+#include <utility>
+
+namespace para {
+  namespace lfds {
+    /*!
+    \ingroup grp_lfds
+    \brief Bounded FIFO queue for any number of pushing and popping threads
+    (Vyukov's design).
+
+    Each slot has a sequence number saying whose turn it is: the slot's
+    position when a pusher may fill it, one more when a popper may empty it,
+    and a lap further on when it's free again.  A thread claims a position
+    with one compare and swap on the shared index, then owns the slot outright
+    until it publishes the new sequence.  So pushers only contend with
+    pushers and poppers with poppers, on one cache line each, and the data is
+    never touched by two threads at once.
+
+    push() and pop() never block and never allocate; they return false when
+    the queue is full or empty, like spsc_ring.  See blocking_adaptor for
+    waiting.  They are lock-free rather than wait-free: a thread which stops
+    between claiming a slot and publishing it holds up that one slot.
+
+    T must be default constructible and assignable, as with spsc_ring.
+    */
+    template <class T>
+    class mpmc_queue : boost::noncopyable {
+      public:
+        typedef T value_type;
+
+        //! \brief Capacity is rounded up to a power of two, and at least 2.
+        explicit mpmc_queue(std::size_t min_capacity)
+        : mask_(round_up(min_capacity) - 1), cells_(new cell[mask_ + 1]) {
+          for (std::size_t i = 0; i <= mask_; ++i) {
+            cells_[i].sequence.store(i, memory_order_relaxed);
+          }
+        }
+
+        //! \name Any thread
+        //@{
+        bool push(const T &v) {
+          cell *c = claim_push();
+          if (! c) return false;
+          c->data = v;
+          publish(c);
+          return true;
+        }
+
+        bool push(T &&v) {
+          cell *c = claim_push();
+          if (! c) return false;
+          c->data = std::move(v);
+          publish(c);
+          return true;
+        }
+
+        //! \brief Move the oldest into \p ret unless it's empty.
+        bool pop(T &ret) {
+          std::size_t pos = dequeue_pos_.load(memory_order_relaxed);
+          for (;;) {
+            cell &c = cells_[pos & mask_];
+            const std::size_t seq = c.sequence.load(memory_order_acquire);
+            const std::ptrdiff_t dif = (std::ptrdiff_t) seq - (std::ptrdiff_t) (pos + 1);
+            if (dif == 0) {
+              if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+                ret = std::move(c.data);
+                // Free for the push a lap from now.
+                c.sequence.store(pos + mask_ + 1, memory_order_release);
+                return true;
+              }
+            }
+            else if (dif < 0) {
+              return false;
+            }
+            else {
+              pos = dequeue_pos_.load(memory_order_relaxed);
+            }
+          }
+        }
+
+        //! \brief Only a snapshot when other threads are using it.
+        std::size_t size() const {
+          const std::size_t d = dequeue_pos_.load(memory_order_acquire);
+          const std::size_t e = enqueue_pos_.load(memory_order_acquire);
+          return e > d ? e - d : 0;
+        }
+
+        bool empty() const { return size() == 0; }
+
+        std::size_t capacity() const { return mask_ + 1; }
+        //@}
+
+      private:
+        struct cell {
+          atomic<std::size_t> sequence;
+          T data;
+        };
+
+        static std::size_t round_up(std::size_t n) {
+          std::size_t c = 2;
+          while (c < n) c <<= 1;
+          return c;
+        }
+
+        //! \brief The cell at the next push position, owned by us, or NULL if full.
+        cell *claim_push() {
+          std::size_t pos = enqueue_pos_.load(memory_order_relaxed);
+          for (;;) {
+            cell &c = cells_[pos & mask_];
+            const std::size_t seq = c.sequence.load(memory_order_acquire);
+            const std::ptrdiff_t dif = (std::ptrdiff_t) seq - (std::ptrdiff_t) pos;
+            if (dif == 0) {
+              if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+                return &c;
+              }
+            }
+            else if (dif < 0) {
+              // Still holds last lap's value.
+              return NULL;
+            }
+            else {
+              pos = enqueue_pos_.load(memory_order_relaxed);
+            }
+          }
+        }
+
+        void publish(cell *c) {
+          // We own it, so the sequence is still the position we claimed.
+          c->sequence.store(c->sequence.load(memory_order_relaxed) + 1, memory_order_release);
+        }
+
+        //! \brief A position on a cache line of its own.
+        struct padded_index : atomic<std::size_t> {
+          char pad[cache_line_size - sizeof(atomic<std::size_t>)];
+        };
+
+        const std::size_t mask_;
+        boost::scoped_array<cell> cells_;
+        // Pushers and poppers each keep to their own line.
+        char pad0_[cache_line_size];
+        padded_index enqueue_pos_;
+        padded_index dequeue_pos_;
+    };
+  }
+}
+
+#endif
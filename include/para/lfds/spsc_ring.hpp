@@ -0,0 +1,125 @@
+// Copyright (C) 2008-2009, James Webber.
+// Distributed under a 3-clause BSD license.  See COPYING.
+
+/*!
+\file
+\ingroup grp_lfds
+\brief Bounded single-producer, single-consumer ring buffer.
+*/
+
+#ifndef PARA_LFDS_SPSC_RING_HPP_k2v9tq0d
+#define PARA_LFDS_SPSC_RING_HPP_k2v9tq0d
+
+#include <para/atomic.hpp>
+
+#include <boost/noncopyable.hpp>
+
+#include <cstddef>
+#include <cassert>
+#include <utility>
+
+namespace para {
+  namespace lfds {
+    using para::cache_line_size;
+
+    /*!
+    \ingroup grp_lfds
+    \brief Wait-free bounded queue for exactly one pushing and one popping thread.
+
+    push() and pop() never block and never lock; they fail instead when the
+    ring is full or empty.  Each side owns one index and reads the other's
+    with acquire ordering, and each index sits on its own cache line so the
+    two threads don't share a line in the common case.
+
+    The capacity is rounded up to a power of two.  T must be default
+    constructible and move assignable; slots which have been popped are
+    left in their moved-from state.
+    */
+    template <class T>
+    class spsc_ring : boost::noncopyable {
+      public:
+        typedef T value_type;
+
+        explicit spsc_ring(std::size_t min_capacity)
+        : mask_(round_up(min_capacity) - 1), slots_(new T[mask_ + 1]) {
+          head_.cached = 0;
+          tail_.cached = 0;
+        }
+
+        ~spsc_ring() { delete [] slots_; }
+
+        //! \name Producer
+        //@{
+
+        //! \brief Move \p v in, or return false without touching it if full.
+        bool push(T &v) {
+          const std::size_t t = tail_.value.load(memory_order_relaxed);
+          if (t - tail_.cached > mask_) {
+            tail_.cached = head_.value.load(memory_order_acquire);
+            if (t - tail_.cached > mask_) return false;
+          }
+          slots_[t & mask_] = std::move(v);
+          tail_.value.store(t + 1, memory_order_release);
+          return true;
+        }
+
+        bool push(T &&v) { return push(v); }
+        //@}
+
+        //! \name Consumer
+        //@{
+
+        //! \brief Move the oldest value into \p ret, or return false if empty.
+        bool pop(T &ret) {
+          const std::size_t h = head_.value.load(memory_order_relaxed);
+          if (h == head_.cached) {
+            head_.cached = tail_.value.load(memory_order_acquire);
+            if (h == head_.cached) return false;
+          }
+          ret = std::move(slots_[h & mask_]);
+          head_.value.store(h + 1, memory_order_release);
+          return true;
+        }
+        //@}
+
+        //! \name Either side
+        //@{
+
+        //! \brief Number of values waiting.  Exact from either side's own point
+        //! of view; possibly stale from anywhere else.
+        std::size_t size() const {
+          return tail_.value.load(memory_order_acquire) - head_.value.load(memory_order_acquire);
+        }
+
+        bool empty() const { return size() == 0; }
+
+        std::size_t capacity() const { return mask_ + 1; }
+        //@}
+
+      private:
+        //! \brief An index and the last value seen of the other side's index.
+        struct padded_index {
+          atomic<std::size_t> value;
+          std::size_t cached;
+          char pad[cache_line_size - sizeof(atomic<std::size_t>) - sizeof(std::size_t)];
+        };
+
+        static std::size_t round_up(std::size_t n) {
+          std::size_t c = 1;
+          while (c < n) c <<= 1;
+          return c;
+        }
+
+        char pad0_[cache_line_size];
+        // Written by the consumer.
+        padded_index head_;
+        // Written by the producer.
+        padded_index tail_;
+
+        const std::size_t mask_;
+        T * const slots_;
+    };
+  }
+}
+
+#endif
@@ -0,0 +1,174 @@
+// Copyright (C) 2008-2009, James Webber.
+// Distributed under a 3-clause BSD license.  See COPYING.
+
+/*!
+\file
+\ingroup grp_lfds
+\brief Lock-free stacks: an unbounded one of values and a fixed one of indices.
+*/
+
+#ifndef PARA_LFDS_STACK_HPP_h5w8kq3z
+#define PARA_LFDS_STACK_HPP_h5w8kq3z
+
+#include <para/atomic.hpp>
+#include <para/lfds/epoch.hpp>
+
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_array.hpp>
+
+#include <cstddef>
+#include <cassert>
+#include <utility>
+
+#include <stdint.h>
+
+namespace para {
+  namespace lfds {
+    /*!
+    \ingroup grp_lfds
+    \brief Unbounded Treiber stack for any number of threads.
+
+    push() allocates a node and pop() retires it to the epoch_domain, which
+    is also what protects pop() from ABA: a node can't be freed and its
+    address pushed again while another pop() is still looking at it.
+
+    push() and pop() are lock-free.  pop() returns false when the stack is
+    empty, as spsc_ring does.
+    */
+    template <class T>
+    class stack : boost::noncopyable {
+      public:
+        typedef T value_type;
+
+        explicit stack(epoch_domain &domain = epoch_domain::global()) : domain_(domain), top_(NULL) {}
+
+        //! \brief No other thread may be using it.
+        ~stack() {
+          node *n = top_.load(memory_order_relaxed);
+          while (n) {
+            node *next = n->next;
+            delete n;
+            n = next;
+          }
+        }
+
+        //! \brief Throws std::bad_alloc.
+        void push(const T &v) { link(new node(v)); }
+
+        //! \brief Throws std::bad_alloc.
+        void push(T &&v) { link(new node(std::move(v))); }
+
+        //! \brief Move the top value into \p ret unless it's empty.
+        bool pop(T &ret) {
+          epoch_domain::guard g(domain_);
+          node *t = top_.load(memory_order_acquire);
+          while (t) {
+            // t can't be freed while we're pinned, so its next is still readable.
+            if (top_.compare_exchange_weak(t, t->next, memory_order_acquire, memory_order_acquire)) {
+              ret = std::move(t->value);
+              domain_.retire(t);
+              return true;
+            }
+          }
+          return false;
+        }
+
+        //! \brief Only a snapshot when other threads are pushing and popping.
+        bool empty() const { return top_.load(memory_order_acquire) == NULL; }
+
+      private:
+        struct node {
+          explicit node(const T &v) : value(v), next(NULL) {}
+          explicit node(T &&v) : value(std::move(v)), next(NULL) {}
+
+          T value;
+          // Set before the node is published and never after.
+          node *next;
+        };
+
+        void link(node *n) {
+          node *t = top_.load(memory_order_relaxed);
+          do {
+            n->next = t;
+          } while (! top_.compare_exchange_weak(t, n, memory_order_release, memory_order_relaxed));
+        }
+
+        epoch_domain &domain_;
+        aligned_atomic<node *> top_;
+    };
+
+    /*!
+    \ingroup grp_lfds
+    \brief Fixed capacity Treiber stack of the indices 0 to capacity() - 1.
+
+    This is a free list for a pool of pre-allocated objects: the links are an
+    array beside the objects so it never allocates and nothing needs
+    reclaiming.  Because the same indices are pushed again and again, the top
+    carries a version which every change increments, so a pop() which read a
+    link before someone else popped and pushed the same index fails its
+    compare and retries instead of corrupting the list (ABA).
+
+    Each index may only be in the stack once.  It starts with all of them in,
+    lowest on top, unless told to start empty.  push() and pop() are
+    lock-free, never block and never allocate, so the audio thread may use
+    them.  A push() releases and a pop() acquires, so whatever was written to
+    an object before its index was pushed is seen by whoever pops it.
+    */
+    class index_stack : boost::noncopyable {
+      public:
+        typedef uint32_t index_type;
+
+        //! \brief Throws std::bad_alloc.
+        explicit index_stack(std::size_t capacity, bool full = true)
+        : capacity_(capacity), next_(new atomic<uint32_t>[capacity]), top_(0) {
+          assert(capacity < 0xffffffffu);
+          if (full) {
+            for (std::size_t i = capacity; i > 0; --i) push((index_type) (i - 1));
+          }
+        }
+
+        void push(index_type i) {
+          assert(i < capacity_);
+          uint64_t t = top_.load(memory_order_relaxed);
+          do {
+            next_[i].store(link(t), memory_order_relaxed);
+          } while (! top_.compare_exchange_weak(t, make(version(t) + 1, i + 1),
+                                                memory_order_release, memory_order_relaxed));
+        }
+
+        //! \brief False if it's empty.
+        bool pop(index_type &ret) {
+          uint64_t t = top_.load(memory_order_acquire);
+          while (link(t)) {
+            const uint32_t i = link(t) - 1;
+            // Might be stale, but then the version has moved and the swap fails.
+            const uint32_t next = next_[i].load(memory_order_relaxed);
+            if (top_.compare_exchange_weak(t, make(version(t) + 1, next),
+                                           memory_order_acquire, memory_order_acquire)) {
+              ret = i;
+              return true;
+            }
+          }
+          return false;
+        }
+
+        bool empty() const { return link(top_.load(memory_order_acquire)) == 0; }
+
+        std::size_t capacity() const { return capacity_; }
+
+      private:
+        // The top is the version in the high half and the index + 1 (0 for none)
+        // in the low half, so it can be swapped in one go.
+        static uint32_t version(uint64_t t) { return (uint32_t) (t >> 32); }
+        static uint32_t link(uint64_t t) { return (uint32_t) t; }
+        static uint64_t make(uint32_t version, uint32_t link) { return ((uint64_t) version << 32) | link; }
+
+        const std::size_t capacity_;
+        // next_[i] is the link below index i.
+        boost::scoped_array<atomic<uint32_t> > next_;
+        aligned_atomic<uint64_t> top_;
+    };
+  }
+}
+
+#endif
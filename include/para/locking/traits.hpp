@@ -9,6 +9,8 @@
 #ifndef PARA_LOCKING_TRAITS_HPP_p16eecnl
 #define PARA_LOCKING_TRAITS_HPP_p16eecnl
 
+#include <para/locking/tuples.hpp>
+#include <para/locking/locked.hpp>
 #include <para/locking/monitors.hpp>
 #include <para/locking/timed_monitors.hpp>
 
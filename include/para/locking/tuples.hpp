@@ -26,7 +26,9 @@ namespace para {
       typedef Mutex lockable_type;
       typedef T     value_type;
 
-      sync_tuple(const value_type &data = value_type()) : data_(data) {}
+      //! \brief Default-construct the data; T need not be copyable.
+      sync_tuple() : data_() {}
+      sync_tuple(const value_type &data) : data_(data) {}
 
       lockable_type &mutex() { return mutex_; }
       const value_type &data() const { return data_; }
@@ -76,7 +78,9 @@ namespace para {
       typedef typename monitor_bind_type::lockable_type  lockable_type;
       typedef typename monitor_bind_type::value_type     value_type;
 
-      monitor_tuple(const T &data = T()) : sync_(data), monitor_sync_(sync_) {}
+      //! \brief Default-construct the data; T need not be copyable.
+      monitor_tuple() : sync_(), monitor_sync_(sync_) {}
+      monitor_tuple(const T &data) : sync_(data), monitor_sync_(sync_) {}
 
       const T &data() const { return monitor_sync_.data(); }
       T &data() { return monitor_sync_.data(); }
@@ -3,62 +3,815 @@
 
 /*!
 \file
+\ingroup grp_pipe
 \brief Multi-threaded pipe-framework.
 */
 
+#ifndef PARA_PIPE_HPP_r5wd2kq8
+#define PARA_PIPE_HPP_r5wd2kq8
+
+#include <para/atomic.hpp>
+#include <para/lfds/spsc_ring.hpp>
+#include <para/lfds/mpmc_queue.hpp>
+#include <para/lfds/adaptors.hpp>
+#include <para/locking/traits.hpp>
+
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+
+#include <algorithm>
+#include <exception>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <utility>
+
+#include <stdint.h>
+
 /*
 TODO:
-  We aim for
-
-  stage(prev, next)
-    x = pipe.pop
-    process(x)
-    pipe.push(y)
-  end
-
-  Here's how:
-
-  typedef std::queue<T> container_type; // or
-  typedef para::lfds::queue<T> container_type;
-  typedef unlocked_affector affector_type;
-  typedef monitor_affector affector_type;
-  typedef pipe<container_type, affector_type> pipe_type;
-
-  Tricky things:
-  - flushing the pipe
-  - being ok if nothing is returned
-    - we will use the same interface as lfds I suppose.
-  - checking attributes of the pipe
-  - limit the size of a pipe
-
-  Extensions:
-  - multiple people taking the same thing from one pipe
-    - needs a different pipe type I think.
+  Several threads running the same stage from one pipe (needs mpmc_channel on
+  both sides, and the order is lost).
 */
 
-/*
-Flushing the pipe:
-
-Method 1:
-- at the start of each stage monitor a `flush' variable.
-- stage must check the flushing status (they will prolly
-  need to check it anyway).
-- flush monitor could be done lock-free maybe?  It should
-  only be a boolean.
-- the trick is *stopping* processing while we flush rather
-  than actually notifying that the flush has happened.
-
-Method 2:
-- like method 1 but every stage has its own flush/pause
-  variable.
-*/
+namespace para {
+  /*!
+  \ingroup grp_pipe
+  \name Channels
 
+  What a pipe is made of.  Each has a queue<T>::type with the lfds failing
+  push() and pop(), and the traits<T>::type the lfds::blocking_adaptor waits
+  with.
+  */
+  //@{
 
-/*
-Branched stages.  One stage outputs to multiple pipes. (Of course
-taking from multiple pipes is easy).
+  //! \brief One stage pushes and one pops: lfds::spsc_ring.  The default, and
+  //! right for any pipe which joins two stages.
+  struct spsc_channel {
+    template <class T> struct queue { typedef lfds::spsc_ring<T> type; };
+    template <class T> struct traits { typedef typename lfds::default_sync_traits<T>::type type; };
+  };
 
-Method 1:
-- insert a coppier stage which writes to multiple pipes.
-*/
+  //! \brief Any number of pushing and popping stages: lfds::mpmc_queue.
+  struct mpmc_channel {
+    template <class T> struct queue { typedef lfds::mpmc_queue<T> type; };
+    template <class T> struct traits { typedef typename lfds::default_sync_traits<T>::type type; };
+  };
+
+  //! \brief A std::queue under a lock (lfds::locked_queue).
+  template <class Mutex = boost::mutex, class Lock = boost::unique_lock<Mutex>,
+            class Condition = boost::condition_variable>
+  struct locked_channel {
+    template <class T> struct traits { typedef sync_traits<T, Mutex, Lock, Condition> type; };
+    template <class T> struct queue { typedef lfds::locked_queue<T, typename traits<T>::type> type; };
+  };
+  //@}
+
+  namespace detail {
+    //! \brief A value and the pipeline epoch it was made in.
+    template <class T>
+    struct pipe_item {
+      pipe_item() : epoch(0) {}
+      T value;
+      uint32_t epoch;
+    };
+
+    //! \brief Add one to a counter only the calling thread writes.
+    inline void bump(atomic<uint64_t> &c) {
+      c.store(c.load(memory_order_relaxed) + 1, memory_order_relaxed);
+    }
+  }
+
+  /*!
+  \ingroup grp_pipe
+  \brief A bounded pipe of T between stages of a pipeline.
+
+  Pushing waits while it's full and popping while it's empty; that is the
+  backpressure which stops a fast stage running away from a slow one.  The
+  Channel decides what it's made of (spsc_channel, mpmc_channel or
+  locked_channel).  A pipe must outlive the pipeline it's used in.
+
+  T must be default constructible and move assignable.
+  */
+  template <class T, class Channel = spsc_channel>
+  class pipe : boost::noncopyable {
+    public:
+      typedef T value_type;
+      typedef detail::pipe_item<T> item_type;
+      typedef typename Channel::template queue<item_type>::type queue_type;
+      typedef typename Channel::template traits<item_type>::type traits_type;
+
+      //! \brief The queue may round \p capacity up.
+      explicit pipe(std::size_t capacity) : queue_(capacity) {}
+
+      std::size_t capacity() const { return queue_.queue().capacity(); }
+
+      //! \brief Only a snapshot while the stages are running.
+      std::size_t size() const { return queue_.queue().size(); }
+
+      //! \brief Closed by the stage which pushes to it when that finishes, or
+      //! by pipeline::stop().
+      bool closed() const { return queue_.closed(); }
+
+      //! \name Stage side
+      //! \p waited is incremented when the call had to wait.
+      //@{
+      bool push(item_type &&i, atomic<uint64_t> &waited) {
+        if (queue_.try_push(std::move(i))) return true;
+        if (queue_.closed()) return false;
+        detail::bump(waited);
+        return queue_.push(std::move(i));
+      }
+
+      //! \brief Never waits; false if it's full or closed.
+      bool try_push(item_type &&i) { return queue_.try_push(std::move(i)); }
+
+      bool pop(item_type &ret, atomic<uint64_t> &waited) {
+        if (queue_.try_pop(ret)) return true;
+        detail::bump(waited);
+        return queue_.pop(ret);
+      }
+
+      void close() { queue_.close(); }
+      //@}
+
+    private:
+      lfds::blocking_adaptor<queue_type, traits_type> queue_;
+  };
+
+  /*!
+  \ingroup grp_pipe
+  \brief What a pipeline counted for one stage.
+
+  \c starved counts the times the stage had to wait for its input and \c
+  stalled the times it had to wait for room in its output.  A stage which is
+  rarely starved while the one before it often stalls is the bottleneck.
+  */
+  struct pipe_stage_stats {
+    std::string name;
+    //! \brief Values taken from the input pipe and processed.
+    uint64_t in;
+    //! \brief Values pushed to the output pipe.
+    uint64_t out;
+    //! \brief Input values dropped because the pipeline was flushed.
+    uint64_t flushed;
+    //! \brief Output values dropped because a branch_drop pipe was full.
+    uint64_t dropped;
+    uint64_t starved;
+    uint64_t stalled;
+    //! \brief From the pipeline starting to this stage finishing (or now).
+    double seconds;
+  };
+
+  class pipeline;
+
+  template <class T, class Channel = spsc_channel> class outlet;
+  template <class T, class InChannel = spsc_channel> class branch_stage;
+
+  /*!
+  \ingroup grp_pipe
+  \brief What a branch_stage does when one of its pipes is full.
+  */
+  enum branch_policy {
+    //! \brief Wait for room, which holds back the other branches and the
+    //! stages before.
+    branch_block,
+    //! \brief Drop the value for this branch only, and count it.
+    branch_drop
+  };
+
+  namespace detail {
+    template <class Out, class OutChannel, class F> class source_stage;
+    template <class In, class InChannel, class Out, class OutChannel, class F> class filter_stage;
+    template <class In, class InChannel, class F> class sink_stage;
+  }
+
+  /*!
+  \ingroup grp_pipe
+  \brief One stage of a pipeline, running on its own thread.
+
+  Made by pipeline::source(), pipeline::filter() or pipeline::sink().
+  */
+  class pipe_stage : boost::noncopyable {
+    friend class pipeline;
+    template <class, class> friend class outlet;
+
+    public:
+      virtual ~pipe_stage() {}
+
+      const std::string &name() const { return name_; }
+
+      /*!
+      \brief Call \p f on this stage's thread when it notices the pipeline was
+      flushed: before it takes anything newer, or as it finishes.
+
+      For state past the end of the pipeline which has to be dropped too,
+      like a queue to the sound card.
+      */
+      pipe_stage &on_flush(const boost::function<void ()> &f) {
+        on_flush_ = f;
+        return *this;
+      }
+
+      /*!
+      \brief Take values from before a flush as if there had been none,
+      instead of dropping them.  Before the pipeline starts.
+
+      For a stage which must see everything, like one saving a copy of the
+      stream.  The on_flush() handler still runs.  A filter's results keep
+      the old epoch, so the stage after it still drops them unless it keeps
+      them too.
+      */
+      pipe_stage &keep_flushed(bool keep = true) {
+        keep_flushed_ = keep;
+        return *this;
+      }
+
+    protected:
+      //! \brief Where a stage is, for pipeline::pause().
+      enum state_type { st_running, st_waiting, st_parked, st_finished };
+
+      inline explicit pipe_stage(pipeline &p, const std::string &name);
+
+      //! \brief The stage's whole life.  Returns when its input is closed and
+      //! empty, or for a source when its function returns.
+      virtual void run() = 0;
+
+      //! \brief Close the pipes this stage touches.
+      virtual void close() = 0;
+
+      //! \brief Not at work: waiting on a pipe.
+      void waiting() { state_.store(st_waiting, memory_order_seq_cst); }
+
+      //! \brief About to work.  Parks here while the pipeline is paused.
+      inline void working();
+
+      //! \brief Run the flush handler if the epoch moved.  Returns the epoch.
+      uint32_t check_flush() {
+        const uint32_t e = current_epoch();
+        if (e != seen_epoch_) {
+          seen_epoch_ = e;
+          if (on_flush_) on_flush_();
+        }
+        return e;
+      }
+
+      //! \brief Run the flush handler if the epoch moved.  True if \p epoch
+      //! is from before a flush and this stage drops such values.
+      bool flushed(uint32_t epoch) { return epoch != check_flush() && ! keep_flushed_; }
+
+      inline uint32_t current_epoch() const;
+
+      pipeline &pipeline_;
+      const std::string name_;
+      boost::function<void ()> on_flush_;
+      uint32_t seen_epoch_;
+      bool keep_flushed_;
+
+      atomic<int> state_;
+      atomic<uint64_t> in_;
+      atomic<uint64_t> out_;
+      atomic<uint64_t> flushed_;
+      atomic<uint64_t> dropped_;
+      atomic<uint64_t> starved_;
+      atomic<uint64_t> stalled_;
+      atomic<uint64_t> finished_us_;
+  };
+
+  /*!
+  \ingroup grp_pipe
+  \brief Where a source or filter pushes its results.
+  */
+  template <class T, class Channel>
+  class outlet : boost::noncopyable {
+    public:
+      typedef T value_type;
+
+      //! \brief Waits for room.  False when the pipe was closed, because the
+      //! pipeline is stopping; a source should return then.
+      bool push(T &&v) {
+        typename pipe<T, Channel>::item_type i;
+        i.value = std::move(v);
+        i.epoch = epoch_ ? *epoch_ : stage_.current_epoch();
+        stage_.waiting();
+        const bool ok = pipe_.push(std::move(i), stage_.stalled_);
+        stage_.working();
+        if (ok) detail::bump(stage_.out_);
+        return ok;
+      }
+
+      bool push(const T &v) {
+        T copy(v);
+        return push(std::move(copy));
+      }
+
+    private:
+      template <class, class, class> friend class detail::source_stage;
+      template <class, class, class, class, class> friend class detail::filter_stage;
+
+      //! \brief A source's outlet tags values with the epoch when they're
+      //! pushed; a filter's with the epoch of the input (\p epoch).
+      outlet(pipe_stage &stage, pipe<T, Channel> &p, const uint32_t *epoch)
+      : stage_(stage), pipe_(p), epoch_(epoch) {}
+
+      pipe_stage &stage_;
+      pipe<T, Channel> &pipe_;
+      const uint32_t *epoch_;
+  };
+
+  /*!
+  \ingroup grp_pipe
+  \brief Stages joined by pipes, each stage on its own thread.
+
+  \code
+  para::pipe<period> raw(2), done(2);
+  para::pipeline line;
+  line.source("generate", generator(), raw);   // void f(para::outlet<period> &)
+  line.filter("meter", meter(), raw, done);    // void f(period &, para::outlet<period> &)
+  line.sink("play", player(), done);           // void f(period &)
+  line.run();
+  \endcode
+
+  A source is called once and pushes as much as it likes.  A filter is
+  called for each value and pushes any number of results; a sink is called
+  for each value.  The functions are copied.  A branch gives each value to
+  several pipes; see branch_stage.  When a source returns its pipe
+  is closed, and each stage after it finishes when its input is closed and
+  empty, closing its own output, so the whole line drains in order.
+
+  flush() drops everything in the pipes: values are tagged with an epoch as
+  they enter, and the next stage to take one from an earlier epoch drops it
+  instead of processing it, unless it was made with
+  pipe_stage::keep_flushed().  Each stage's pipe_stage::on_flush() handler
+  runs on its own thread when it sees the new epoch.  A flush costs one
+  store and never waits.
+
+  pause() stops every stage when it next takes or pushes a value, and waits
+  until none is working; resume() lets them go again.
+
+  If a stage's function throws, the pipeline is stopped and wait() (or
+  run()) rethrows the first exception once all the threads have finished.
+  */
+  class pipeline : boost::noncopyable {
+    friend class pipe_stage;
+
+    public:
+      pipeline() : epoch_(0), paused_(false), started_(false) {}
+
+      //! \brief Stops and joins anything still running.
+      ~pipeline() {
+        if (started_) {
+          stop();
+          threads_.join_all();
+        }
+      }
+
+      //! \name Building
+      //! Add stages before starting.  The pipes must outlive the pipeline.
+      //@{
+      template <class Out, class Channel, class F>
+      pipe_stage &source(const std::string &name, F f, pipe<Out, Channel> &out);
+
+      template <class In, class InChannel, class Out, class OutChannel, class F>
+      pipe_stage &filter(const std::string &name, F f, pipe<In, InChannel> &in, pipe<Out, OutChannel> &out);
+
+      template <class In, class Channel, class F>
+      pipe_stage &sink(const std::string &name, F f, pipe<In, Channel> &in);
+
+      //! \brief Copy each value from \p in to every pipe added with
+      //! branch_stage::to().
+      template <class T, class Channel>
+      branch_stage<T, Channel> &branch(const std::string &name, pipe<T, Channel> &in);
+      //@}
+
+      //! \name Running
+      //@{
+
+      //! \brief Start every stage on a thread of its own.
+      void start() { start_threads(NULL); }
+
+      /*!
+      \brief Run the first stage on the calling thread and the rest on their
+      own, then wait().
+
+      So the first stage keeps the caller's priority, CPU affinity and
+      per-thread state; the other threads are started first, and inherit
+      whatever the caller had then.
+      */
+      void run() {
+        pipe_stage *first = stages_.empty() ? NULL : stages_.front().get();
+        start_threads(first);
+        if (first) run_stage(first);
+        wait();
+      }
+
+      //! \brief Join every stage.  Rethrows the first exception a stage threw.
+      void wait() {
+        threads_.join_all();
+        started_ = false;
+        boost::lock_guard<boost::mutex> lk(mutex_);
+        if (error_) {
+          std::exception_ptr e = error_;
+          error_ = std::exception_ptr();
+          std::rethrow_exception(e);
+        }
+      }
+
+      //! \brief Drop what's in the pipes and close them all, so every stage
+      //! finishes soon.  A source finds out when its push() fails.
+      void stop() {
+        flush();
+        for (std::size_t i = 0; i < stages_.size(); ++i) stages_[i]->close();
+        resume();
+      }
+      //@}
+
+      //! \name Control
+      //! Any thread.
+      //@{
+
+      //! \brief Drop everything pushed so far.
+      void flush() { epoch_.fetch_add(1, memory_order_release); }
+
+      uint32_t epoch() const { return epoch_.load(memory_order_acquire); }
+
+      //! \brief Returns when no stage is working.  Stages waiting on a pipe
+      //! count as not working.
+      void pause() {
+        paused_.store(true, memory_order_seq_cst);
+        boost::unique_lock<boost::mutex> lk(mutex_);
+        while (working()) {
+          // Timed: stages only lock to park, not to wait on a pipe.
+          cond_.timed_wait(lk, boost::get_system_time() + boost::posix_time::milliseconds(1));
+        }
+      }
+
+      void resume() {
+        {
+          boost::lock_guard<boost::mutex> lk(mutex_);
+          paused_.store(false, memory_order_seq_cst);
+        }
+        cond_.notify_all();
+      }
+
+      bool paused() const { return paused_.load(memory_order_acquire); }
+      //@}
+
+      //! \name Statistics
+      //@{
+
+      //! \brief A snapshot while running; exact after wait().
+      std::vector<pipe_stage_stats> stats() const {
+        std::vector<pipe_stage_stats> r;
+        for (std::size_t i = 0; i < stages_.size(); ++i) {
+          const pipe_stage &s = *stages_[i];
+          pipe_stage_stats st;
+          st.name = s.name_;
+          st.in = s.in_.load();
+          st.out = s.out_.load();
+          st.flushed = s.flushed_.load();
+          st.dropped = s.dropped_.load();
+          st.starved = s.starved_.load();
+          st.stalled = s.stalled_.load();
+          const uint64_t us = s.finished_us_.load();
+          st.seconds = (us ? us : elapsed_us()) / 1e6;
+          r.push_back(st);
+        }
+        return r;
+      }
+
+      //! \brief A line for each stage, each starting with \p indent.
+      void print(std::ostream &o, const char *indent = "") const {
+        const std::vector<pipe_stage_stats> st = stats();
+        for (std::size_t i = 0; i < st.size(); ++i) {
+          o << indent << st[i].name << ": " << st[i].in << " in, " << st[i].out << " out";
+          if (st[i].seconds > 0) o << " (" << (st[i].in > st[i].out ? st[i].in : st[i].out) / st[i].seconds << "/s)";
+          o << ", " << st[i].flushed << " flushed";
+          if (st[i].dropped) o << ", " << st[i].dropped << " dropped";
+          o << "; waited for input " << st[i].starved
+            << " times and for output " << st[i].stalled << " times." << std::endl;
+        }
+      }
+      //@}
+
+    private:
+      bool working() const {
+        for (std::size_t i = 0; i < stages_.size(); ++i) {
+          if (stages_[i]->state_.load(memory_order_seq_cst) == pipe_stage::st_running) return true;
+        }
+        return false;
+      }
+
+      uint64_t elapsed_us() const {
+        return started_ ? (boost::get_system_time() - start_time_).total_microseconds() : 0;
+      }
+
+      void start_threads(pipe_stage *except) {
+        start_time_ = boost::get_system_time();
+        started_ = true;
+        for (std::size_t i = 0; i < stages_.size(); ++i) {
+          if (stages_[i].get() != except) {
+            threads_.create_thread(boost::bind(&pipeline::run_stage, this, stages_[i].get()));
+          }
+        }
+      }
+
+      void run_stage(pipe_stage *s) {
+        try {
+          s->working();
+          s->run();
+        }
+        catch (...) {
+          {
+            boost::lock_guard<boost::mutex> lk(mutex_);
+            if (! error_) error_ = std::current_exception();
+          }
+          stop();
+        }
+        s->close();
+        s->finished_us_.store(std::max<uint64_t>(1, elapsed_us()));
+        s->state_.store(pipe_stage::st_finished, memory_order_seq_cst);
+      }
+
+      template <class Stage>
+      Stage &add(Stage *s) {
+        stages_.push_back(boost::shared_ptr<pipe_stage>(s));
+        return *s;
+      }
+
+      std::vector<boost::shared_ptr<pipe_stage> > stages_;
+      boost::thread_group threads_;
+
+      atomic<uint32_t> epoch_;
+      atomic<bool> paused_;
+      boost::mutex mutex_;
+      boost::condition_variable cond_;
+      std::exception_ptr error_;
+
+      bool started_;
+      boost::system_time start_time_;
+  };
+
+  inline pipe_stage::pipe_stage(pipeline &p, const std::string &name)
+  : pipeline_(p), name_(name), seen_epoch_(p.epoch()), keep_flushed_(false), state_(st_waiting) {}
+
+  inline uint32_t pipe_stage::current_epoch() const { return pipeline_.epoch(); }
+
+  inline void pipe_stage::working() {
+    // Pairs with pause(): either it sees us running or we see it paused.
+    state_.store(st_running, memory_order_seq_cst);
+    if (! pipeline_.paused_.load(memory_order_seq_cst)) return;
+
+    boost::unique_lock<boost::mutex> lk(pipeline_.mutex_);
+    state_.store(st_parked, memory_order_seq_cst);
+    pipeline_.cond_.notify_all();
+    while (pipeline_.paused_.load(memory_order_seq_cst)) pipeline_.cond_.wait(lk);
+    state_.store(st_running, memory_order_seq_cst);
+  }
+
+  namespace detail {
+    template <class Out, class OutChannel, class F>
+    class source_stage : public pipe_stage {
+      public:
+        source_stage(pipeline &p, const std::string &name, F f, pipe<Out, OutChannel> &out)
+        : pipe_stage(p, name), f_(f), out_pipe_(out) {}
+
+      protected:
+        void run() {
+          outlet<Out, OutChannel> o(*this, out_pipe_, NULL);
+          f_(o);
+          check_flush();
+        }
+
+        void close() { out_pipe_.close(); }
+
+      private:
+        F f_;
+        pipe<Out, OutChannel> &out_pipe_;
+    };
+
+    template <class In, class InChannel, class Out, class OutChannel, class F>
+    class filter_stage : public pipe_stage {
+      public:
+        filter_stage(pipeline &p, const std::string &name, F f, pipe<In, InChannel> &in,
+                     pipe<Out, OutChannel> &out)
+        : pipe_stage(p, name), f_(f), in_pipe_(in), out_pipe_(out) {}
+
+      protected:
+        void run() {
+          typename pipe<In, InChannel>::item_type i;
+          outlet<Out, OutChannel> o(*this, out_pipe_, &i.epoch);
+          for (;;) {
+            waiting();
+            if (! in_pipe_.pop(i, starved_)) break;
+            working();
+            if (flushed(i.epoch)) {
+              bump(flushed_);
+              continue;
+            }
+            bump(in_);
+            f_(i.value, o);
+            // Let go of whatever's left now, not at the next pop.
+            i.value = In();
+          }
+          check_flush();
+        }
+
+        void close() {
+          in_pipe_.close();
+          out_pipe_.close();
+        }
+
+      private:
+        F f_;
+        pipe<In, InChannel> &in_pipe_;
+        pipe<Out, OutChannel> &out_pipe_;
+    };
+
+    template <class In, class InChannel, class F>
+    class sink_stage : public pipe_stage {
+      public:
+        sink_stage(pipeline &p, const std::string &name, F f, pipe<In, InChannel> &in)
+        : pipe_stage(p, name), f_(f), in_pipe_(in) {}
+
+      protected:
+        void run() {
+          typename pipe<In, InChannel>::item_type i;
+          for (;;) {
+            waiting();
+            if (! in_pipe_.pop(i, starved_)) break;
+            working();
+            if (flushed(i.epoch)) {
+              bump(flushed_);
+              continue;
+            }
+            bump(in_);
+            f_(i.value);
+            i.value = In();
+          }
+          check_flush();
+        }
+
+        void close() { in_pipe_.close(); }
+
+      private:
+        F f_;
+        pipe<In, InChannel> &in_pipe_;
+    };
+  }
+
+  /*!
+  \ingroup grp_pipe
+  \brief Fan-out: each value from the input is pushed to every output.
+
+  \code
+  line.branch("fan-out", decoded).to(to_speaker).to(to_meter, para::branch_drop);
+  \endcode
+
+  Every branch but the last gets a copy of the value, and the last gets the
+  value itself, so T should be a cheap handle to data which is shared and
+  not changed, like a reference counted buffer.  Then the data is never
+  copied, however many branches there are.
+
+  Each branch has its own branch_policy for when its pipe is full.  A
+  branch_block pipe holds everything back until there's room; a branch_drop
+  pipe misses the value, so a slow meter or network relay can't hold up
+  playback.
+
+  After a flush the older values go only to the branches added with \p
+  keep_flushed, for a stage made with pipe_stage::keep_flushed() to take;
+  the rest never see them.  keep_flushed() on the branch stage itself
+  passes them to every branch.
+  */
+  template <class T, class InChannel>
+  class branch_stage : public pipe_stage {
+    friend class pipeline;
+
+    public:
+      //! \brief Add a branch.  Before the pipeline starts.  \p keep_flushed
+      //! passes on values from before a flush too.
+      template <class OutChannel>
+      branch_stage &to(pipe<T, OutChannel> &out, branch_policy policy = branch_block,
+                       bool keep_flushed = false) {
+        targets_.push_back(boost::shared_ptr<target>(new channel_target<OutChannel>(out, policy, keep_flushed)));
+        if (keep_flushed) ++keepers_;
+        return *this;
+      }
+
+      std::size_t branches() const { return targets_.size(); }
+
+      //! \brief Values \p branch missed because its pipe was full.
+      uint64_t dropped(std::size_t branch) const { return targets_[branch]->dropped.load(); }
+
+    protected:
+      branch_stage(pipeline &p, const std::string &name, pipe<T, InChannel> &in)
+: pipe_stage(p, name), in_pipe_(in), keepers_(0) {}
+
+      void run() {
+        item_type i;
+        for (;;) {
+          waiting();
+          if (! in_pipe_.pop(i, starved_)) break;
+          working();
+          const bool stale = flushed(i.epoch);
+          std::size_t left = stale ? keepers_ : targets_.size();
+          if (! left) {
+            detail::bump(flushed_);
+            continue;
+          }
+          detail::bump(in_);
+          for (std::size_t b = 0; b < targets_.size(); ++b) {
+            if (stale && ! targets_[b]->keep_flushed) continue;
+            if (--left) {
+              item_type copy(i);
+              give(*targets_[b], std::move(copy));
+            }
+            else {
+              give(*targets_[b], std::move(i));
+            }
+          }
+          // Still here if the last branch dropped it.
+          i.value = T();
+        }
+        check_flush();
+      }
+
+      void close() {
+        in_pipe_.close();
+        for (std::size_t b = 0; b < targets_.size(); ++b) targets_[b]->close();
+      }
+
+    private:
+      typedef typename pipe<T, InChannel>::item_type item_type;
+
+      //! \brief One output, whatever its channel.
+      struct target : boost::noncopyable {
+        target(branch_policy p, bool keep) : policy(p), keep_flushed(keep) {}
+        virtual ~target() {}
+        virtual bool try_push(item_type &&i) = 0;
+        virtual bool push(item_type &&i, atomic<uint64_t> &waited) = 0;
+        virtual void close() = 0;
+
+        const branch_policy policy;
+        const bool keep_flushed;
+        atomic<uint64_t> dropped;
+      };
+
+      template <class OutChannel>
+      struct channel_target : target {
+        channel_target(pipe<T, OutChannel> &out, branch_policy p, bool keep) : target(p, keep), out(out) {}
+        bool try_push(item_type &&i) { return out.try_push(std::move(i)); }
+        bool push(item_type &&i, atomic<uint64_t> &waited) { return out.push(std::move(i), waited); }
+        void close() { out.close(); }
+
+        pipe<T, OutChannel> &out;
+      };
+
+      void give(target &t, item_type &&i) {
+        bool ok;
+        if (t.policy == branch_drop) {
+          ok = t.try_push(std::move(i));
+          if (! ok) {
+            detail::bump(t.dropped);
+            detail::bump(dropped_);
+          }
+        }
+        else {
+          waiting();
+          ok = t.push(std::move(i), stalled_);
+          working();
+        }
+        if (ok) detail::bump(out_);
+      }
+
+      pipe<T, InChannel> &in_pipe_;
+      std::vector<boost::shared_ptr<target> > targets_;
+      std::size_t keepers_;
+  };
+
+  template <class Out, class Channel, class F>
+  pipe_stage &pipeline::source(const std::string &name, F f, pipe<Out, Channel> &out) {
+    return add(new detail::source_stage<Out, Channel, F>(*this, name, f, out));
+  }
+
+  template <class In, class InChannel, class Out, class OutChannel, class F>
+  pipe_stage &pipeline::filter(const std::string &name, F f, pipe<In, InChannel> &in, pipe<Out, OutChannel> &out) {
+    return add(new detail::filter_stage<In, InChannel, Out, OutChannel, F>(*this, name, f, in, out));
+  }
+
+  template <class In, class Channel, class F>
+  pipe_stage &pipeline::sink(const std::string &name, F f, pipe<In, Channel> &in) {
+    return add(new detail::sink_stage<In, Channel, F>(*this, name, f, in));
+  }
+
+  template <class T, class Channel>
+  branch_stage<T, Channel> &pipeline::branch(const std::string &name, pipe<T, Channel> &in) {
+    return add(new branch_stage<T, Channel>(*this, name, in));
+  }
+}
 
+#endif
@@ -8,19 +8,56 @@
 #include <cstdlib>
 #include <cmath>
 #include <limits>
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+#include <cstring>
+#include <cassert>
+
+#include <stdint.h>
 
 // #include <bdbg/trace/short_macros.hpp>
 
 #include "sdl.hpp"
+#include "sine_kernels.hpp"
+#include "sample_formats.hpp"
+#include "period_pool.hpp"
+
+//! \brief Interface for the wave calculations which sample_generator can use.
+//! Implementations are picked at runtime; see main().
+class oscillator {
+  public:
+    virtual ~oscillator() {}
+
+    //! \brief Change the note and start the wave again from phase 0.
+    virtual void reset_wave(double frequency) = 0;
+
+    //! \brief Write the next \p frames full-scale signed 16 bit samples.
+    virtual void fill(int16_t *out, std::size_t frames) = 0;
+
+    //! \brief Write the next \p frames samples between -1 and 1.
+    virtual void fill_normalised(double *out, std::size_t frames) = 0;
+
+    //! \brief Move to \p frame frames after the start of the note.  What is
+    //! calculated next is exactly what it would have been had the frames been
+    //! generated.  This is how a note is split up between threads.
+    virtual void seek(uint64_t frame) = 0;
+
+    //! \brief New copy with the same settings and state.
+    virtual oscillator *clone() const = 0;
+};
 
 //! \brief Stateful calculation context.
-class sine_calculation {
+//! The position on the wave is worked out from the number of frames since the
+//! start of the note, so sample n is always sin(n * speed) however the note was
+//! split up.
+class sine_calculation : public oscillator {
   public:
 
     //! \brief reset_wave() must be called after this to set the note.
     sine_calculation(double output_frequency, double amplitude = 0.75)
     : output_frequency_(output_frequency), note_frequency_(0),
-      amplitude_(amplitude), sine_pos_(0), sine_speed_(0) { }
+      amplitude_(amplitude), frame_(0), sine_speed_(0) { }
 
     //! \brief Set sound properties and note properties; recalculate state.
     void reset(double output_frequency, double note_frequency, double amplitude) {
@@ -50,7 +87,7 @@ class sine_calculation {
 
     //! \brief Based on the properties, recalculate the speed and set sine position to 0.
     void reset_state() {
-      sine_pos_ = 0;
+      frame_ = 0;
       sine_speed_ = 2 * M_PI * note_frequency_ / output_frequency_;
     }
 
@@ -62,15 +99,53 @@ class sine_calculation {
       return ret;
     }
 
+    //! \brief Write the next \p frames normalised samples to \p out in one go.
+    //! This evaluates the sine in blocks with sine_kernels::fill() instead of
+    //! libm per sample.  Values may differ from next_sample() by one unit.
+    template <class SampleUnit>
+    void fill(SampleUnit *out, std::size_t frames) {
+      fill_scaled(out, frames, amplitude_ * std::numeric_limits<SampleUnit>::max());
+    }
+
+    void fill(int16_t *out, std::size_t frames) { fill<int16_t>(out, frames); }
+
+    void fill_normalised(double *out, std::size_t frames) { fill_scaled(out, frames, amplitude_); }
+
+    void seek(uint64_t frame) { frame_ = frame; }
+
+    oscillator *clone() const { return new sine_calculation(*this); }
+
   protected:
     //! \brief Value of y between -1 and 1.
     double y() const {
-      return amplitude_ * std::sin(sine_pos_);
+      return amplitude_ * std::sin(frame_ * sine_speed_);
     }
 
     //! \brief Move to the next x-axis sample position.
     void increment() {
-      sine_pos_ += sine_speed_;
+      ++frame_;
+    }
+
+    //! \brief Block evaluation of sin() * scale for fill().
+    //! Blocks are aligned to multiples of block_size frames from the start of
+    //! the note so the result doesn't depend on how the calls are split.
+    template <class Out>
+    void fill_scaled(Out *out, std::size_t frames, double scale) {
+      const std::size_t block_size = 64;
+      double block[block_size];
+
+      while (frames > 0) {
+        const std::size_t n = std::min(frames, block_size - (std::size_t) (frame_ % block_size));
+        // The reduction keeps the kernels' range reduction cheap and accurate.
+        const double pos = std::fmod(frame_ * sine_speed_, 2 * M_PI);
+        sine_kernels::fill(block, n, pos, sine_speed_, scale);
+        for (std::size_t i = 0; i < n; ++i) {
+          out[i] = block[i];
+        }
+        frame_ += n;
+        out += n;
+        frames -= n;
+      }
     }
 
   private:
@@ -79,29 +154,55 @@ class sine_calculation {
     double note_frequency_;
     double amplitude_;
 
-    double sine_pos_;
+    // Frames since the start of the note.
+    uint64_t frame_;
     double sine_speed_;
 };
 
-#include <cmath> // nearbyint
-#include <algorithm> // max()
+//! \brief A whole number of frames holding a whole number of cycles.
+struct wave_cycle {
+  uint32_t frames;
+  //! \brief The frequency which fits exactly.
+  double frequency;
+};
+
+/*!
+\brief Shortest loop of \p freq at \p rate which is within \p max_error_cents.
+
+A pure tone repeats exactly after n frames when n * freq / rate is whole.
+Most frequencies don't for a long time (or ever), so the frequency is rounded
+to the nearest one which does.  If nothing up to \p max_frames is that close
+then the closest is used.
+*/
+inline wave_cycle find_cycle(double freq, uint32_t rate, uint32_t max_frames, double max_error_cents) {
+  assert(freq > 0 && rate > 0 && max_frames > 0);
+  const double max_error = std::pow(2.0, max_error_cents / 1200) - 1;
+
+  wave_cycle best = {max_frames, freq};
+  double best_error = std::numeric_limits<double>::max();
+  for (uint32_t n = 1; n <= max_frames; ++n) {
+    const double cycles = (double) n * freq / rate;
+    const double whole = nearbyint(cycles);
+    if (whole < 1) continue;
+
+    // Relative error of the frequency.
+    const double error = std::fabs(cycles - whole) / cycles;
+    if (error < best_error) {
+      best.frames = n;
+      best.frequency = whole * rate / n;
+      best_error = error;
+      if (error <= max_error) break;
+    }
+  }
+  return best;
+}
 
-// TODO:
-//   memory pool this later - return a special auto ptr with a ref to the
-//   memory pool perhaps?
-// TODO:
-//   need sample rate and stuff.
 //! \brief Keep popping correct-sized buffers until we've made up the right timespan of sinewaves.
+//! This is the format-independent part; use make_sample_generator() to get one
+//! for the device's sample format.
 class sample_generator {
   public:
-    sample_generator(sine_calculation &calc, const sdl::audio_spec &spec)
-    : calc_(calc), channels_(spec.channels()), buffer_size_(spec.buffer_size()),
-      buffer_samples_(spec.buffer_samples() * spec.channels()), buffer_index_(0),
-      total_samples_(0) {
-      buffer_ = (uint8_t*)std::malloc(spec.buffer_size());
-    }
-    ~sample_generator() { std::free(buffer_); }
-
+    virtual ~sample_generator() {}
 
     //! \brief Change the remaining time to play the sine wave.
     void reset_time(int64_t time_ms) {
@@ -110,12 +211,71 @@ class sample_generator {
       // this could be optimised - we are recalculating the buffer size every time here.  Better to just
       // use reset_bytes()
 
-      total_samples_ = nearbyint((time_ms * 44100) / 1000);
+      total_samples_ = frames_for(time_ms);
+      replay_ = NULL;
+      record_ = NULL;
+      forever_ = false;
       // trc("total_samples: " << total_samples_);
 
       // TODO: due to rounding errors (?) this equality doesn't always hold.
-      // wassert_eq((total_samples_ * 1000) / 44100, time_ms);
+      // wassert_eq((total_samples_ * 1000) / frequency_, time_ms);
+
+    }
+
+    //! \brief Like reset_time() but in frames.
+    void reset_frames(uint32_t frames) {
+      total_samples_ = frames;
+      replay_ = NULL;
+      record_ = NULL;
+      forever_ = false;
+    }
+
+    //! \brief Longest loop reset_forever() will look for.
+    static const uint32_t max_cycle_seconds = 10;
+
+    /*!
+    \brief Play \p freq until the next reset.
+
+    One loop of the wave is calculated (see find_cycle()) and then
+    get_samples() only copies it, so a note which lasts forever costs almost
+    nothing.  The frequency may be changed by up to \p max_error_cents so
+    that the loop joins up exactly.  This resets the oscillator.  There is no
+    remaining time: get_silence() ends the note without writing anything.
+    */
+    void reset_forever(double freq, double max_error_cents) {
+      make_loop(calc_, freq, max_error_cents, cycle_);
+      start_loop();
+    }
+
+    //! \brief The loop reset_forever() would play, calculated with \p calc
+    //! into \p into.  It doesn't touch the generator, so any thread may do it
+    //! while another plays; see play_loop().
+    void make_loop(oscillator &calc, double freq, double max_error_cents, std::vector<uint8_t> &into) const {
+      const wave_cycle c = find_cycle(freq, frequency_, frequency_ * max_cycle_seconds, max_error_cents);
+      // At least a period long so a period is never more than two copies.
+      const std::size_t repeats = (buffer_frames() + c.frames - 1) / c.frames;
+      const std::size_t frames = c.frames * repeats;
+
+      calc.reset_wave(c.frequency);
+      into.resize(frames * frame_size());
+      calculate(calc, &into[0], frames);
+    }
 
+    //! \brief Like reset_forever() with a loop from make_loop(), which is
+    //! swapped with the old one, so nothing is calculated or allocated.
+    void play_loop(std::vector<uint8_t> &loop) {
+      assert(! loop.empty());
+      cycle_.swap(loop);
+      start_loop();
+    }
+
+    //! \brief True after reset_forever().
+    bool forever() const { return forever_; }
+
+    //! \brief Frames reset_time() would give for \p time_ms.
+    uint32_t frames_for(int64_t time_ms) const {
+      assert(time_ms > 0);
+      return nearbyint((time_ms * frequency_) / 1000);
     }
 
     // TODO:
@@ -123,97 +283,326 @@ class sample_generator {
     //   us pulling from here and then pushing back again.
 
     //! \brief Return output samples until the time is fullfiled.
-    void *get_samples() {
+    period_buffer get_samples() {
       // trc("get samples: " << total_samples_);
+      buffer_index_ += write_samples(buffer_position(), buffer_frames_left()) * channels_;
+      return buffer_or_null();
+    }
 
-      // TODO: different sized samples?
+    //! \brief Return silence samples until the time is fullfiled.
+    period_buffer get_silence() {
+      assert(buffer_samples_ >= buffer_index_);
+      // A forever note has no time left to fill; it just stops.
+      forever_ = false;
+      buffer_index_ += fill_silence(buffer_position(), buffer_frames_left()) * channels_;
+      return buffer_or_null();
+    }
 
-      // TODO:
-      //   Somehow we need to wait until samp is `near' zero so there is no audio pop.
-      //   It might mean returning an entirely new buffer?  It means that samp needs to
-      //   be a member variable, then we do total_samples_ <= 0 && samp_ near zero.  so
-      //   total_samples_ needs to become signed but we need to be careful that it doesn't
-      //   reach less than zero after this function, otherwise get_silence will be broken.
-      //   Also we need to be careful about volume - if the volume is zero (or near zero)
-      //   then many samples will seem like they are the end.  That *should* be ok, but
-      //   it won't solve the popping problem.
+    //! \name Writing to any buffer
+    //! These are what get_samples() and get_silence() use.  They can also be
+    //! used to write straight to a device's buffer.
+    //@{
 
-      int16_t *samples = (int16_t *) buffer_;
-      while (buffer_index_ < buffer_samples_) {
-        int16_t samp = calc_.next_sample<int16_t>();
-        for (std::size_t ch = 0; ch < channels_; ++ch) {
-          samples[buffer_index_ ++] = samp;
-        }
-        total_samples_--;
+    //! \brief Write up to \p max_frames of the note however it's being made:
+    //! calculated, replayed or looped.  Returns the frames written.
+    std::size_t write_samples(void *dest, std::size_t max_frames) {
+      if (forever_) {
+        return copy_cycle(dest, max_frames);
+      }
+      else if (replay_) {
+        return copy_samples(dest, max_frames);
+      }
 
-        if (total_samples_ == 0) {
-          return NULL;
-        }
+      const std::size_t frames = fill_samples(dest, max_frames);
+      if (record_) {
+        const uint8_t *p = (const uint8_t *) dest;
+        record_->insert(record_->end(), p, p + frames * frame_size());
       }
+      return frames;
+    }
 
-      return reset();
+    //! \brief Write up to \p max_frames of the note to \p dest.  Returns the
+    //! number of frames written, which is less if the time ran out.
+    virtual std::size_t fill_samples(void *dest, std::size_t max_frames) = 0;
+
+    //! \brief Like fill_samples() but writes silence.
+    virtual std::size_t fill_silence(void *dest, std::size_t max_frames) = 0;
+
+    //! \brief Write the next \p frames of \p calc's wave regardless of the
+    //! remaining time.
+    virtual void calculate(oscillator &calc, void *dest, std::size_t frames) const = 0;
+
+    //! \brief Write \p frames of silence regardless of the remaining time.
+    virtual void silence(void *dest, std::size_t frames) const = 0;
+    //@}
+
+    //! \name Reusing a rendered note
+    //! For the note_cache.  Both only last until the next reset_time() or
+    //! reset_frames().
+    //@{
+
+    //! \brief Make get_samples() copy from \p frames, which holds at least
+    //! remaining_frames(), instead of calculating anything.
+    void replay(const uint8_t *frames) { replay_ = frames; }
+
+    //! \brief Make get_samples() append what it calculates to \p into.
+    void record(std::vector<uint8_t> *into) { record_ = into; }
+    //@}
+
+    //! \brief Another generator of the same format using \p calc.  It takes its
+    //! period from the same pool.
+    virtual sample_generator *clone(oscillator &calc) const = 0;
+
+    //! \brief Frames left before the time set by reset_time() is fulfilled.
+    uint32_t remaining_frames() const { return total_samples_; }
+
+    //! \brief Bytes in each buffer returned.
+    std::size_t buffer_size() const { return buffer_size_; }
+
+    //! \brief Bytes in one frame (a sample for every channel).
+    std::size_t frame_size() const { return sample_size_ * channels_; }
+
+  protected:
+    sample_generator(oscillator &calc, period_pool &pool, uint32_t frequency, unsigned int channels,
+                     std::size_t buffer_frames, std::size_t sample_size)
+    : calc_(calc), frequency_(frequency), channels_(channels), total_samples_(0),
+      pool_(pool), sample_size_(sample_size),
+      buffer_size_(buffer_frames * channels * sample_size),
+      buffer_samples_(buffer_frames * channels), buffer_index_(0),
+      replay_(NULL), record_(NULL), forever_(false), cycle_pos_(0) {
+      assert(pool.buffer_size() >= buffer_size_);
+      buffer_ = pool_.acquire();
     }
 
-    //! \brief Return silence samples until the time is fullfiled.
-    void *get_silence() {
-      // TODO: use the sdl audio silence value
-      const int16_t silence_value = 0;
+    oscillator &calc_;
+    const uint32_t frequency_;
+    const unsigned int channels_;
 
-      assert(buffer_samples_ >= buffer_index_);
-      const uint32_t available = buffer_samples_ - buffer_index_;
-      const uint32_t silence_samples = std::min(available, total_samples_);
-      const std::size_t silence_bytes = silence_samples * sizeof(int16_t);
+    // Samples per period.
+    uint32_t total_samples_;
 
-      // trc("left over bytes in the buffer: " << available);
-      // trc("total samples to fill: " << total_samples_);
-      // trc("samples to write: " << silence_samples);
-      // trc("bytes to write: " << silence_bytes);
+    period_pool &pool_;
 
-      assert(total_samples_ >= silence_samples);
+    std::size_t buffer_frames() const { return buffer_samples_ / channels_; }
 
-      int16_t *samples = (int16_t*) buffer_;
-      void *start = samples + buffer_index_;
-      // TODO: won't work if samples isn't int16_t
-      std::memset(start, silence_value, silence_bytes);
-      total_samples_ -= silence_samples;
+  private:
+    //! \brief fill_samples() from replay_.
+    std::size_t copy_samples(void *dest, std::size_t max_frames) {
+      const std::size_t written = std::min<std::size_t>(max_frames, total_samples_);
+      const std::size_t bytes = written * frame_size();
+      std::memcpy(dest, replay_, bytes);
+      replay_ += bytes;
+      total_samples_ -= written;
+      return written;
+    }
 
-      if (total_samples_ == 0) {
-        return NULL;
-      }
-      else {
-        return reset();
+    //! \brief write_samples() from the loop, wrapping round.
+    std::size_t copy_cycle(void *dest, std::size_t frames) {
+      uint8_t *out = (uint8_t *) dest;
+      std::size_t bytes = frames * frame_size();
+      while (bytes > 0) {
+        const std::size_t n = std::min(bytes, cycle_.size() - cycle_pos_);
+        std::memcpy(out, &cycle_[cycle_pos_], n);
+        out += n;
+        bytes -= n;
+        cycle_pos_ += n;
+        if (cycle_pos_ == cycle_.size()) {
+          cycle_pos_ = 0;
+        }
       }
+      return frames;
+    }
+
+    void start_loop() {
+      total_samples_ = 0;
+      cycle_pos_ = 0;
+      forever_ = true;
+      replay_ = NULL;
+      record_ = NULL;
     }
 
-  protected:
     //! \brief Reset and get buffer.
-    void *reset() {
-      void *b = buffer_;
-      buffer_ = (uint8_t*) std::malloc(buffer_size_);
-      assert(buffer_ != NULL);
+    period_buffer reset() {
+      period_buffer b(std::move(buffer_));
+      buffer_ = pool_.acquire();
       buffer_index_ = 0;
       return b;
     }
 
-  private:
-    sine_calculation &calc_;
-    unsigned int channels_;
+    //! \brief An empty handle when the time is done, otherwise the buffer
+    //! (which is full).  The unfinished buffer is kept for appending to.
+    period_buffer buffer_or_null() {
+      if (total_samples_ == 0 && ! forever_) {
+        return period_buffer();
+      }
+      assert(buffer_index_ == buffer_samples_);
+      return reset();
+    }
+
+    void *buffer_position() {
+      return (uint8_t *) buffer_.get() + buffer_index_ * sample_size_;
+    }
+
+    std::size_t buffer_frames_left() const {
+      return (buffer_samples_ - buffer_index_) / channels_;
+    }
+
+    const std::size_t sample_size_;
     const std::size_t buffer_size_;
-    // complete size in samples of int16_t
-    std::size_t buffer_samples_;
+    // complete size in samples of the format
+    const std::size_t buffer_samples_;
 
-    uint8_t *buffer_;
-    // TODO:
-    //   Organise this better.  Depending on how we end up doing different sized sample outputs.  We
-    //   only have available 8 and 16 bit samples, but they can be unsigned.  Not sure how that works
-    //   so have to work it out.  Might be that I need to have a void* buffer and perform the counting
-    //   by some magic, and use memset to apply the samples.
+    period_buffer buffer_;
 
     // index up to buffer_samples * channels_, *not* buffer_size.
     std::size_t buffer_index_;
-    // Samples per period.
-    uint32_t total_samples_;
 
+    const uint8_t *replay_;
+    std::vector<uint8_t> *record_;
+
+    // reset_forever()'s loop and where we are in it, in bytes.
+    bool forever_;
+    std::vector<uint8_t> cycle_;
+    std::size_t cycle_pos_;
+};
+
+namespace detail {
+  //! \brief Ask the oscillator for whichever kind of samples the format wants.
+  inline void render(oscillator &calc, int16_t *out, std::size_t frames) {
+    calc.fill(out, frames);
+  }
+
+  inline void render(oscillator &calc, double *out, std::size_t frames) {
+    calc.fill_normalised(out, frames);
+  }
+}
+
+//! \brief Generator for one sample format and channel count.
+//! Format is one of the sample_formats.  Channels is the number of channels,
+//! or 0 to take it from the constructor at runtime.
+template <class Format, unsigned int Channels>
+class basic_sample_generator : public sample_generator {
+  public:
+    typedef typename Format::storage_type storage_type;
+    typedef typename Format::source_type  source_type;
+
+    basic_sample_generator(oscillator &calc, period_pool &pool, uint32_t frequency,
+                           unsigned int channels, std::size_t buffer_frames)
+    : sample_generator(calc, pool, frequency, channels, buffer_frames, sizeof(storage_type)) {
+      assert(Channels == 0 || Channels == channels);
+    }
+
+    std::size_t fill_samples(void *dest, std::size_t max_frames) {
+      // TODO:
+      //   Somehow we need to wait until samp is `near' zero so there is no audio pop.
+      //   It might mean returning an entirely new buffer?  It means that samp needs to
+      //   be a member variable, then we do total_samples_ <= 0 && samp_ near zero.  so
+      //   total_samples_ needs to become signed but we need to be careful that it doesn't
+      //   reach less than zero after this function, otherwise get_silence will be broken.
+      //   Also we need to be careful about volume - if the volume is zero (or near zero)
+      //   then many samples will seem like they are the end.  That *should* be ok, but
+      //   it won't solve the popping problem.
+
+      const std::size_t written = std::min<std::size_t>(max_frames, total_samples_);
+      total_samples_ -= written;
+      calculate(calc_, dest, written);
+      return written;
+    }
+
+    void calculate(oscillator &calc, void *dest, std::size_t frames) const {
+      const unsigned int ch = channels();
+      storage_type *samples = (storage_type *) dest;
+      const std::size_t block_size = 64;
+      source_type block[block_size];
+      while (frames > 0) {
+        const std::size_t n = std::min(frames, block_size);
+        detail::render(calc, block, n);
+        for (std::size_t f = 0; f < n; ++f) {
+          const storage_type samp = Format::convert(block[f]);
+          for (unsigned int c = 0; c < ch; ++c) {
+            *samples++ = samp;
+          }
+        }
+        frames -= n;
+      }
+    }
+
+    std::size_t fill_silence(void *dest, std::size_t max_frames) {
+      const std::size_t written = std::min<std::size_t>(max_frames, total_samples_);
+
+      // trc("total samples to fill: " << total_samples_);
+      // trc("frames to write: " << written);
+
+      silence(dest, written);
+      total_samples_ -= written;
+      return written;
+    }
+
+    void silence(void *dest, std::size_t frames) const {
+      storage_type *samples = (storage_type *) dest;
+      std::fill(samples, samples + frames * channels(), Format::convert(0));
+    }
+
+    sample_generator *clone(oscillator &calc) const {
+      return new basic_sample_generator(calc, pool_, frequency_, channels_, buffer_frames());
+    }
+
+  private:
+    //! \brief Constant when Channels is given so the fan-out loop unrolls.
+    unsigned int channels() const { return Channels ? Channels : channels_; }
 };
 
+namespace detail {
+  //! \brief Pick the channel specialisation.  Uncommon counts are done at runtime.
+  template <class Format>
+  sample_generator *make_sample_generator(oscillator &calc, period_pool &pool, const sdl::audio_spec &spec) {
+    const uint32_t freq = spec.frequency();
+    const std::size_t frames = spec.buffer_samples();
+    switch (spec.channels()) {
+      case 1:
+        return new basic_sample_generator<Format, 1>(calc, pool, freq, 1, frames);
+      case 2:
+        return new basic_sample_generator<Format, 2>(calc, pool, freq, 2, frames);
+      default:
+        return new basic_sample_generator<Format, 0>(calc, pool, freq, spec.channels(), frames);
+    }
+  }
+}
+
+//! \brief Generator specialised for the format and channels in \p spec, which
+//! should be the obtained spec.  Buffers come from \p pool, which must have
+//! buffers of at least spec.buffer_size().  Throws std::runtime_error for
+//! unknown formats.
+inline sample_generator *make_sample_generator(oscillator &calc, period_pool &pool, const sdl::audio_spec &spec) {
+  using namespace sample_formats;
+  switch (spec.format()) {
+    case AUDIO_U8:
+      return detail::make_sample_generator<u8>(calc, pool, spec);
+    case AUDIO_S8:
+      return detail::make_sample_generator<s8>(calc, pool, spec);
+    case AUDIO_U16LSB:
+      return detail::make_sample_generator<u16<false> >(calc, pool, spec);
+    case AUDIO_U16MSB:
+      return detail::make_sample_generator<u16<true> >(calc, pool, spec);
+    case AUDIO_S16LSB:
+      return detail::make_sample_generator<s16<false> >(calc, pool, spec);
+    case AUDIO_S16MSB:
+      return detail::make_sample_generator<s16<true> >(calc, pool, spec);
+#ifdef AUDIO_S32LSB
+    case AUDIO_S32LSB:
+      return detail::make_sample_generator<s32<false> >(calc, pool, spec);
+    case AUDIO_S32MSB:
+      return detail::make_sample_generator<s32<true> >(calc, pool, spec);
+#endif
+#ifdef AUDIO_F32LSB
+    case AUDIO_F32LSB:
+      return detail::make_sample_generator<f32<false> >(calc, pool, spec);
+    case AUDIO_F32MSB:
+      return detail::make_sample_generator<f32<true> >(calc, pool, spec);
+#endif
+    default:
+      throw std::runtime_error("unsupported sample format");
+  }
+}
+
 #endif
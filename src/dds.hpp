@@ -0,0 +1,131 @@
+/*!
+\file
+\brief Direct digital synthesis: an integer-only alternative to sine_calculation.
+*/
+#ifndef DDS_HPP_r84kd0zt
+#define DDS_HPP_r84kd0zt
+
+#include "calculations.hpp"
+
+#include <cmath>
+#include <cassert>
+
+#include <stdint.h>
+
+namespace detail {
+  //! \brief Full-cycle Q15 sine table with one guard entry for interpolation.
+  //! Built with libm the first time it's asked for; never in the sample loop.
+  template <unsigned int Bits>
+  class q15_sine_table {
+    public:
+      static const uint32_t size = 1u << Bits;
+
+      static const int16_t *get() {
+        static const q15_sine_table t;
+        return t.table_;
+      }
+
+    private:
+      q15_sine_table() {
+        for (uint32_t i = 0; i <= size; ++i) {
+          table_[i] = (int16_t) nearbyint(std::sin(2 * M_PI * i / size) * 32767);
+        }
+      }
+
+      int16_t table_[size + 1];
+  };
+}
+
+/*!
+\brief Oscillator based on a wrapping integer phase accumulator.
+
+The top table_bits of the phase index the sine table and the next 15 bits
+interpolate linearly between neighbours.  Amplitude is applied as a Q15
+multiply.  Phase can't lose precision however long the note is; the only
+error is the quantisation of the increment, which is frequency / 2^bits(Phase)
+of the sample rate.
+
+Phase should be uint32_t or uint64_t.
+*/
+template <class Phase = uint32_t>
+class dds_calculation : public oscillator {
+  public:
+    //! \brief Bits of phase used to index the table.
+    static const unsigned int table_bits = 10;
+
+    //! \brief reset_wave() must be called after this to set the note.
+    dds_calculation(double output_frequency, double amplitude = 0.75)
+    : output_frequency_(output_frequency), table_(detail::q15_sine_table<table_bits>::get()),
+      phase_(0), increment_(0) {
+      reset_amplitude(amplitude);
+    }
+
+    //! \brief Change the note and set the phase to 0.
+    void reset_wave(double frequency) {
+      const double phase_range = std::ldexp(1.0, phase_bits);
+      increment_ = (Phase) nearbyint(std::fmod(frequency / output_frequency_, 1.0) * phase_range);
+      phase_ = 0;
+    }
+
+    //! \brief Amplitude between 0 and 1; effective on the next sample.
+    void reset_amplitude(double amplitude) {
+      assert(amplitude >= 0 && amplitude <= 1);
+      amplitude_ = (int32_t) nearbyint(amplitude * 32767);
+    }
+
+    //! \brief Q15 samples.  Integer arithmetic only.
+    void fill(int16_t *out, std::size_t frames) {
+      const unsigned int index_shift = phase_bits - table_bits;
+      const unsigned int frac_shift = index_shift - frac_bits;
+
+      for (std::size_t i = 0; i < frames; ++i) {
+        const uint32_t index = (uint32_t) (phase_ >> index_shift);
+        const int32_t frac = (int32_t) ((phase_ >> frac_shift) & frac_mask);
+        const int32_t a = table_[index];
+        const int32_t b = table_[index + 1];
+        const int32_t s = a + (((b - a) * frac) >> frac_bits);
+        out[i] = (int16_t) ((s * amplitude_) >> 15);
+        phase_ += increment_;
+      }
+    }
+
+    //! \brief Q15 samples scaled to -1..1; floating point only at the end.
+    void fill_normalised(double *out, std::size_t frames) {
+      const std::size_t block_size = 64;
+      int16_t block[block_size];
+      while (frames > 0) {
+        const std::size_t n = std::min(frames, block_size);
+        fill(block, n);
+        for (std::size_t i = 0; i < n; ++i) {
+          out[i] = block[i] / 32767.0;
+        }
+        out += n;
+        frames -= n;
+      }
+    }
+
+    //! \brief Exact: the phase is just a multiple of the increment.
+    void seek(uint64_t frame) { phase_ = (Phase) (frame * increment_); }
+
+    oscillator *clone() const { return new dds_calculation(*this); }
+
+    //! \brief Raw phase; the whole range of Phase is one cycle.
+    Phase phase() const { return phase_; }
+
+    //! \brief Per-sample phase increment.
+    Phase increment() const { return increment_; }
+
+  private:
+    static const unsigned int phase_bits = sizeof(Phase) * 8;
+    static const unsigned int frac_bits = 15;
+    static const uint32_t frac_mask = (1u << frac_bits) - 1;
+
+    double output_frequency_;
+    const int16_t *table_;
+
+    Phase phase_;
+    Phase increment_;
+    int32_t amplitude_;
+};
+
+#endif
@@ -0,0 +1,275 @@
+/*!
+\file
+\brief Rendered notes kept in a directory and mapped by later runs.
+
+This is the --cache-dir.  Each note is a file named by a hash of its
+note_key.  The file has a small header holding the whole key, which is
+checked when it's opened, then the samples.  Files are mapped read-only, so
+a run which finds its notes here copies them straight out of the page cache.
+
+Several tune processes can share the directory.  A note is written to a
+temporary file which is renamed into place, so a reader sees all of it or
+none of it, and if two processes store the same note one harmlessly
+replaces the other.  When the directory goes over its size limit the files
+which were used longest ago are removed.  A process which already has one
+mapped keeps it until it exits.  The directory is only listed when it's
+opened and when what this process knows of goes over the limit; between
+those it keeps a running total of the bytes it stored, so a store is not a
+listing and a stat of every note.
+
+Nothing here is fatal once the directory exists: a note which can't be read
+or written is just calculated.
+*/
+#ifndef DISK_CACHE_HPP_w7rb3kx2
+#define DISK_CACHE_HPP_w7rb3kx2
+
+#include "note_cache.hpp"
+#include "sample_writer.hpp"
+
+#include <boost/noncopyable.hpp>
+
+#include <map>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+
+namespace detail {
+  //! \brief Size of the header before the samples in a cache file.
+  const std::size_t cache_header_size = 64;
+
+  //! \brief First bytes of every cache file; the digit is the version.
+  const char cache_magic[8] = {'T', 'U', 'N', 'E', 'N', 'O', 'T', '1'};
+
+  //! \brief The header for \p k: the magic then the key, little endian.
+  inline void cache_header(uint8_t *h, const note_key &k) {
+    std::memset(h, 0, cache_header_size);
+    std::memcpy(h, cache_magic, sizeof(cache_magic));
+    uint64_t freq, amp;
+    std::memcpy(&freq, &k.frequency, sizeof(freq));
+    std::memcpy(&amp, &k.amplitude, sizeof(amp));
+    put_le64(h + 8, freq);
+    put_le64(h + 16, amp);
+    put_le32(h + 24, k.frames);
+    put_le32(h + 28, k.rate);
+    put_le16(h + 32, k.format);
+    h[34] = k.channels;
+    h[35] = k.oscillator;
+    put_le64(h + 36, k.bytes());
+  }
+
+  //! \brief 64 bit FNV-1a.
+  inline uint64_t fnv1a(const uint8_t *p, std::size_t n) {
+    uint64_t h = 14695981039346656037ULL;
+    for (std::size_t i = 0; i < n; ++i) {
+      h ^= p[i];
+      h *= 1099511628211ULL;
+    }
+    return h;
+  }
+}
+
+//! \brief Directory of rendered notes shared between runs.
+class disk_cache : public note_cache_backing, boost::noncopyable {
+  public:
+    //! \brief Suffix of the note files.  Anything else in the directory is left alone.
+    static const char *suffix() { return ".note"; }
+
+    //! \brief Temporary files older than this are from a process which died.
+    static const time_t stale_seconds = 24 * 60 * 60;
+
+    //! \brief Use \p dir, making it if needed, and keep it under \p max_bytes.
+    //! Throws std::runtime_error if it isn't a usable directory.
+    disk_cache(const std::string &dir, uint64_t max_bytes)
+    : dir_(dir), max_bytes_(max_bytes), counter_(0), bytes_(0), hits_(0), stores_(0), evictions_(0) {
+      if (::mkdir(dir_.c_str(), 0777) == -1 && errno != EEXIST) {
+        throw std::runtime_error("could not make the --cache-dir: " + std::string(std::strerror(errno)));
+      }
+      if (::access(dir_.c_str(), R_OK | W_OK | X_OK) == -1) {
+        throw std::runtime_error("can't use the --cache-dir: " + std::string(std::strerror(errno)));
+      }
+      // What's there already, and tidy up after earlier runs.
+      evict();
+    }
+
+    //! \brief Unmaps everything.
+    ~disk_cache() {
+      for (map_type::iterator i = mapped_.begin(); i != mapped_.end(); ++i) {
+        ::munmap(i->second.base, i->second.size);
+      }
+    }
+
+    const uint8_t *find(const note_key &k) {
+      const map_type::iterator i = mapped_.find(k);
+      if (i != mapped_.end()) {
+        ++hits_;
+        return i->second.base + detail::cache_header_size;
+      }
+
+      const std::string path = path_for(k);
+      const int fd = ::open(path.c_str(), O_RDONLY);
+      if (fd == -1) return NULL;
+
+      const std::size_t size = detail::cache_header_size + k.bytes();
+      struct stat st;
+      void *p = MAP_FAILED;
+      if (::fstat(fd, &st) == 0 && (uint64_t) st.st_size == size) {
+        p = ::mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+      }
+      ::close(fd);
+      if (p == MAP_FAILED) return NULL;
+
+      uint8_t header[detail::cache_header_size];
+      detail::cache_header(header, k);
+      if (std::memcmp(p, header, sizeof(header)) != 0) {
+        // Another version or (unlikely) a hash collision.
+        ::munmap(p, size);
+        return NULL;
+      }
+
+      // Recently used, for evict().
+      ::utimes(path.c_str(), NULL);
+
+      mapping m = {(uint8_t *) p, size};
+      mapped_[k] = m;
+      ++hits_;
+      return m.base + detail::cache_header_size;
+    }
+
+    void store(const note_key &k, const std::vector<uint8_t> &frames) {
+      if (frames.size() != k.bytes() || mapped_.count(k)) return;
+
+      const std::string path = path_for(k);
+      if (::access(path.c_str(), F_OK) == 0) return;
+
+      std::ostringstream tmp;
+      tmp << dir_ << "/.tmp-" << ::getpid() << "-" << counter_++;
+      const std::string tmp_path = tmp.str();
+
+      const int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0666);
+      if (fd == -1) return;
+
+      uint8_t header[detail::cache_header_size];
+      detail::cache_header(header, k);
+      bool ok = true;
+      try {
+        detail::pwrite_all(fd, header, sizeof(header), 0);
+        detail::pwrite_all(fd, &frames[0], frames.size(), sizeof(header));
+      }
+      catch (std::runtime_error &) {
+        ok = false;
+      }
+      ok = ::close(fd) == 0 && ok;
+
+      if (ok && ::rename(tmp_path.c_str(), path.c_str()) == 0) {
+        ++stores_;
+        bytes_ += sizeof(header) + frames.size();
+        if (bytes_ > max_bytes_) evict();
+      }
+      else {
+        ::unlink(tmp_path.c_str());
+      }
+    }
+
+    //! \name Statistics for this process
+    //@{
+    uint64_t hits() const { return hits_; }
+    uint64_t stores() const { return stores_; }
+    uint64_t evictions() const { return evictions_; }
+    //@}
+
+    const std::string &dir() const { return dir_; }
+
+  private:
+    struct mapping {
+      uint8_t *base;
+      std::size_t size;
+    };
+
+    typedef std::map<note_key, mapping> map_type;
+
+    struct file {
+      std::string path;
+      time_t used;
+      uint64_t size;
+
+      friend bool operator<(const file &l, const file &r) { return l.used < r.used; }
+    };
+
+    std::string path_for(const note_key &k) const {
+      uint8_t header[detail::cache_header_size];
+      detail::cache_header(header, k);
+      std::ostringstream o;
+      o << dir_ << "/" << std::hex << std::setw(16) << std::setfill('0')
+        << detail::fnv1a(header, sizeof(header)) << suffix();
+      return o.str();
+    }
+
+    //! \brief Remove the least recently used notes until the directory fits, and
+    //! any abandoned temporary files.  Sets bytes_ to what's left.
+    void evict() {
+      DIR *d = ::opendir(dir_.c_str());
+      if (! d) return;
+
+      std::vector<file> files;
+      uint64_t total = 0;
+      const time_t now = std::time(NULL);
+      const std::string sfx = suffix();
+      while (struct dirent *e = ::readdir(d)) {
+        const std::string name = e->d_name;
+        const std::string path = dir_ + "/" + name;
+        struct stat st;
+        if (::stat(path.c_str(), &st) != 0 || ! S_ISREG(st.st_mode)) continue;
+
+        if (name.compare(0, 5, ".tmp-") == 0) {
+          if (now - st.st_mtime > stale_seconds) ::unlink(path.c_str());
+        }
+        else if (name.size() > sfx.size() && name.compare(name.size() - sfx.size(), sfx.size(), sfx) == 0) {
+          file f = {path, st.st_mtime, (uint64_t) st.st_size};
+          files.push_back(f);
+          total += f.size;
+        }
+      }
+      ::closedir(d);
+
+      std::sort(files.begin(), files.end());
+      for (std::size_t i = 0; i < files.size() && total > max_bytes_; ++i) {
+        // Someone else may have got there first.
+        if (::unlink(files[i].path.c_str()) == 0) ++evictions_;
+        total -= files[i].size;
+      }
+      bytes_ = total;
+    }
+
+    const std::string dir_;
+    const uint64_t max_bytes_;
+    unsigned int counter_;
+
+    // Bytes of notes in the directory as of the last evict(), plus what this
+    // process stored since.  Other processes' stores only show up at the
+    // next evict().
+    uint64_t bytes_;
+
+    // Notes mapped by this process.
+    map_type mapped_;
+
+    uint64_t hits_;
+    uint64_t stores_;
+    uint64_t evictions_;
+};
+
+#endif
@@ -5,6 +5,8 @@
 #ifndef KEY_READER_HPP_s9dbdcti
 #define KEY_READER_HPP_s9dbdcti
 
+#include "trace.hpp"
+
 // allow including the nonportable headers now
 #define KEY_READER_HEADER
 
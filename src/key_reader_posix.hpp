@@ -34,7 +34,7 @@ class key_reader_posix : private detail::key_reader_interface {
           return false;
         }
         else {
-          trc("key.pressed(): another kind of error.")
+          trace::event(trace::ev_key_error, errno);
           // arses.
           return false;
         }
@@ -45,7 +45,7 @@ class key_reader_posix : private detail::key_reader_interface {
           v = read(fileno(stdin), buf, buf_sz);
         }
         while (v > 0);
-        trc("key.pressed(): there was stuff in the buffer - a key was pressed.")
+        trace::event(trace::ev_key);
         return true;
       }
     }
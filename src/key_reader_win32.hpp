@@ -36,7 +36,7 @@ class key_reader_win32 : private detail::key_reader_interface {
       }
 
       if (b) {
-        trc("key was pressed");
+        trace::event(trace::ev_key);
       }
 
       return b;
@@ -48,11 +48,9 @@ class key_reader_win32 : private detail::key_reader_interface {
         std::cin.read(&c, 1);
         {
           boost::mutex::scoped_lock lk(mut_);
-          trc("notify keypress");
           pressed_ = true;
         }
       }
-      trc("exitting thread wtf");
     }
 
     boost::mutex mut_;
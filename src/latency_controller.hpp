@@ -0,0 +1,122 @@
+/*!
+\file
+\brief Adapts how many periods are queued ahead of the sound card.
+
+A deep queue survives a busy machine but adds latency; a shallow one is the
+opposite.  Instead of a fixed depth, the controller watches two things over a
+window of periods:
+
+- underflows reported by the callback, and
+- the low water mark: the fewest periods left in the queue after the
+  callback took one.  That is how much slack the producer had.
+
+More underflows than the budget doubles the depth (up to the maximum).  A
+window with no underflows, where the queue never got below two periods,
+takes one period off (down to the minimum).  So it grows quickly when it's
+in trouble and shrinks slowly when it's comfortable.
+*/
+#ifndef LATENCY_CONTROLLER_HPP_x2j8rq5c
+#define LATENCY_CONTROLLER_HPP_x2j8rq5c
+
+#include <para/atomic.hpp>
+
+#include <boost/noncopyable.hpp>
+
+#include <algorithm>
+#include <cassert>
+
+#include <stdint.h>
+
+//! \brief Target queue depth between bounds, from underflows and slack.
+class latency_controller : boost::noncopyable {
+  public:
+    /*!
+    \brief Depths are in periods.  The depth starts at \p max_depth, which is
+    always safe, and works down.  \p window is how many periods are pushed
+    between decisions and \p budget is how many underflows a window may have
+    before the depth grows.
+    */
+    latency_controller(std::size_t min_depth, std::size_t max_depth, std::size_t window,
+                       unsigned int budget = 0)
+    : min_depth_(min_depth), max_depth_(max_depth), window_(window), budget_(budget),
+      depth_(max_depth), pushes_(0), underflows_(0), total_underflows_(0),
+      low_water_(no_low_water) {
+      assert(min_depth > 0 && min_depth <= max_depth);
+      assert(window > 0);
+    }
+
+    //! \name Callback thread
+    //@{
+
+    //! \brief The callback had nothing to play.
+    void underflow() {
+      underflows_.fetch_add(1, para::memory_order_relaxed);
+      total_underflows_.fetch_add(1, para::memory_order_relaxed);
+    }
+
+    //! \brief The callback took a period and left \p remaining queued.
+    void popped(std::size_t remaining) {
+      std::size_t cur = low_water_.load(para::memory_order_relaxed);
+      while (remaining < cur && ! low_water_.compare_exchange_weak(cur, remaining, para::memory_order_relaxed)) {}
+    }
+    //@}
+
+    //! \name Producer thread
+    //@{
+
+    //! \brief A period was pushed.  Returns true if depth() changed.
+    bool pushed() {
+      if (++pushes_ < window_) {
+        return false;
+      }
+      pushes_ = 0;
+
+      const unsigned int underflows = underflows_.exchange(0, para::memory_order_relaxed);
+      const std::size_t low_water = low_water_.exchange(no_low_water, para::memory_order_relaxed);
+      const std::size_t old = depth();
+
+      if (underflows > budget_) {
+        set_depth(std::min(max_depth_, old * 2));
+      }
+      else if (underflows == 0 && low_water != no_low_water && low_water >= 2) {
+        set_depth(std::max(min_depth_, old - 1));
+      }
+
+      return depth() != old;
+    }
+    //@}
+
+    //! \name Any thread
+    //@{
+
+    //! \brief Periods the producer should keep queued.
+    std::size_t depth() const { return depth_.load(para::memory_order_relaxed); }
+
+    std::size_t min_depth() const { return min_depth_; }
+    std::size_t max_depth() const { return max_depth_; }
+
+    //! \brief Underflows since the start.
+    uint64_t underflows() const { return total_underflows_.load(para::memory_order_relaxed); }
+    //@}
+
+  private:
+    static const std::size_t no_low_water = (std::size_t) -1;
+
+    void set_depth(std::size_t d) { depth_.store(d, para::memory_order_relaxed); }
+
+    const std::size_t min_depth_;
+    const std::size_t max_depth_;
+    const std::size_t window_;
+    const unsigned int budget_;
+
+    // Written by the producer.
+    para::atomic<std::size_t> depth_;
+    std::size_t pushes_;
+
+    // Written by the callback; reset by the producer.
+    para::atomic<unsigned int> underflows_;
+    para::atomic<uint64_t> total_underflows_;
+    para::atomic<std::size_t> low_water_;
+};
+
+#endif
@@ -11,14 +11,31 @@
 #include "sdl.hpp"
 #include "settings.hpp"
 #include "calculations.hpp"
+#include "dds.hpp"
 #include "note_sequence.hpp"
 #include "sync_data.hpp"
+#include "pull_renderer.hpp"
+#include "offline_renderer.hpp"
+#include "sample_writer.hpp"
 #include "key_reader.hpp"
+#include "realtime.hpp"
+#include "startup.hpp"
+#include "note_cache.hpp"
+#include "disk_cache.hpp"
+#include "run_stats.hpp"
+#include "trace.hpp"
+#include "profiler.hpp"
+
+#include <para/pipe.hpp>
+
+#include <boost/scoped_ptr.hpp>
 
 #include <iostream>
+#include <fstream>
 
 #include <cstdlib>
 #include <cstring>
+#include <cerrno>
 #include <csignal>
 
 // #include <bdbg/trace/crash_detection.hpp>
@@ -45,90 +62,566 @@
 //   when ctrl+c happens, exit more safely and play some short silence at the
 //   end.
 
-#include <string>
+// Started before main() so it counts everything.  Global for the callbacks,
+// like the rest.
+startup_timer startup_time;
 
-// TODO: pretty messy
-class sample_dumper {
-  public:
-    sample_dumper(bool enabled, const std::string &filename, std::size_t buffer_size)
-    : enabled_(enabled), buffer_size_(buffer_size), out_(filename.c_str(), std::ios::out|std::ios::trunc) {}
+// For --stats; written by both the callbacks and the producer.
+run_stats stats;
 
-    void dump(const void *buf) {
-      if (! enabled_) return;
-      out_.write((const char*) buf, buffer_size_);
-    }
-
-  private:
-    bool enabled_;
-    std::size_t buffer_size_;
-    std::ofstream out_;
-};
-
-
-// another messy global... perhaps those methods should be part of the
-// synced struct?  More discussion about that on the sunc_data header.
-// It is an interesting observation that we basically have the same
-// bool get(T &ret) format that an LFDS has.  We can generalise this as
-// an adaptor pattern which locks a stl container.  Give them a functor
-// for whether to push/pop/push_back etc.
-queue_pusher<sync_queue_type> *qp = NULL;
+// another messy global... perhaps the callback should get it through the
+// SDL userdata pointer instead.
+queue_pusher *qp = NULL;
 
 void reader_callback(void *, uint8_t *stream, int length) {
   // argh! horrible messy - means  we didn't set up properly yet!
   if (! qp) return;
-  // use quitting and quit_cond somehow :)
-  //
-  //
-  // oops no good - we don't always pop something... maybe we
-  // just keep going until null?  Thne a lot of problems
-  // evaporate!
-
-  // TODO: use lfds style:
-  //
-  //   void *buf;
-  //   if (! qp->pop(buf)) ...
-  //
-  //   If we could lib this up into a generic sync_container or something
-  //   it would be really good.
-  // null buffer means it's empty
-  void *buf = qp->pop();
-  if (! buf) {
-    // trc("no data!");
+  stats.callback();
+  trace::event(trace::ev_callback_begin);
+
+  shared_period buf;
+  const queue_pusher::pop_result r = qp->pop(buf);
+  if (r == queue_pusher::pop_flushed) {
+    // Skipped; the next note is on its way.
+    stats.flushed();
+    std::memset(stream, 0, length);
+    trace::event(trace::ev_callback_end, trace::cb_flushed, qp->size());
+    return;
+  }
+  else if (r == queue_pusher::pop_empty) {
     // rather messy.
 
-    boost::mutex::scoped_lock lk(quit_mutex);
-    if (quitting) {
-      trc("notify quit");
-      terminated = true;
-      quit_cond.notify_one();
-      lk.unlock();
+    if (quitting.load(para::memory_order_acquire)) {
+      trace::event(trace::ev_callback_end, trace::cb_quitting, 0);
+      // Notify only the first time: it can lock inside Boost, and the
+      // producer's timed wait covers a miss anyway.
+      if (! terminated.exchange(true, para::memory_order_acq_rel)) quit_cond.notify_one();
       // avoids popping - it would prbably be better to cuause this thread to wait I
       // guess?
       std::memset(stream, 0, length);
     }
     else {
+      qp->underflow();
+      stats.underflow();
+      trace::event(trace::ev_callback_end, trace::cb_underflow, 0);
       std::cerr << "warning: buffer underflow - computer to slow?!" << std::endl;
     }
     return;
   }
 
-  std::memcpy(stream, buf, length);
-  std::free(buf);
+  const std::size_t queued = qp->size();
+  stats.queued(queued);
+  std::memcpy(stream, buf.get(), length);
+  startup_time.sample_played();
+  trace::event(trace::ev_callback_end, trace::cb_played, queued);
+  // buf goes back to the pool here.
 }
 
+// Same again for --pull.
+pull_renderer *pr = NULL;
+
+void pull_callback(void *, uint8_t *stream, int length) {
+  if (! pr) return;
+  stats.callback();
+  trace::event(trace::ev_callback_begin);
+  const uint64_t start = detail::now_ns();
+  pr->render(stream, length);
+  stats.generated(start);
+  startup_time.sample_played();
+  trace::event(trace::ev_callback_end, trace::cb_played, 0);
+}
 
+//! \brief sample_generator::get_samples(), timed for the stats, and counted by
+//! \p prof (if there is one) as part of the note at \p freq.
+period_buffer generate(sample_generator &gen, profiler *prof, double freq) {
+  trace::event(trace::ev_period_begin);
+  const uint64_t start = detail::now_ns();
+  const perf_reading counted = prof ? prof->start() : perf_reading();
+  const uint32_t remaining = gen.remaining_frames();
+  period_buffer b = gen.get_samples();
+  // Forever notes were calculated in reset_forever(); these are copies.
+  if (prof && ! gen.forever()) {
+    prof->stop(counted, freq, remaining - gen.remaining_frames());
+  }
+  if (b) stats.generated(start);
+  trace::event(trace::ev_period_end);
+  return b;
+}
+
+
+
+//! \brief The wave calculation chosen by --oscillator.
+oscillator *make_oscillator(const settings &set, const sdl::audio_spec &spec) {
+  switch (set.oscillator()) {
+    case settings::oscillator_dds:
+      return new dds_calculation<>(spec.frequency(), set.amplitude());
+    case settings::oscillator_sine:
+    default:
+      return new sine_calculation(spec.frequency(), set.amplitude());
+  }
+}
 
-bool interrupt = false;
+//! \brief Set by SIGINT.  Lock-free, so the handler may touch it.
+para::atomic<bool> interrupt;
 
 void notify_interrupt(int) {
   // TODO: timeout
-  if (interrupt) {
+  if (interrupt.load(para::memory_order_relaxed)) {
     std::cerr << "error: double interrupt!  Aborting now..." << std::endl;
     abort();
   }
 
   std::cout << "Interrupted.  Press again if it doesn't work." << std::endl;
-  interrupt = true;
+  interrupt.store(true, para::memory_order_relaxed);
+}
+
+//! \brief The container chosen by --dump-format.
+dump_container make_dump_container(const settings &set) {
+  switch (set.dump_format()) {
+    case settings::dump_format_wav:
+      return container_wav;
+    case settings::dump_format_raw:
+    default:
+      return container_raw;
+  }
+}
+
+//! \brief Most periods to queue: --latency-target or the old fixed depth.
+std::size_t max_queue_depth(const settings &set, const sdl::audio_spec &spec) {
+  if (! set.latency_target_ms()) {
+    return std::max<std::size_t>(max_queued_periods, set.latency_min_periods());
+  }
+  const uint64_t frames = (uint64_t) set.latency_target_ms() * spec.frequency();
+  const uint64_t per_period = (uint64_t) spec.buffer_samples() * 1000;
+  return std::max<std::size_t>(set.latency_min_periods(), (frames + per_period - 1) / per_period);
+}
+
+//! \brief Say what the latency controller picked.
+void report_depth(const settings &set, const queue_pusher &q, const sdl::audio_spec &spec) {
+  if (set.should_display(msg_verbose)) {
+    const std::size_t d = q.controller().depth();
+    std::cout << "Queue depth: " << d << " periods (" << d * spec.period() << "ms)." << std::endl;
+  }
+}
+
+//! \brief Milliseconds of sound in \p frames.
+double frames_ms(uint64_t frames, const sdl::audio_spec &spec) {
+  return frames * 1000.0 / spec.frequency();
+}
+
+//! \brief Say how far behind the sound card is from what's calculated.  This is
+//! the period we got (which needn't be the one asked for) plus what's queued,
+//! plus the most the playback pipeline's pipes (\p piped) can hold before that.
+void report_latency(const settings &set, const sdl::audio_spec &spec, std::size_t queued,
+                    std::size_t piped, const char *label = "Latency") {
+  if (! set.should_display(set.low_latency() ? msg_normal : msg_verbose)) {
+    return;
+  }
+
+  const double period = frames_ms(spec.buffer_samples(), spec);
+  std::cout << label << ": " << spec.buffer_samples() << " frame periods (" << period << "ms)";
+  if (set.pull()) {
+    std::cout << " rendered in the callback";
+  }
+  else {
+    std::cout << " with " << queued << " queued (" << queued * period << "ms) and up to "
+              << piped << " in the pipeline (" << piped * period << "ms), "
+              << (queued + piped + 1) * period << "ms in all";
+  }
+  std::cout << "." << std::endl;
+}
+
+/*!
+\brief --low-latency and --cpu for the calling thread, which is the producer.
+
+Do this after starting the other threads which shouldn't inherit it (the dump
+writer) and before unpausing.  The playback pipeline's stage threads are
+started after it and do inherit it, deliberately: the play stage is on the way
+to the callback, and neither it nor the dump stage ever waits for the disk.
+Whatever isn't allowed is warned about and skipped.
+*/
+void tune_producer(const settings &set) {
+  const bool warn = set.should_display(msg_normal);
+  const bool verbose = set.should_display(msg_verbose);
+
+  if (set.low_latency()) {
+    if (realtime::set_fifo()) {
+      if (verbose) std::cout << "Producer: SCHED_FIFO, priority " << realtime::fifo_priority << "." << std::endl;
+    }
+    else {
+      const std::string why = std::strerror(errno);
+      if (realtime::set_nice()) {
+        if (warn) std::cerr << "warning: no real-time priority (" << why << "); using nice "
+                            << realtime::fallback_nice << " instead." << std::endl;
+      }
+      else if (warn) {
+        std::cerr << "warning: couldn't raise the producer's priority: " << why << "." << std::endl;
+      }
+    }
+
+    if (! realtime::lock_memory() && warn) {
+      std::cerr << "warning: couldn't lock memory: " << std::strerror(errno) << "." << std::endl;
+    }
+    realtime::prefault_stack();
+  }
+
+  const int cpu = set.cpu() >= 0 ? set.cpu() : (set.low_latency() ? realtime::current_cpu() : -1);
+  if (cpu >= 0) {
+    if (realtime::pin_to_cpu(cpu)) {
+      if (verbose) std::cout << "Producer: pinned to CPU " << cpu << "." << std::endl;
+    }
+    else if (warn) {
+      std::cerr << "warning: couldn't pin the producer to CPU " << cpu << ": " << std::strerror(errno) << "." << std::endl;
+    }
+  }
+}
+
+//! \brief Time to first sample, and how the prefill went.
+void report_startup(const settings &set, const prefill_gate &gate) {
+  if (! set.should_display(msg_verbose) || startup_time.first_sample_ms() < 0) {
+    return;
+  }
+  std::cout << "Time to first sample: " << startup_time.first_sample_ms() << "ms (unpaused at "
+            << startup_time.unpaused_ms() << "ms";
+  if (! set.pull()) {
+    std::cout << " with " << gate.prefilled() << " of " << gate.target() << " periods queued";
+  }
+  std::cout << ")." << std::endl;
+}
+
+//! \brief What makes a note's samples what they are.
+note_cache::key make_note_key(const settings &set, const sdl::audio_spec &spec, double freq, uint32_t frames) {
+  note_cache::key k;
+  k.frequency = freq;
+  k.amplitude = set.amplitude();
+  k.frames = frames;
+  k.rate = spec.frequency();
+  k.format = spec.format();
+  k.channels = spec.channels();
+  k.oscillator = set.oscillator();
+  return k;
+}
+
+//! \brief The --cache-dir, or NULL if there isn't one.
+disk_cache *make_disk_cache(const settings &set) {
+  if (set.cache_dir().empty()) {
+    return NULL;
+  }
+  return new disk_cache(set.cache_dir(), set.cache_dir_limit());
+}
+
+//! \brief How much the note cache saved.
+void report_cache(const settings &set, const note_cache &cache, const disk_cache *disk) {
+  if (cache.enabled() && set.should_display(msg_verbose)) {
+    std::cout << "Note cache: " << cache.hits() << " hits, " << cache.misses() << " misses, "
+              << cache.notes() << " notes in " << cache.bytes() << " bytes, "
+              << cache.evictions() << " dropped." << std::endl;
+  }
+  if (disk && set.should_display(msg_verbose)) {
+    std::cout << "Cache directory " << disk->dir() << ": " << disk->hits() << " notes mapped, "
+              << disk->stores() << " stored, " << disk->evictions() << " removed." << std::endl;
+  }
+}
+
+//! \brief Counters for --profile on the calling thread, or NULL without it.
+profiler *make_profiler(const settings &set) {
+  if (! set.profile()) {
+    return NULL;
+  }
+
+  profiler *p = new profiler;
+  if (! p->counters().any()) {
+    if (set.should_display(msg_normal)) {
+      std::cerr << "warning: no performance counters (" << p->counters().error()
+                << "); --profile will only give the time." << std::endl;
+    }
+  }
+  else if (! p->counters().error().empty() && set.should_display(msg_verbose)) {
+    std::cout << "Some performance counters are missing: " << p->counters().error() << "." << std::endl;
+  }
+  return p;
+}
+
+//! \brief Time the kernels and print everything --profile found.  On the same
+//! thread as make_profiler().
+void report_profile(profiler *prof) {
+  if (prof) {
+    prof->benchmark_kernels();
+    prof->print(std::cout);
+  }
+}
+
+//! \brief --stats and --stats-json, with the playback \p line's stages if there
+//! was one.
+void report_stats(const settings &set, const para::pipeline *line = NULL) {
+  if (set.stats()) {
+    stats.print(std::cout);
+    if (line) {
+      std::cout << "  Pipeline stages:\n";
+      line->print(std::cout, "    ");
+    }
+  }
+
+  const std::string &json = set.stats_json();
+  if (json == "-") {
+    stats.write_json(std::cout);
+  }
+  else if (! json.empty()) {
+    std::ofstream f(json.c_str());
+    stats.write_json(f);
+    f.close();
+    if (! f && set.should_display(msg_normal)) {
+      std::cerr << "warning: couldn't write the --stats-json file " << json << "." << std::endl;
+    }
+  }
+}
+
+//! \brief Write the --trace file if there is one.  All the traced threads should
+//! have stopped.
+void dump_trace(const settings &set) {
+  if (set.trace_file().empty()) {
+    return;
+  }
+
+  try {
+    trace::global().dump(set.trace_file());
+  }
+  catch (std::runtime_error &e) {
+    if (set.should_display(msg_normal)) std::cerr << "warning: " << e.what() << "." << std::endl;
+    return;
+  }
+  if (trace::global().untraced() && set.should_display(msg_normal)) {
+    std::cerr << "warning: " << trace::global().untraced() << " threads weren't traced; "
+              << "only " << trace::log::max_threads << " can be." << std::endl;
+  }
+}
+
+//! \brief I/O settings for the dump file.  During playback the samples are
+//! dropped when the disk can't keep up, rather than causing underflows.
+sample_writer_options make_writer_options(const settings &set, bool playback) {
+  sample_writer_options o;
+  o.buffer_size = set.dump_buffer_size();
+  o.buffers = set.dump_buffers();
+  o.direct = set.direct_io();
+  o.drop_when_full = playback;
+  return o;
+}
+
+//! \brief Warn about what the dump file's backpressure cost.
+void report_dump(const settings &set, const sample_writer &w) {
+  if (w.dropped() && set.should_display(msg_normal)) {
+    std::cerr << "warning: the disk couldn't keep up; " << w.dropped()
+              << " bytes of the dump file were left empty." << std::endl;
+  }
+  if (set.should_display(msg_verbose)) {
+    std::cout << "Dump file: " << w.data_size() << " bytes; all the buffers were busy "
+              << w.stalls() << " times." << std::endl;
+  }
+}
+
+//! \brief Periods each pipe of the playback pipeline holds.
+const std::size_t pipe_periods = 2;
+
+//! \brief Periods the playback pipeline holds on top of pool_periods(): its
+//! three pipes, and the ones the branch and the dump stage have in hand.
+const std::size_t pipeline_periods = 3 * pipe_periods + 2;
+
+//! \brief Most periods the pipes between generating and queueing for the
+//! callback can hold: one pipe, or two with the --dump branch between.
+std::size_t piped_periods(bool dump) { return dump ? 2 * pipe_periods : pipe_periods; }
+
+/*!
+\brief First stage of the playback pipeline: go through the note sequence and
+push each period.
+
+A key press flushes the pipeline and moves on to the next note; SIGINT
+flushes and stops.  Either way a period of silence is pushed last.
+*/
+class note_source {
+  public:
+    note_source(const settings &set, note_sequence &note_seq, oscillator &calc, sample_generator &gen,
+                note_cache &cache, key_reader &keys, profiler *prof, const sdl::audio_spec &spec,
+                para::pipeline &line)
+    : set_(set), note_seq_(note_seq), calc_(calc), gen_(gen), cache_(cache), keys_(keys), prof_(prof),
+      spec_(spec), line_(line) {}
+
+    void operator()(para::outlet<shared_period> &out) {
+      std::vector<uint8_t> rendered;
+      period_buffer samples;
+      do {
+        trace::event(trace::ev_sequence);
+        note_seq_.reset();
+        while (! note_seq_.done()) {
+          double freq = note_seq_.next_frequency();
+          trace::event(trace::ev_note, trace::real(freq), set_.duration_ms());
+          // TODO: print out the note as a msg_normal.
+          calc_.reset_wave(freq);
+          if (set_.duration_ms() == settings::forever) {
+            // Until a key is pressed.
+            gen_.reset_forever(freq, set_.cycle_error_cents());
+          }
+          else {
+            gen_.reset_time(set_.duration_ms());
+          }
+
+          // Copy the note if we've had it before, otherwise keep it for next time.
+          const note_cache::key key = make_note_key(set_, spec_, freq, gen_.remaining_frames());
+          const uint8_t *cached = cache_.find(key);
+          if (cached) {
+            gen_.replay(cached);
+          }
+          else if (cache_.enabled()) {
+            rendered.clear();
+            rendered.reserve(gen_.remaining_frames() * gen_.frame_size());
+            gen_.record(&rendered);
+          }
+
+          while ((samples = generate(gen_, prof_, freq))) {
+            if (! out.push(shared_period(std::move(samples)))) return;
+
+            // TODO:
+            //   once I have the "exit when near zero" thing to stop popping, this bit
+            //   needs to do it as well.  I guess we could set the buffer time to 0 ms
+            //   and just keep going?  Flushing will still work like this.
+            if (keys_.pressed()) {
+              // Stop playing this note straight away.
+              line_.flush();
+              break;
+            }
+            else if (interrupt) {
+              line_.flush();
+              goto clean_exit;
+            }
+          }
+
+          // Only whole notes.
+          if (! cached && gen_.remaining_frames() == 0) {
+            cache_.insert(key, rendered);
+          }
+          trace::event(trace::ev_note_end);
+
+          if (set_.pause_ms()) {
+            trace::event(trace::ev_pause, set_.pause_ms());
+            gen_.reset_time(set_.pause_ms());
+
+            while ((samples = gen_.get_silence())) {
+              if (! out.push(shared_period(std::move(samples)))) return;
+              if (keys_.pressed()) {
+                line_.flush();
+                break;
+              }
+              else if (interrupt) {
+                line_.flush();
+                goto clean_exit;
+              }
+            }
+          }
+        }
+        trace::event(trace::ev_sequence_end);
+      } while (set_.loop());
+
+clean_exit:
+      trace::event(trace::ev_quit);
+
+      // final period
+      samples = gen_.get_silence();
+      if (samples) {
+        out.push(shared_period(std::move(samples)));
+      }
+    }
+
+  private:
+    const settings &set_;
+    note_sequence &note_seq_;
+    oscillator &calc_;
+    sample_generator &gen_;
+    note_cache &cache_;
+    key_reader &keys_;
+    profiler *prof_;
+    const sdl::audio_spec &spec_;
+    para::pipeline &line_;
+};
+
+//! \brief Copy each period into the --dump file.  It shares the period with the
+//! callback, so it may still be reading after the sound card has played it.
+class dump_stage {
+  public:
+    explicit dump_stage(sample_writer &w) : w_(w) {}
+
+    void operator()(shared_period &samples) { w_.dump(samples); }
+
+  private:
+    sample_writer &w_;
+};
+
+//! \brief Last stage of the playback pipeline: queue each period for the
+//! callback, and unpause once the prefill is there.
+class play_stage {
+  public:
+    play_stage(const settings &set, queue_pusher &pusher, prefill_gate &gate, const sdl::audio_spec &spec)
+    : set_(set), pusher_(pusher), gate_(gate), spec_(spec) {}
+
+    void operator()(shared_period &samples) {
+      if (pusher_.push(std::move(samples))) report_depth(set_, pusher_, spec_);
+      gate_.pushed();
+    }
+
+  private:
+    const settings &set_;
+    queue_pusher &pusher_;
+    prefill_gate &gate_;
+    const sdl::audio_spec &spec_;
+};
+
+//! \brief --offline: no sound card, just the dump file.
+int render_offline(const settings &set, note_sequence &note_seq) {
+  sdl::audio_spec spec(NULL, set.sample_rate(), offline_renderer::default_chunk_frames, set.channels());
+  spec.calculate();
+
+  unsigned int threads = set.threads();
+  if (threads == 0) {
+    threads = std::max(1u, boost::thread::hardware_concurrency());
+  }
+
+  // Each generator holds one period which it never uses here.
+  period_pool pool(spec.buffer_size(), threads + 1);
+  boost::scoped_ptr<oscillator> calc(make_oscillator(set, spec));
+  boost::scoped_ptr<sample_generator> gen(make_sample_generator(*calc, pool, spec));
+  sample_writer dump_file(set.dump_file(), make_dump_container(set), spec, make_writer_options(set, false));
+
+  const boost::scoped_ptr<disk_cache> disk(make_disk_cache(set));
+  note_cache cache(set.note_cache_size(), disk.get());
+
+  offline_renderer renderer(note_seq, *calc, *gen, set, offline_renderer::default_chunk_frames, threads);
+  if (cache.enabled()) {
+    renderer.cache(cache, make_note_key(set, spec, 0, 0));
+  }
+  const boost::scoped_ptr<profiler> prof(make_profiler(set));
+  if (prof.get()) {
+    renderer.profile(*prof);
+  }
+  signal(SIGINT, notify_interrupt);
+  const boost::system_time start = boost::get_system_time();
+  const bool complete = renderer.render(dump_file, interrupt);
+  dump_file.close();
+  const boost::posix_time::time_duration took = boost::get_system_time() - start;
+
+  if (set.should_display(msg_verbose)) {
+    const double audio_s = (double) renderer.frames() / spec.frequency();
+    const double took_s = took.total_microseconds() / 1e6;
+    std::cout << "Rendered " << audio_s << "s of audio in " << took_s << "s with "
+              << threads << " thread" << (threads == 1 ? "" : "s");
+    if (took_s > 0) {
+      std::cout << " (" << audio_s / took_s << "x real time)";
+    }
+    std::cout << "." << std::endl;
+  }
+  report_dump(set, dump_file);
+  report_cache(set, cache, disk.get());
+  report_profile(prof.get());
+  dump_trace(set);
+
+  return complete ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 int main(int argc, char **argv) {
@@ -138,6 +631,11 @@ int main(int argc, char **argv) {
       return set.exit_status();
     }
 
+    // Before any threads are started.
+    if (! set.trace_file().empty()) {
+      trace::global().start();
+    }
+
     if (set.should_display(msg_verbose)) {
       set.dump_note_settings(std::cout) << std::endl;
     }
@@ -145,125 +643,159 @@ int main(int argc, char **argv) {
     // declare this quick because it does a lot of validation
     note_sequence note_seq(set);
 
-    sdl::audio aud;
-    sdl::audio_spec out_spec(reader_callback);
+    if (set.offline()) {
+      return render_offline(set, note_seq);
+    }
+
+    sdl::audio_spec out_spec(set.pull() ? pull_callback : reader_callback);
     out_spec.frequency(set.sample_rate());
     out_spec.channels(set.channels());
-    sdl::device dev(aud, out_spec);
+    out_spec.buffer_samples(set.period_frames());
+    device_opener dev(out_spec, set.early_start());
     if (set.should_display(msg_verbose)) {
       std::cout << "Audio spec:" << std::endl;
-      dev.obtained().dump(std::cout, "  ") << std::endl;
+      dev.spec().dump(std::cout, "  ") << std::endl;
+      std::cout << "Sine kernel: " << sine_kernels::selected_name() << std::endl;
     }
 
-    if (dev.obtained() != out_spec && set.should_display(msg_normal)) {
+    if (dev.spec() != out_spec && set.should_display(msg_normal)) {
       std::cerr << "warning: could not get the requested audio spec - parameters not supported?" << std::endl;
     }
+    if (dev.spec().buffer_samples() != set.period_frames() && set.should_display(msg_normal)) {
+      std::cerr << "warning: asked for " << set.period_frames() << " frame periods but got "
+                << dev.spec().buffer_samples() << "." << std::endl;
+    }
 
     // TODO:
     //   could be nicer as a global which carries all the sync data - see sync_data.hpp
     //   there are other ways it could be done..
-    queue_pusher<sync_queue_type> pusher(queue);
+    // All the period memory; declared before anything which holds a period.  In
+    // --pull mode the generator holds one it never uses.
+    const std::size_t max_queued = max_queue_depth(set, dev.spec());
+    period_pool pool(dev.spec().buffer_size(), set.pull() ? 1 : pool_periods(max_queued) + pipeline_periods);
+
+    // Decide on the depth about once a second.
+    const std::size_t periods_per_second =
+      std::max(1, (int) dev.spec().frequency() / dev.spec().buffer_samples());
+    queue_pusher pusher(max_queued, std::min<std::size_t>(set.latency_min_periods(), max_queued),
+                        periods_per_second, set.underflow_budget());
     qp = &pusher;
 
-    sine_calculation calc(dev.obtained().frequency(), set.amplitude());
+    boost::scoped_ptr<oscillator> calc(make_oscillator(set, dev.spec()));
 
-    sample_generator buffer(calc, dev.obtained());
-    sample_dumper dump_file(set.dump_to_file(), set.dump_file(), dev.obtained().buffer_size());
+    boost::scoped_ptr<sample_generator> buffer(make_sample_generator(*calc, pool, dev.spec()));
+    boost::scoped_ptr<sample_writer> dump_file;
+    if (set.dump_to_file()) {
+      dump_file.reset(new sample_writer(set.dump_file(), make_dump_container(set), dev.spec(), make_writer_options(set, true)));
+    }
 
     key_reader keys;
 
+    tune_producer(set);
+    const boost::scoped_ptr<profiler> prof(make_profiler(set));
+    report_latency(set, dev.spec(), max_queued, piped_periods(dump_file.get() != NULL));
+    stats.period_ns((uint64_t) dev.spec().buffer_samples() * 1000000000 / dev.spec().frequency());
+
+    // Forever notes are looped instead.
+    const bool forever = set.duration_ms() == settings::forever;
+    const boost::scoped_ptr<disk_cache> disk(forever ? NULL : make_disk_cache(set));
+    note_cache cache(forever ? 0 : set.note_cache_size(), disk.get());
+
+    // The controller starts at its deepest, so this much always fits.
+    const std::size_t prefill = set.prefill() ? std::min<std::size_t>(set.prefill(), max_queued) : max_queued;
+    prefill_gate gate(dev, pusher, prefill, startup_time);
+
     // TODO:
     //   ./tune -v --start a --end a --distance 0
     //   loops forever; it should end after the first note.
 
-    dev.unpause();
-
-    signal(SIGINT, notify_interrupt);
-    void *samples = NULL;
-    do {
-      trc("begin loop");
-      // TODO: here I must reset the note_sequence somehow
-      // note_seq::iterator i = note_seq.begin() ...
-      while (! note_seq.done()) {
-        trc("get next freq.");
-        double freq = note_seq.next_frequency(); // (or *i if I get that wokring)
-        trc("note " << freq << " for " << set.duration_ms() << "ms");
-        // TODO: print out the note as a msg_normal.
-        calc.reset_wave(freq);
-        // TODO: this breaks when duration is forever.
-        buffer.reset_time(set.duration_ms());
-
-        trc("note: " << freq);
-        // TODO: much neater to pass a functor to do something whith each of the buffers.
-        while ((samples = buffer.get_samples()) != NULL) {
-          pusher.push(samples);
-          dump_file.dump(samples);
-
-          // TODO:
-          //   once I have the "exit when near zero" thing to stop popping, this bit
-          //   needs to do it as well.  I guess we could set the buffer time to 0 ms
-          //   and just keep going?  Flushing will still work like this.
-          if (keys.pressed()) {
-            // flush next time we have a full buffer.
-            pusher.flush_next_push();
-            break;
-          }
-          else if (interrupt) {
-            pusher.flush_next_push();
-            goto clean_exit;
-          }
+    if (set.pull()) {
+      pull_renderer renderer(note_seq, *calc, *buffer, set);
+      pr = &renderer;
+      // Nothing to prefill: the callback calculates its own.
+      gate.open();
+
+      signal(SIGINT, notify_interrupt);
+      // The callback does all the work; we just pass on the controls, and
+      // calculate forever notes' loops for it.
+      while (! renderer.finished()) {
+        renderer.prepare();
+        if (keys.pressed()) {
+          renderer.skip();
         }
-
-        if (set.pause_ms()) {
-          trc("pause between notes");
-          buffer.reset_time(set.pause_ms());
-
-          while ((samples = buffer.get_silence()) != NULL) {
-            pusher.push(samples);
-            dump_file.dump(samples);
-            // TODO: don't I need to flush here?
-            if (keys.pressed()) {
-              break;
-            }
-            else if (interrupt) {
-              goto clean_exit;
-            }
-          }
+        else if (interrupt) {
+          renderer.stop();
         }
-
-        trc("finished this note");
+        boost::this_thread::sleep(boost::posix_time::milliseconds(10));
       }
-      trc("finished this sequence");
-    } while (set.loop());
 
-clean_exit:
-    trc("clean exit");
+      dev.device().pause();
+      pr = NULL;
+      report_startup(set, gate);
+      report_stats(set);
+      dump_trace(set);
+      return EXIT_SUCCESS;
+    }
 
-    // final period
-    samples = buffer.get_silence();
-    if (samples) {
-      pusher.push(samples);
+    // Generate on this thread, which keeps its --profile counters; dump and
+    // play on threads of their own, which inherit its --low-latency priority
+    // and CPU on purpose (see tune_producer()).  With --dump, each period is
+    // shared by both, not copied.
+    para::pipe<shared_period> generated(pipe_periods);
+    para::pipe<shared_period> to_play(pipe_periods);
+    para::pipe<shared_period> to_dump(pipe_periods);
+    para::pipeline line;
+    line.source("generate", note_source(set, note_seq, *calc, *buffer, cache, keys, prof.get(), dev.spec(), line),
+                generated);
+    if (dump_file.get()) {
+      // The dump branch blocks too: the writer already leaves a gap rather
+      // than wait for the disk, which keeps the file in time, where dropping
+      // whole periods here would shift it.  A key press flushes what's
+      // waiting to be played, but the file still gets every period.
+      line.branch("fan-out", generated).to(to_play).to(to_dump, para::branch_block, true);
+      line.sink("dump", dump_stage(*dump_file), to_dump).keep_flushed();
     }
+    line.sink("play", play_stage(set, pusher, gate, dev.spec()), dump_file.get() ? to_play : generated)
+      .on_flush(boost::bind(&queue_pusher::flush, &pusher));
+
+    signal(SIGINT, notify_interrupt);
+    line.run();
 
-    trc("lock");
+    // In case it was all shorter than the prefill.
+    gate.open();
 
     // TODO:
     //   Generalise this pattern as monitored_flag (monitored_flag.hpp).  (First I need
     //   the quit strategy in the SDL thread).  I will use the standard way first.
-    boost::unique_lock<boost::mutex> lk(quit_mutex);
-    quitting = true;
-    quit_cond.notify_one();
-
-    trc("wait for thread to finish nicely");
+    quitting.store(true, para::memory_order_release);
 
-    // while the sdl thread hasnt flipped it back again
-    while (terminated == false) {
-      quit_cond.wait(lk);
+    // while the sdl thread hasnt flipped it back again.  Timed, because the
+    // callback notifies without the lock and we might miss it.
+    boost::unique_lock<boost::mutex> lk(quit_mutex);
+    while (! terminated.load(para::memory_order_acquire)) {
+      quit_cond.timed_wait(lk, boost::get_system_time() + boost::posix_time::milliseconds(2));
     }
     lk.unlock();
 
     // Avoid needlessly calling the output while we're shutting down
-    dev.pause();
+    dev.device().pause();
+
+    if (dump_file.get()) {
+      dump_file->close();
+      report_dump(set, *dump_file);
+    }
+
+    if (set.should_display(msg_verbose)) {
+      std::cout << "Underflows: " << pusher.controller().underflows() << "." << std::endl;
+    }
+    // What the controller settled on.
+    report_latency(set, dev.spec(), pusher.controller().depth(), piped_periods(dump_file.get() != NULL),
+                   "Latency at the end");
+    report_startup(set, gate);
+    report_cache(set, cache, disk.get());
+    report_profile(prof.get());
+    report_stats(set, &line);
+    dump_trace(set);
 
     return EXIT_SUCCESS;
   }
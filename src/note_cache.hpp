@@ -0,0 +1,169 @@
+/*!
+\file
+\brief Keeps rendered notes so playing one again is a copy.
+
+Every note starts at phase zero, so the same note in the same spec is the
+same bytes every time it's played.  With --loop (or a sequence which repeats
+notes) that's a lot of sin() for nothing.  The producer records each note it
+calculates into the cache, and the next time that note comes up the
+sample_generator copies it out instead (see sample_generator::replay()).
+
+The cache has a budget in bytes; when a new note doesn't fit, the least
+recently played ones are dropped until it does.
+*/
+#ifndef NOTE_CACHE_HPP_v5ch1r8k
+#define NOTE_CACHE_HPP_v5ch1r8k
+
+#include <boost/noncopyable.hpp>
+
+#include <list>
+#include <map>
+#include <vector>
+#include <cassert>
+
+#include <stdint.h>
+
+//! \brief Everything which decides the bytes of a note.
+struct note_key {
+  double frequency;
+  double amplitude;
+  uint32_t frames;
+  uint32_t rate;
+  uint16_t format;
+  uint8_t channels;
+  uint8_t oscillator;
+
+  //! \brief Size of the note's samples.
+  std::size_t bytes() const { return (std::size_t) frames * channels * ((format & 0xff) / 8); }
+
+  friend bool operator<(const note_key &l, const note_key &r) {
+    if (l.frequency != r.frequency) return l.frequency < r.frequency;
+    if (l.amplitude != r.amplitude) return l.amplitude < r.amplitude;
+    if (l.frames != r.frames) return l.frames < r.frames;
+    if (l.rate != r.rate) return l.rate < r.rate;
+    if (l.format != r.format) return l.format < r.format;
+    if (l.channels != r.channels) return l.channels < r.channels;
+    return l.oscillator < r.oscillator;
+  }
+};
+
+//! \brief Somewhere bigger and slower which a note_cache looks in when a note
+//! isn't in memory, and keeps new notes in as well.  See disk_cache.
+class note_cache_backing {
+  public:
+    virtual ~note_cache_backing() {}
+
+    //! \brief The note's frames (key.bytes() of them) or NULL.  They stay valid as
+    //! long as the backing does.
+    virtual const uint8_t *find(const note_key &k) = 0;
+
+    //! \brief Keep \p frames for \p k.  Failing is not an error; it's a cache.
+    virtual void store(const note_key &k, const std::vector<uint8_t> &frames) = 0;
+};
+
+//! \brief Rendered notes, least recently used dropped first.
+class note_cache : boost::noncopyable {
+  public:
+    typedef note_key key;
+
+    //! \brief Keep up to \p budget bytes of notes in memory, and use \p backing
+    //! (which must outlive the cache) if it's given.  With neither the cache is
+    //! off.
+    explicit note_cache(std::size_t budget, note_cache_backing *backing = NULL)
+    : budget_(budget), backing_(backing), bytes_(0), hits_(0), misses_(0), evictions_(0),
+      backing_hits_(0) {}
+
+    bool enabled() const { return budget_ > 0 || backing_; }
+
+    /*!
+    \brief The note's frames, or NULL if it's not here (or the cache is off).
+
+    The memory stays valid until the next insert().  A hit makes it the most
+    recently used.  The backing is only asked when it's not in memory.
+    */
+    const uint8_t *find(const key &k) {
+      if (! enabled()) return NULL;
+
+      const index_type::iterator i = index_.find(k);
+      if (i == index_.end()) {
+        const uint8_t *p = backing_ ? backing_->find(k) : NULL;
+        if (p) {
+          ++backing_hits_;
+          return p;
+        }
+        ++misses_;
+        return NULL;
+      }
+
+      ++hits_;
+      lru_.splice(lru_.begin(), lru_, i->second);
+      return &i->second->frames[0];
+    }
+
+    //! \brief Keep \p frames for \p k, swapping them out of the argument.  Notes
+    //! bigger than the whole budget, or already here, aren't kept in memory.
+    //! They all go to the backing.
+    void insert(const key &k, std::vector<uint8_t> &frames) {
+      const std::size_t size = frames.size();
+      if (backing_ && size > 0) {
+        backing_->store(k, frames);
+      }
+      if (size == 0 || size > budget_ || index_.count(k)) {
+        return;
+      }
+
+      while (bytes_ + size > budget_) {
+        evict();
+      }
+
+      lru_.push_front(entry());
+      lru_.front().k = k;
+      lru_.front().frames.swap(frames);
+      index_[k] = lru_.begin();
+      bytes_ += size;
+    }
+
+    //! \name Statistics
+    //@{
+    std::size_t bytes() const { return bytes_; }
+    std::size_t notes() const { return lru_.size(); }
+    uint64_t hits() const { return hits_; }
+    uint64_t misses() const { return misses_; }
+    uint64_t evictions() const { return evictions_; }
+    //! \brief Notes found in the backing.
+    uint64_t backing_hits() const { return backing_hits_; }
+    //@}
+
+  private:
+    struct entry {
+      key k;
+      std::vector<uint8_t> frames;
+    };
+
+    typedef std::list<entry> lru_type;
+    typedef std::map<key, lru_type::iterator> index_type;
+
+    void evict() {
+      assert(! lru_.empty());
+      const entry &e = lru_.back();
+      bytes_ -= e.frames.size();
+      index_.erase(e.k);
+      lru_.pop_back();
+      ++evictions_;
+    }
+
+    const std::size_t budget_;
+    note_cache_backing * const backing_;
+    std::size_t bytes_;
+
+    // Most recently used first.
+    lru_type lru_;
+    index_type index_;
+
+    uint64_t hits_;
+    uint64_t misses_;
+    uint64_t evictions_;
+    uint64_t backing_hits_;
+};
+
+#endif
@@ -7,6 +7,7 @@
 
 #include "settings.hpp"
 #include "notes.hpp"
+#include "trace.hpp"
 
 #include <boost/lexical_cast.hpp>
 
@@ -17,10 +18,6 @@
 #include <memory>
 #include <string>
 
-#ifndef trc
-#  define trc(x)
-#endif
-
 namespace detail {
 
   //! \brief Abstract base for the implementation of a note sequence.
@@ -28,6 +25,8 @@ namespace detail {
     virtual ~sequence_engine() {}
     virtual double next_frequency() = 0;
     virtual bool done() = 0;
+    //! \brief Go back to the first note.
+    virtual void reset() = 0;
   };
 
   //! \brief Sequence based on a start, step, and stop.
@@ -75,6 +74,8 @@ namespace detail {
         return x;
       }
 
+      void reset() { offset_ = start_; }
+
     private:
       const double concert_pitch_;
       const int start_;
@@ -114,6 +115,8 @@ namespace detail {
         return *i;
       }
 
+      void reset() { iter_ = frequencies_.begin(); }
+
       template<class String>
       bool is_floating_point(const String &s) {
         typedef typename String::const_iterator iter_type;
@@ -167,7 +170,6 @@ class note_sequence {
       }
       else {
         assert(set.note_mode() == settings::note_mode_start);
-        trc("using a start note and distance");
         int start_offset = parse_note(set.start_note().c_str());
 
         int stop_offset;
@@ -191,22 +193,22 @@ class note_sequence {
           step = -step;
         }
 
-        trc("start: " << start_offset);
-        trc("stop:  " << stop_offset);
-        trc("step:  " << step);
+        trace::event(trace::ev_note_range, start_offset, stop_offset);
+        trace::event(trace::ev_note_step, step);
 
         impl_.reset(
           new detail::generated_sequence(
             set.concert_pitch(), start_offset, stop_offset, step
           )
         );
-        trc("done");
         assert(impl_.get());
       }
     }
 
     bool done() { return impl_->done(); }
     double next_frequency() { return impl_->next_frequency(); }
+    //! \brief Start the sequence again, eg for --loop.
+    void reset() { impl_->reset(); }
 
   private:
     std::auto_ptr<detail::sequence_engine> impl_;
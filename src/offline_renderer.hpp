@@ -0,0 +1,346 @@
+/*!
+\file
+\brief Render the note sequence to a file as fast as possible.
+
+This is the --offline mode.  There is no device, no queue and no playback
+thread: the notes and pauses are calculated into one large buffer which is
+written straight to the sink, so it runs as fast as the CPU allows instead of
+in real time.
+
+With more than one thread the whole sequence is first split into chunks of at
+most chunk_frames.  Each note starts at phase zero and oscillator::seek() can
+move to any frame of it, so every chunk is independent.  The threads take
+chunks in turn and write them at their final offset in the file.  The output
+is the same bytes as with one thread.
+
+Given a note_cache, notes which are already in it (or its disk_cache) are
+written straight from there, and the notes it renders are added to it.
+*/
+#ifndef OFFLINE_RENDERER_HPP_p8ye1nvk
+#define OFFLINE_RENDERER_HPP_p8ye1nvk
+
+#include "calculations.hpp"
+#include "note_sequence.hpp"
+#include "settings.hpp"
+#include "note_cache.hpp"
+#include "trace.hpp"
+#include "profiler.hpp"
+
+#include <para/atomic.hpp>
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include <vector>
+#include <map>
+#include <string>
+#include <stdexcept>
+#include <cstring>
+#include <cassert>
+
+#include <stdint.h>
+
+//! \brief Plays a note_sequence into a sink with no time limit.
+class offline_renderer : boost::noncopyable {
+  public:
+    //! \brief Default frames written to the sink at once.
+    static const std::size_t default_chunk_frames = 16384;
+
+    //! \brief Everything given must outlive the renderer.  With several \p threads,
+    //! \p calc and \p gen are cloned for each one.
+    offline_renderer(note_sequence &seq, oscillator &calc, sample_generator &gen,
+                     const settings &set, std::size_t chunk_frames = default_chunk_frames,
+                     unsigned int threads = 1)
+    : seq_(seq), calc_(calc), gen_(gen), duration_ms_(set.duration_ms()),
+      pause_ms_(set.pause_ms()), chunk_frames_(chunk_frames), threads_(threads),
+      chunk_(chunk_frames * gen.frame_size()), frames_(0), cache_(NULL), profiler_(NULL),
+      next_job_(0), failed_(false) {
+      assert(chunk_frames > 0);
+    }
+
+    //! \brief Look notes up in \p c and keep the ones rendered there.  \p format
+    //! has everything but the frequency and frames filled in.
+    void cache(note_cache &c, const note_key &format) {
+      cache_ = &c;
+      format_ = format;
+    }
+
+    //! \brief Count the notes the serial renderer calculates with \p p, which
+    //! must be the calling thread's.
+    void profile(profiler &p) { profiler_ = &p; }
+
+    /*!
+    \brief Write the whole sequence to \p sink.
+
+    Sink needs write(const void *, std::size_t bytes), and also
+    write_at(const void *, std::size_t bytes, uint64_t offset) which is safe to
+    call from several threads when there is more than one.  The sequence is
+    played once.  Returns false if \p interrupted was set part way.  Errors
+    from any thread are thrown as std::runtime_error.
+    */
+    template <class Sink>
+    bool render(Sink &sink, const para::atomic<bool> &interrupted) {
+      if (threads_ > 1) {
+        return render_parallel(sink, interrupted);
+      }
+
+      seq_.reset();
+      while (! seq_.done()) {
+        const double freq = seq_.next_frequency();
+        trace::event(trace::ev_note, trace::real(freq), duration_ms_);
+        gen_.reset_time(duration_ms_);
+        const note_key k = key_for(freq);
+        const uint8_t *cached = (cache_ && k.frames > 0) ? cache_->find(k) : NULL;
+        if (cached) {
+          if (! write_cached(sink, cached, interrupted)) return false;
+        }
+        else {
+          calc_.reset_wave(freq);
+          if (cache_) {
+            rendered_.clear();
+            gen_.record(&rendered_);
+          }
+          if (! drain(sink, true, interrupted, freq)) return false;
+          if (cache_) {
+            cache_->insert(k, rendered_);
+          }
+        }
+
+        if (pause_ms_) {
+          gen_.reset_time(pause_ms_);
+          if (! drain(sink, false, interrupted)) return false;
+        }
+      }
+      return true;
+    }
+
+    //! \brief Frames written so far.
+    uint64_t frames() const { return frames_.load(para::memory_order_relaxed); }
+
+  private:
+    //! \brief One piece of a note or pause.
+    struct job {
+      double frequency;
+      bool note;
+      // frame of the note this starts on
+      uint64_t note_frame;
+      // frame of the whole output this starts on
+      uint64_t output_frame;
+      uint32_t frames;
+      // copy from here instead of calculating (a cached note)
+      const uint8_t *source;
+      // and keep a copy here (the first time an uncached note is played)
+      uint8_t *stage;
+    };
+
+    typedef std::vector<job> job_list_type;
+    typedef std::map<note_key, std::vector<uint8_t> > stage_type;
+
+    note_key key_for(double freq) const {
+      note_key k = format_;
+      k.frequency = freq;
+      k.frames = gen_.frames_for(duration_ms_);
+      return k;
+    }
+
+    //! \brief Split the whole sequence into chunks.  Cached notes are looked up
+    //! now, and the first of each uncached note gets somewhere in \p staged.
+    void plan(job_list_type &jobs, stage_type &staged) {
+      const uint32_t note_frames = gen_.frames_for(duration_ms_);
+      const uint32_t pause_frames = pause_ms_ ? gen_.frames_for(pause_ms_) : 0;
+      uint64_t output_frame = 0;
+
+      seq_.reset();
+      while (! seq_.done()) {
+        const double freq = seq_.next_frequency();
+        const uint8_t *source = NULL;
+        uint8_t *stage = NULL;
+        if (cache_ && note_frames > 0) {
+          const note_key k = key_for(freq);
+          source = cache_->find(k);
+          if (! source && ! staged.count(k)) {
+            std::vector<uint8_t> &v = staged[k];
+            v.resize(k.bytes());
+            stage = &v[0];
+          }
+        }
+        plan_segment(jobs, freq, true, note_frames, output_frame, source, stage);
+        plan_segment(jobs, 0, false, pause_frames, output_frame, NULL, NULL);
+      }
+    }
+
+    void plan_segment(job_list_type &jobs, double freq, bool note, uint32_t frames,
+                      uint64_t &output_frame, const uint8_t *source, uint8_t *stage) {
+      const std::size_t frame_size = gen_.frame_size();
+      for (uint32_t done = 0; done < frames;) {
+        job j;
+        j.frequency = freq;
+        j.note = note;
+        j.note_frame = done;
+        j.output_frame = output_frame;
+        j.frames = std::min<uint32_t>(frames - done, chunk_frames_);
+        j.source = source ? source + done * frame_size : NULL;
+        j.stage = stage ? stage + done * frame_size : NULL;
+        jobs.push_back(j);
+
+        done += j.frames;
+        output_frame += j.frames;
+      }
+    }
+
+    template <class Sink>
+    bool render_parallel(Sink &sink, const para::atomic<bool> &interrupted) {
+      job_list_type jobs;
+      stage_type staged;
+      plan(jobs, staged);
+
+      next_job_.store(0, para::memory_order_relaxed);
+      failed_.store(false, para::memory_order_relaxed);
+      boost::thread_group group;
+      for (unsigned int i = 0; i < threads_; ++i) {
+        group.create_thread(
+          boost::bind(&offline_renderer::work<Sink>, this,
+                      boost::ref(sink), boost::cref(jobs), boost::cref(interrupted)));
+      }
+      group.join_all();
+
+      if (failed_.load(para::memory_order_relaxed)) {
+        throw std::runtime_error(error_);
+      }
+      if (interrupted.load(para::memory_order_relaxed)) {
+        return false;
+      }
+
+      // Only now is every staged note complete.
+      for (stage_type::iterator i = staged.begin(); i != staged.end(); ++i) {
+        cache_->insert(i->first, i->second);
+      }
+      return true;
+    }
+
+    //! \brief One thread of render_parallel().
+    template <class Sink>
+    void work(Sink &sink, const job_list_type &jobs, const para::atomic<bool> &interrupted) {
+      try {
+        const boost::scoped_ptr<oscillator> calc(calc_.clone());
+        const boost::scoped_ptr<sample_generator> gen(gen_.clone(*calc));
+        const std::size_t frame_size = gen->frame_size();
+        std::vector<uint8_t> chunk(chunk_frames_ * frame_size);
+
+        while (! failed_.load(para::memory_order_relaxed)
+               && ! interrupted.load(para::memory_order_relaxed)) {
+          const std::size_t i = next_job_.fetch_add(1, para::memory_order_relaxed);
+          if (i >= jobs.size()) {
+            break;
+          }
+
+          const job &j = jobs[i];
+          trace::event(trace::ev_chunk_begin, j.output_frame, j.frames);
+          if (j.source) {
+            sink.write_at(j.source, j.frames * frame_size, j.output_frame * frame_size);
+            frames_.fetch_add(j.frames, para::memory_order_relaxed);
+            trace::event(trace::ev_chunk_end);
+            continue;
+          }
+
+          gen->reset_frames(j.frames);
+          std::size_t n;
+          if (j.note) {
+            calc->reset_wave(j.frequency);
+            calc->seek(j.note_frame);
+            n = gen->fill_samples(&chunk[0], j.frames);
+          }
+          else {
+            n = gen->fill_silence(&chunk[0], j.frames);
+          }
+          assert(n == j.frames);
+          if (j.stage) {
+            std::memcpy(j.stage, &chunk[0], n * frame_size);
+          }
+
+          sink.write_at(&chunk[0], n * frame_size, j.output_frame * frame_size);
+          frames_.fetch_add(n, para::memory_order_relaxed);
+          trace::event(trace::ev_chunk_end);
+        }
+      }
+      catch (std::exception &e) {
+        boost::mutex::scoped_lock lk(error_mutex_);
+        if (! failed_.load(para::memory_order_relaxed)) {
+          error_ = e.what();
+        }
+        failed_.store(true, para::memory_order_relaxed);
+      }
+    }
+
+    //! \brief Write until the generator's time is up.
+    template <class Sink>
+    bool drain(Sink &sink, bool note, const para::atomic<bool> &interrupted, double freq = 0) {
+      while (gen_.remaining_frames() > 0) {
+        if (interrupted.load(para::memory_order_relaxed)) {
+          return false;
+        }
+
+        std::size_t n;
+        if (note && profiler_) {
+          const perf_reading started = profiler_->start();
+          n = gen_.write_samples(&chunk_[0], chunk_frames_);
+          profiler_->stop(started, freq, n);
+        }
+        else {
+          n = note
+            ? gen_.write_samples(&chunk_[0], chunk_frames_)
+            : gen_.fill_silence(&chunk_[0], chunk_frames_);
+        }
+        sink.write(&chunk_[0], n * gen_.frame_size());
+        frames_.fetch_add(n, para::memory_order_relaxed);
+      }
+      return true;
+    }
+
+    //! \brief Write the generator's remaining time from \p p, a chunk at a time
+    //! so an interrupt is still noticed.
+    template <class Sink>
+    bool write_cached(Sink &sink, const uint8_t *p, const para::atomic<bool> &interrupted) {
+      const std::size_t frame_size = gen_.frame_size();
+      for (uint32_t left = gen_.remaining_frames(); left > 0;) {
+        if (interrupted.load(para::memory_order_relaxed)) {
+          return false;
+        }
+
+        const uint32_t n = std::min<uint32_t>(left, chunk_frames_);
+        sink.write(p, n * frame_size);
+        p += n * frame_size;
+        left -= n;
+        frames_.fetch_add(n, para::memory_order_relaxed);
+      }
+      return true;
+    }
+
+    note_sequence &seq_;
+    oscillator &calc_;
+    sample_generator &gen_;
+
+    const int duration_ms_;
+    const int pause_ms_;
+    const std::size_t chunk_frames_;
+    const unsigned int threads_;
+
+    std::vector<uint8_t> chunk_;
+    para::atomic<uint64_t> frames_;
+
+    note_cache *cache_;
+    note_key format_;
+    profiler *profiler_;
+    // the note being recorded into cache_
+    std::vector<uint8_t> rendered_;
+
+    // render_parallel() only.
+    para::atomic<std::size_t> next_job_;
+    para::atomic<bool> failed_;
+    boost::mutex error_mutex_;
+    std::string error_;
+};
+
+#endif
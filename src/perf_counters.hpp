@@ -0,0 +1,180 @@
+/*!
+\file
+\brief The CPU's performance counters for the calling thread, for --profile.
+
+This uses Linux's perf_event_open().  The counters are opened as one group so
+they all count over exactly the same instructions, and only user space is
+counted, which the default perf_event_paranoid setting allows.  Anything
+which can't be opened (a VM with no PMU, a container which forbids it,
+another OS) is just missing: available() says which, and the wall clock
+time is always measured.
+*/
+#ifndef PERF_COUNTERS_HPP_t8kd2wqn
+#define PERF_COUNTERS_HPP_t8kd2wqn
+
+#include "run_stats.hpp"
+
+#include <boost/noncopyable.hpp>
+
+#include <string>
+#include <cstring>
+#include <cerrno>
+
+#include <stdint.h>
+
+#ifdef __linux__
+#  include <linux/perf_event.h>
+#  include <sys/syscall.h>
+#  include <sys/ioctl.h>
+#  include <unistd.h>
+#endif
+
+//! \brief Counts over some stretch of a thread.
+struct perf_reading {
+  //! \brief What's counted, in the order of value.
+  enum counter {
+    cycles,
+    instructions,
+    cache_misses,
+    branch_misses,
+    counters
+  };
+
+  static const char *name(counter c) {
+    static const char *const names[counters] = {
+      "cycles", "instructions", "cache misses", "branch misses"
+    };
+    return names[c];
+  }
+
+  perf_reading() : ns(0) {
+    for (int i = 0; i < counters; ++i) value[i] = 0;
+  }
+
+  uint64_t value[counters];
+  //! \brief Wall clock.
+  uint64_t ns;
+
+  perf_reading &operator+=(const perf_reading &r) {
+    for (int i = 0; i < counters; ++i) value[i] += r.value[i];
+    ns += r.ns;
+    return *this;
+  }
+
+  friend perf_reading operator-(const perf_reading &l, const perf_reading &r) {
+    perf_reading d;
+    for (int i = 0; i < counters; ++i) d.value[i] = l.value[i] - r.value[i];
+    d.ns = l.ns - r.ns;
+    return d;
+  }
+};
+
+//! \brief The counters of the thread which made it.  Only use it on that thread.
+class perf_counters : boost::noncopyable {
+  public:
+    //! \brief Open what we can.  Never throws; see available() and error().
+    perf_counters() : leader_(-1), opened_(0) {
+      for (int i = 0; i < perf_reading::counters; ++i) {
+        fd_[i] = -1;
+        slot_[i] = -1;
+      }
+      open_all();
+    }
+
+    ~perf_counters() {
+      for (int i = 0; i < perf_reading::counters; ++i) {
+        if (fd_[i] != -1) ::close(fd_[i]);
+      }
+    }
+
+    //! \brief Whether counter \p c is being counted.
+    bool available(perf_reading::counter c) const { return fd_[c] != -1; }
+
+    //! \brief Whether any are.
+    bool any() const { return opened_ > 0; }
+
+    //! \brief Why the first one which failed did, or empty if none did.
+    const std::string &error() const { return error_; }
+
+    //! \brief Totals so far.  Missing counters are 0.  When the kernel had to
+    //! share the hardware between more counters than it has, they're scaled up
+    //! to the whole time.
+    perf_reading read() const {
+      perf_reading r;
+#ifdef __linux__
+      if (leader_ != -1) {
+        // PERF_FORMAT_GROUP with both times: nr, enabled, running, values.
+        uint64_t buf[3 + perf_reading::counters];
+        const ssize_t got = ::read(leader_, buf, sizeof(buf));
+        if (got >= (ssize_t) (3 * sizeof(uint64_t))) {
+          const uint64_t enabled = buf[1], running = buf[2];
+          for (int i = 0; i < perf_reading::counters; ++i) {
+            if (slot_[i] < 0 || (uint64_t) slot_[i] >= buf[0]) continue;
+            uint64_t v = buf[3 + slot_[i]];
+            if (running && running < enabled) {
+              v = (uint64_t) ((double) v * enabled / running);
+            }
+            r.value[i] = v;
+          }
+        }
+      }
+#endif
+      r.ns = detail::now_ns();
+      return r;
+    }
+
+  private:
+    void open_all() {
+#ifdef __linux__
+      static const uint64_t configs[perf_reading::counters] = {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES,
+        PERF_COUNT_HW_BRANCH_MISSES
+      };
+
+      for (int i = 0; i < perf_reading::counters; ++i) {
+        perf_event_attr a;
+        std::memset(&a, 0, sizeof(a));
+        a.size = sizeof(a);
+        a.type = PERF_TYPE_HARDWARE;
+        a.config = configs[i];
+        a.exclude_kernel = 1;
+        a.exclude_hv = 1;
+        a.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        // The leader starts the whole group.
+        a.disabled = leader_ == -1;
+
+        const int fd = (int) ::syscall(__NR_perf_event_open, &a, 0, -1, leader_, 0);
+        if (fd == -1) {
+          if (error_.empty()) {
+            error_ = std::string(perf_reading::name((perf_reading::counter) i)) + ": " + std::strerror(errno);
+            if (errno == EACCES || errno == EPERM) {
+              error_ += " (see /proc/sys/kernel/perf_event_paranoid)";
+            }
+          }
+          continue;
+        }
+
+        fd_[i] = fd;
+        slot_[i] = opened_++;
+        if (leader_ == -1) leader_ = fd;
+      }
+
+      if (leader_ != -1) {
+        ::ioctl(leader_, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+      }
+#else
+      error_ = "performance counters are only supported on Linux";
+#endif
+    }
+
+    int fd_[perf_reading::counters];
+    // Where each counter is in the group's read().
+    int slot_[perf_reading::counters];
+    int leader_;
+    int opened_;
+    std::string error_;
+};
+
+#endif
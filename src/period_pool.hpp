@@ -0,0 +1,255 @@
+/*!
+\file
+\brief Pre-allocated, fixed-size period buffers.
+
+All the memory for the periods in flight is allocated once at startup.  The
+producer acquire()s a buffer, fills it and pushes the handle through the
+queue; when the SDL callback has copied it into the stream, the handle goes
+out of scope and its slot is pushed back on the free list, a
+para::lfds::index_stack.  Neither side calls the allocator or takes a lock,
+and both are O(1) whatever the size of the pool.
+
+A period which several consumers read (the sound card, the dump file, ...)
+is turned into a shared_period.  Copying one only counts another reader;
+the slot goes back on the free list when the last of them lets go.
+*/
+#ifndef PERIOD_POOL_HPP_n3s8qv0e
+#define PERIOD_POOL_HPP_n3s8qv0e
+
+#include <para/lfds/stack.hpp>
+#include <para/atomic.hpp>
+
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/thread.hpp>
+
+#include <new>
+#include <utility>
+#include <cstdlib>
+#include <cstring>
+#include <cassert>
+
+#include <stdint.h>
+
+class period_pool;
+class shared_period;
+
+//! \brief Move-only handle to one buffer of a period_pool.  The buffer goes
+//! back to the pool when the handle is destroyed or release()d.  An empty
+//! handle is the "no buffer" value, like a NULL void* used to be.
+class period_buffer {
+  friend class period_pool;
+  friend class shared_period;
+
+  public:
+    period_buffer() : pool_(NULL), slot_(0), data_(NULL) {}
+
+    period_buffer(period_buffer &&o) : pool_(o.pool_), slot_(o.slot_), data_(o.data_) {
+      o.pool_ = NULL;
+      o.data_ = NULL;
+    }
+
+    period_buffer &operator=(period_buffer &&o) {
+      if (this != &o) {
+        release();
+        pool_ = o.pool_;
+        slot_ = o.slot_;
+        data_ = o.data_;
+        o.pool_ = NULL;
+        o.data_ = NULL;
+      }
+      return *this;
+    }
+
+    ~period_buffer() { release(); }
+
+    //! \brief Start of the buffer or NULL if empty.
+    void *get() const { return data_; }
+
+    explicit operator bool() const { return data_ != NULL; }
+
+    //! \brief Give the buffer back to the pool now.
+    inline void release();
+
+  private:
+    period_buffer(period_pool *pool, std::size_t slot, void *data)
+    : pool_(pool), slot_(slot), data_(data) {}
+
+    period_pool *pool_;
+    std::size_t slot_;
+    void *data_;
+};
+
+/*!
+\brief Copyable, read-only handle to a buffer of a period_pool.
+
+All the copies share the one buffer, which goes back to the pool when the
+last is destroyed or release()d.  Copying and releasing are an atomic add
+each, so the callback may drop one.
+*/
+class shared_period {
+  public:
+    shared_period() : pool_(NULL), slot_(0), data_(NULL) {}
+
+    //! \brief Take over \p b, which is left empty.
+    inline shared_period(period_buffer &&b);
+
+    inline shared_period(const shared_period &o);
+
+    shared_period(shared_period &&o) : pool_(o.pool_), slot_(o.slot_), data_(o.data_) {
+      o.pool_ = NULL;
+      o.data_ = NULL;
+    }
+
+    shared_period &operator=(const shared_period &o) {
+      if (this != &o) {
+        shared_period copy(o);
+        *this = std::move(copy);
+      }
+      return *this;
+    }
+
+    shared_period &operator=(shared_period &&o) {
+      if (this != &o) {
+        release();
+        pool_ = o.pool_;
+        slot_ = o.slot_;
+        data_ = o.data_;
+        o.pool_ = NULL;
+        o.data_ = NULL;
+      }
+      return *this;
+    }
+
+    ~shared_period() { release(); }
+
+    //! \brief Start of the buffer or NULL if empty.  Nobody may write to it.
+    const void *get() const { return data_; }
+
+    explicit operator bool() const { return data_ != NULL; }
+
+    //! \brief Stop sharing the buffer now.
+    inline void release();
+
+    //! \brief Handles to this buffer, or 0 if empty.  A snapshot if other
+    //! threads have copies.
+    inline unsigned int use_count() const;
+
+  private:
+    period_pool *pool_;
+    std::size_t slot_;
+    const void *data_;
+};
+
+//! \brief Fixed number of equal-sized buffers with a lock-free free list.
+//! The pool must outlive every period_buffer taken from it.
+class period_pool : boost::noncopyable {
+  friend class period_buffer;
+  friend class shared_period;
+
+  public:
+    //! \brief Buffers are cache line aligned.
+    static const std::size_t alignment = 64;
+
+    //! \brief Allocate and touch all the memory now.  Throws std::bad_alloc.
+    period_pool(std::size_t buffer_size, std::size_t count)
+    : buffer_size_(buffer_size), stride_((buffer_size + alignment - 1) & ~(alignment - 1)),
+      count_(count), free_(count), refs_(new para::atomic<uint32_t>[count]) {
+      assert(count > 0);
+      raw_ = std::malloc(stride_ * count_ + alignment);
+      if (raw_ == NULL) {
+        throw std::bad_alloc();
+      }
+
+      const uintptr_t p = reinterpret_cast<uintptr_t>(raw_);
+      memory_ = reinterpret_cast<uint8_t *>((p + alignment - 1) & ~(uintptr_t) (alignment - 1));
+      std::memset(memory_, 0, stride_ * count_);
+    }
+
+    ~period_pool() { std::free(raw_); }
+
+    //! \brief A free buffer, or an empty handle if they are all in use.  Lock-free.
+    period_buffer try_acquire() {
+      para::lfds::index_stack::index_type i;
+      if (free_.pop(i)) {
+        return period_buffer(this, i, memory_ + i * stride_);
+      }
+      return period_buffer();
+    }
+
+    //! \brief Get a free buffer, yielding until one is returned.  Don't call this
+    //! from the audio thread; size the pool so it doesn't have to wait.
+    period_buffer acquire() {
+      period_buffer b = try_acquire();
+      while (! b) {
+        boost::this_thread::yield();
+        b = try_acquire();
+      }
+      return b;
+    }
+
+    std::size_t buffer_size() const { return buffer_size_; }
+    std::size_t count() const { return count_; }
+
+  private:
+    void release(std::size_t slot) {
+      assert(slot < count_);
+      free_.push((para::lfds::index_stack::index_type) slot);
+    }
+
+    //! \brief The last reference's release() frees the slot.  Acquire so
+    //! every reader is done with the data before it's reused.
+    void unref(std::size_t slot) {
+      if (refs_[slot].fetch_sub(1, para::memory_order_acq_rel) == 1) {
+        release(slot);
+      }
+    }
+
+    const std::size_t buffer_size_;
+    const std::size_t stride_;
+    const std::size_t count_;
+
+    void *raw_;
+    uint8_t *memory_;
+    // The most recently freed is reused first, while it's still in the cache.
+    para::lfds::index_stack free_;
+    // shared_period handles to each slot.
+    boost::scoped_array<para::atomic<uint32_t> > refs_;
+};
+
+inline void period_buffer::release() {
+  if (pool_) {
+    pool_->release(slot_);
+    pool_ = NULL;
+    data_ = NULL;
+  }
+}
+
+inline shared_period::shared_period(period_buffer &&b)
+: pool_(b.pool_), slot_(b.slot_), data_(b.data_) {
+  if (pool_) {
+    // Nobody else can see the slot yet.
+    pool_->refs_[slot_].store(1, para::memory_order_relaxed);
+    b.pool_ = NULL;
+    b.data_ = NULL;
+  }
+}
+
+inline shared_period::shared_period(const shared_period &o)
+: pool_(o.pool_), slot_(o.slot_), data_(o.data_) {
+  if (pool_) pool_->refs_[slot_].fetch_add(1, para::memory_order_relaxed);
+}
+
+inline void shared_period::release() {
+  if (pool_) {
+    pool_->unref(slot_);
+    pool_ = NULL;
+    data_ = NULL;
+  }
+}
+
+inline unsigned int shared_period::use_count() const {
+  return pool_ ? pool_->refs_[slot_].load(para::memory_order_relaxed) : 0;
+}
+
+#endif
@@ -0,0 +1,134 @@
+/*!
+\file
+\brief --profile: what calculating the samples costs the CPU.
+
+The producer brackets each period it calculates with start() and stop(),
+which read the perf_counters, and the counts are added up for each note.  At
+the end each sine kernel the CPU can run is timed over the same block size
+sine_calculation uses, so kernels (and CPUs) can be compared directly.
+
+A sample here is one frame, whatever the number of channels: the wave is
+calculated once per frame and copied to each channel.
+*/
+#ifndef PROFILER_HPP_z4nc8rvb
+#define PROFILER_HPP_z4nc8rvb
+
+#include "perf_counters.hpp"
+#include "sine_kernels.hpp"
+
+#include <boost/noncopyable.hpp>
+
+#include <map>
+#include <vector>
+#include <string>
+#include <ostream>
+#include <cmath>
+
+#include <stdint.h>
+
+//! \brief Counters per note and per kernel.  Use it on one thread only: the one
+//! being measured.
+class profiler : boost::noncopyable {
+  public:
+    //! \brief Samples each kernel calculates in benchmark_kernels().
+    static const uint64_t default_benchmark_samples = 1 << 21;
+
+    //! \brief Opens the calling thread's counters.
+    profiler() {}
+
+    const perf_counters &counters() const { return counters_; }
+
+    //! \brief Call before calculating; give the result to stop().
+    perf_reading start() const { return counters_.read(); }
+
+    //! \brief \p samples of the note at \p frequency were calculated since \p
+    //! started.
+    void stop(const perf_reading &started, double frequency, uint64_t samples) {
+      entry &e = notes_[frequency];
+      e.counts += counters_.read() - started;
+      e.samples += samples;
+    }
+
+    //! \brief Time each of sine_kernels::available() over \p samples.
+    void benchmark_kernels(uint64_t samples = default_benchmark_samples) {
+      // The same blocks as sine_calculation::fill().
+      const std::size_t block_size = 64;
+      double block[block_size];
+      const double speed = 2 * M_PI * 440 / 44100;
+      volatile double sink = 0;
+
+      const std::vector<sine_kernels::named_kernel> ks = sine_kernels::available();
+      for (std::size_t k = 0; k < ks.size(); ++k) {
+        entry e;
+        const perf_reading before = counters_.read();
+        for (uint64_t done = 0; done < samples; done += block_size) {
+          const double pos = std::fmod(done * speed, 2 * M_PI);
+          ks[k].kernel(block, block_size, pos, speed, 1.0);
+          sink = sink + block[done % block_size];
+        }
+        e.counts = counters_.read() - before;
+        e.samples = samples;
+        kernels_.push_back(std::make_pair(std::string(ks[k].name), e));
+      }
+    }
+
+    //! \brief Per note, all the notes, then the kernels.
+    std::ostream &print(std::ostream &o) const {
+      o << "Profile, per sample:\n";
+      entry all;
+      for (note_map_type::const_iterator i = notes_.begin(); i != notes_.end(); ++i) {
+        o << "  " << i->first << "Hz: ";
+        print_entry(o, i->second);
+        all.counts += i->second.counts;
+        all.samples += i->second.samples;
+      }
+      o << "  All notes: ";
+      print_entry(o, all);
+
+      if (! kernels_.empty()) {
+        o << "Sine kernels, per sample:\n";
+        const std::string selected = sine_kernels::selected_name();
+        for (std::size_t k = 0; k < kernels_.size(); ++k) {
+          o << "  " << kernels_[k].first << (kernels_[k].first == selected ? " (used)" : "") << ": ";
+          print_entry(o, kernels_[k].second);
+        }
+      }
+      return o;
+    }
+
+  private:
+    struct entry {
+      entry() : samples(0) {}
+
+      perf_reading counts;
+      uint64_t samples;
+    };
+
+    typedef std::map<double, entry> note_map_type;
+
+    void print_entry(std::ostream &o, const entry &e) const {
+      o << e.samples << " samples";
+      if (! e.samples) {
+        o << "\n";
+        return;
+      }
+
+      for (int c = 0; c < perf_reading::counters; ++c) {
+        const perf_reading::counter which = (perf_reading::counter) c;
+        if (counters_.available(which)) {
+          o << ", " << (double) e.counts.value[c] / e.samples << " " << perf_reading::name(which);
+        }
+      }
+      if (counters_.available(perf_reading::cycles) && counters_.available(perf_reading::instructions)
+          && e.counts.value[perf_reading::cycles]) {
+        o << ", IPC " << (double) e.counts.value[perf_reading::instructions] / e.counts.value[perf_reading::cycles];
+      }
+      o << ", " << (double) e.counts.ns / e.samples << "ns\n";
+    }
+
+    perf_counters counters_;
+    note_map_type notes_;
+    std::vector<std::pair<std::string, entry> > kernels_;
+};
+
+#endif
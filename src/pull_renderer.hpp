@@ -0,0 +1,268 @@
+/*!
+\file
+\brief Render the note sequence straight into the audio callback's stream.
+
+This is the --pull mode.  Instead of a thread which pushes periods through
+the queue, the callback asks the renderer to fill the stream it was given.
+There is no copy, no queue and no thread to wake up, so the latency is as
+low as the device allows.
+
+The renderer is a small state machine driven by a sample clock: every frame
+written advances clock(), and the current note or pause ends when the clock
+reaches the frame it was scheduled to end on.  Everything in render() runs
+on the audio thread, so it must never block or allocate.
+
+Notes which last forever are the exception to calculating in the callback:
+each needs its whole loop calculated first.  So the thread which passes on
+the controls also calls prepare(), which takes the next note from the
+sequence and calculates its loop; the callback only swaps it in.  If it's
+not ready in time the callback plays silence until it is.
+*/
+#ifndef PULL_RENDERER_HPP_c7wq2mza
+#define PULL_RENDERER_HPP_c7wq2mza
+
+#include "calculations.hpp"
+#include "note_sequence.hpp"
+#include "settings.hpp"
+#include "trace.hpp"
+
+#include <para/atomic.hpp>
+
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include <vector>
+#include <limits>
+#include <cassert>
+
+#include <stdint.h>
+
+//! \brief Plays a note_sequence from inside the audio callback.
+class pull_renderer : boost::noncopyable {
+  public:
+    //! \brief Everything given must outlive the renderer.  Nothing is calculated
+    //! until the first render(), except the first forever note's loop.
+    pull_renderer(note_sequence &seq, oscillator &calc, sample_generator &gen, const settings &set)
+    : seq_(seq), calc_(calc), gen_(gen), duration_ms_(set.duration_ms()),
+      pause_ms_(set.pause_ms()), cycle_error_(set.cycle_error_cents()), loop_(set.loop()),
+      state_(state_start),
+      clock_(0), segment_end_(0), next_freq_(0), next_(next_empty),
+      skip_(false), stop_(false), finished_(false) {
+      if (forever()) {
+        loop_calc_.reset(calc.clone());
+        prepare();
+      }
+    }
+
+    //! \name Audio thread
+    //@{
+
+    //! \brief Fill \p length bytes of \p stream.
+    void render(uint8_t *stream, int length) {
+      const std::size_t frame_size = gen_.frame_size();
+      std::size_t frames = length / frame_size;
+
+      // Loads first so the usual callback doesn't write the shared lines.
+      if (stop_.load(para::memory_order_relaxed) && stop_.exchange(false, para::memory_order_acquire)) {
+        trace::event(trace::ev_stop);
+        state_ = state_finished;
+      }
+      else if (skip_.load(para::memory_order_relaxed) && skip_.exchange(false, para::memory_order_acquire)) {
+        // same as the push mode: skipping a note goes to its pause.
+        if (state_ == state_note) {
+          start_pause();
+        }
+        else if (state_ == state_pause) {
+          next_note();
+        }
+      }
+
+      if (state_ == state_start) {
+        next_note();
+      }
+
+      if (state_ == state_finished) {
+        gen_.silence(stream, frames);
+        clock_ += frames;
+        // The last of the sequence was in an earlier call so it's gone to the
+        // device by now.
+        finished_.store(true, para::memory_order_release);
+        return;
+      }
+
+      while (frames > 0) {
+        std::size_t written;
+        if (state_ == state_finished || state_ == state_start) {
+          // Still waiting for prepare() in the second case; try again next
+          // call.
+          gen_.silence(stream, frames);
+          written = frames;
+        }
+        else if (state_ == state_note) {
+          written = gen_.write_samples(stream, frames);
+        }
+        else {
+          assert(state_ == state_pause);
+          written = gen_.fill_silence(stream, frames);
+        }
+
+        clock_ += written;
+        stream += written * frame_size;
+        frames -= written;
+
+        if ((state_ == state_note || state_ == state_pause) && clock_ == segment_end_) {
+          advance();
+        }
+      }
+    }
+    //@}
+
+    //! \name Any thread
+    //@{
+
+    //! \brief Move on to the next note (or the next pause), like a keypress in
+    //! the normal mode.
+    void skip() { skip_.store(true, para::memory_order_release); }
+
+    //! \brief Write silence from the next callback on.
+    void stop() { stop_.store(true, para::memory_order_release); }
+
+    //! \brief True when the sequence has been completely written and the device
+    //! only gets silence.
+    bool finished() const { return finished_.load(para::memory_order_acquire); }
+    //@}
+
+    /*!
+    \brief With notes which last forever, calculate the next one's loop if
+    it isn't already.  Call it often from one thread, not the audio one;
+    with other notes it does nothing.
+    */
+    void prepare() {
+      if (! forever() || next_.load(para::memory_order_acquire) != next_empty) {
+        return;
+      }
+
+      if (seq_.done() && loop_) {
+        seq_.reset();
+        trace::event(trace::ev_sequence);
+      }
+      if (seq_.done()) {
+        next_.store(next_none, para::memory_order_release);
+        return;
+      }
+
+      next_freq_ = seq_.next_frequency();
+      gen_.make_loop(*loop_calc_, next_freq_, cycle_error_, next_loop_);
+      next_.store(next_ready, para::memory_order_release);
+    }
+
+    //! \brief Frames written since the start.  Only accurate on the audio thread.
+    uint64_t clock() const { return clock_; }
+
+  private:
+    enum state_type { state_start, state_note, state_pause, state_finished };
+
+    //! \brief What prepare() has handed over.
+    enum next_type { next_empty, next_ready, next_none };
+
+    bool forever() const { return duration_ms_ == settings::forever; }
+
+    //! \brief The current segment's time ran out.
+    void advance() {
+      if (state_ == state_note && pause_ms_ > 0) {
+        start_pause();
+      }
+      else {
+        next_note();
+      }
+    }
+
+    void start_pause() {
+      trace::event(trace::ev_pause, pause_ms_);
+      state_ = state_pause;
+      schedule(pause_ms_);
+    }
+
+    void next_note() {
+      if (forever()) {
+        next_forever();
+        return;
+      }
+
+      if (seq_.done()) {
+        if (loop_) {
+          seq_.reset();
+          trace::event(trace::ev_sequence);
+        }
+
+        if (seq_.done()) {
+          trace::event(trace::ev_sequence_end);
+          state_ = state_finished;
+          return;
+        }
+      }
+
+      const double freq = seq_.next_frequency();
+      trace::event(trace::ev_note, trace::real(freq), duration_ms_);
+      calc_.reset_wave(freq);
+      state_ = state_note;
+      schedule(duration_ms_);
+    }
+
+    //! \brief next_note() with the loop from prepare().
+    void next_forever() {
+      const int next = next_.load(para::memory_order_acquire);
+      if (next == next_empty) {
+        // Not calculated yet.
+        state_ = state_start;
+        return;
+      }
+      else if (next == next_none) {
+        trace::event(trace::ev_sequence_end);
+        state_ = state_finished;
+        return;
+      }
+
+      trace::event(trace::ev_note, trace::real(next_freq_), duration_ms_);
+      gen_.play_loop(next_loop_);
+      next_.store(next_empty, para::memory_order_release);
+      state_ = state_note;
+      // Only skip() ends it.
+      segment_end_ = std::numeric_limits<uint64_t>::max();
+    }
+
+    //! \brief The current segment lasts \p ms from now on the sample clock.
+    void schedule(int ms) {
+      gen_.reset_time(ms);
+      // If this is too short for even one frame then render() advances again
+      // without writing anything.
+      segment_end_ = clock_ + gen_.remaining_frames();
+    }
+
+    note_sequence &seq_;
+    oscillator &calc_;
+    sample_generator &gen_;
+
+    const int duration_ms_;
+    const int pause_ms_;
+    const double cycle_error_;
+    const bool loop_;
+
+    state_type state_;
+    uint64_t clock_;
+    uint64_t segment_end_;
+
+    // The next forever note, written by prepare() while next_ is next_empty
+    // and read by the callback while it's next_ready.
+    boost::scoped_ptr<oscillator> loop_calc_;
+    std::vector<uint8_t> next_loop_;
+    double next_freq_;
+    para::atomic<int> next_;
+
+    // Cross-thread flags.
+    para::atomic<bool> skip_;
+    para::atomic<bool> stop_;
+    para::atomic<bool> finished_;
+};
+
+#endif
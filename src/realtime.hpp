@@ -0,0 +1,115 @@
+/*!
+\file
+\brief Scheduling, memory locking and CPU pinning for --low-latency.
+
+With small periods the producer has only a millisecond or two to fill each
+one, so a page fault, a swapped-out buffer or being preempted by a make -j
+is an audible click.  These ask the OS not to do that.  None of them are
+essential: each returns false (leaving errno set) when it isn't permitted
+or isn't supported, and the caller carries on without it.
+
+Everything here applies to the calling thread (or the whole process, for
+memory locking).  Threads started afterwards inherit the scheduling and the
+CPU.
+*/
+#ifndef REALTIME_HPP_f6tq0hwd
+#define REALTIME_HPP_f6tq0hwd
+
+#include <cstring>
+#include <cerrno>
+
+#ifndef _WIN32
+#  include <unistd.h>
+#  include <pthread.h>
+#  include <sched.h>
+#  include <sys/mman.h>
+#  include <sys/resource.h>
+#endif
+
+namespace realtime {
+  //! \brief SCHED_FIFO priority for the producer.  Low, so it's still below
+  //! the sound server and the driver's own threads.
+  const int fifo_priority = 10;
+
+  //! \brief Nice value to fall back on when SCHED_FIFO isn't allowed.
+  const int fallback_nice = -10;
+
+  //! \brief Bytes of stack to touch in prefault_stack().
+  const std::size_t stack_prefault_size = 256 * 1024;
+
+  //! \brief Run the calling thread as SCHED_FIFO at \p priority.  Usually needs
+  //! root or an rtprio limit.
+  inline bool set_fifo(int priority = fifo_priority) {
+#if defined(_POSIX_PRIORITY_SCHEDULING) && ! defined(_WIN32)
+    sched_param p;
+    std::memset(&p, 0, sizeof(p));
+    p.sched_priority = priority;
+    const int r = pthread_setschedparam(pthread_self(), SCHED_FIFO, &p);
+    errno = r;
+    return r == 0;
+#else
+    (void) priority;
+    errno = ENOSYS;
+    return false;
+#endif
+  }
+
+  //! \brief Lower the calling thread's nice value.  On Linux this is per-thread;
+  //! elsewhere it might be the whole process.
+  inline bool set_nice(int nice = fallback_nice) {
+#ifndef _WIN32
+    return setpriority(PRIO_PROCESS, 0, nice) == 0;
+#else
+    (void) nice;
+    errno = ENOSYS;
+    return false;
+#endif
+  }
+
+  //! \brief Lock everything mapped now and later into RAM.  This also faults in
+  //! all the memory already allocated.
+  inline bool lock_memory() {
+#if defined(_POSIX_MEMLOCK) && ! defined(_WIN32)
+    return mlockall(MCL_CURRENT | MCL_FUTURE) == 0;
+#else
+    errno = ENOSYS;
+    return false;
+#endif
+  }
+
+  //! \brief Touch the stack the thread will need so the first deep call doesn't
+  //! fault.  Heap buffers are touched when they are allocated (see period_pool).
+  inline void prefault_stack() {
+    volatile unsigned char stack[stack_prefault_size];
+    for (std::size_t i = 0; i < sizeof(stack); i += 4096) {
+      stack[i] = 0;
+    }
+  }
+
+  //! \brief Keep the calling thread on \p cpu.  Linux only.
+  inline bool pin_to_cpu(int cpu) {
+#if defined(__linux__) && defined(CPU_SET)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    const int r = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    errno = r;
+    return r == 0;
+#else
+    (void) cpu;
+    errno = ENOSYS;
+    return false;
+#endif
+  }
+
+  //! \brief CPU the calling thread is on now, or -1 if we can't tell.
+  inline int current_cpu() {
+#if defined(__linux__) && defined(CPU_SET)
+    return sched_getcpu();
+#else
+    return -1;
+#endif
+  }
+}
+
+#endif
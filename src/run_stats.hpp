@@ -0,0 +1,239 @@
+/*!
+\file
+\brief Counters and histograms of how playback is going, for --stats.
+
+These are always collected; it's a clock read and a few relaxed atomic adds
+per period.  Each histogram and counter has one writer (the producer or the
+audio callback) so nothing locks or retries, and they can be read from any
+thread at any time, although a reading taken while they are being written
+might be a period out between one field and the next.
+*/
+#ifndef RUN_STATS_HPP_m2zs9peu
+#define RUN_STATS_HPP_m2zs9peu
+
+#include <para/atomic.hpp>
+
+#include <boost/noncopyable.hpp>
+
+#include <ostream>
+#include <string>
+#include <algorithm>
+
+#include <stdint.h>
+#include <time.h>
+
+#ifndef _WIN32
+#  include <sys/time.h>
+#  include <sys/resource.h>
+#endif
+
+namespace detail {
+  //! \brief A monotonic clock in nanoseconds.  Only differences mean anything.
+  inline uint64_t now_ns() {
+#ifdef CLOCK_MONOTONIC
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+#else
+    timeval t;
+    gettimeofday(&t, NULL);
+    return (uint64_t) t.tv_sec * 1000000000 + (uint64_t) t.tv_usec * 1000;
+#endif
+  }
+}
+
+/*!
+\brief Distribution of a quantity with power of two buckets.
+
+Bucket 0 counts zeros and bucket b counts values from 2^(b-1) to 2^b - 1, so
+percentiles are only good to within a factor of two; the mean and the max are
+exact.  Only one thread may record().
+*/
+class stat_histogram : boost::noncopyable {
+  public:
+    static const unsigned int buckets = 32;
+
+    stat_histogram() {}
+
+    void record(uint64_t v) {
+      unsigned int b = 0;
+      for (uint64_t x = v; x && b < buckets - 1; x >>= 1) ++b;
+      buckets_[b].fetch_add(1, para::memory_order_relaxed);
+      sum_.fetch_add(v, para::memory_order_relaxed);
+      if (v > max_.load(para::memory_order_relaxed)) {
+        max_.store(v, para::memory_order_relaxed);
+      }
+      // Last, so a reader never sees more samples than the buckets hold.
+      count_.fetch_add(1, para::memory_order_relaxed);
+    }
+
+    uint64_t count() const { return count_.load(para::memory_order_relaxed); }
+    uint64_t max() const { return max_.load(para::memory_order_relaxed); }
+    double mean() const {
+      const uint64_t n = count();
+      return n ? (double) sum_.load(para::memory_order_relaxed) / n : 0;
+    }
+    uint64_t bucket(unsigned int b) const { return buckets_[b].load(para::memory_order_relaxed); }
+
+    //! \brief Upper bound of the bucket \p p (0 to 1) of the values are in, but
+    //! no more than the max.
+    uint64_t percentile(double p) const {
+      const uint64_t n = count();
+      uint64_t seen = 0;
+      for (unsigned int b = 0; b < buckets; ++b) {
+        seen += bucket(b);
+        if (n && seen >= p * n) {
+          return std::min(max(), b ? ((uint64_t) 1 << b) - 1 : 0);
+        }
+      }
+      return max();
+    }
+
+  private:
+    para::atomic<uint64_t> buckets_[buckets];
+    para::atomic<uint64_t> count_;
+    para::atomic<uint64_t> sum_;
+    para::atomic<uint64_t> max_;
+};
+
+//! \brief Everything --stats reports.
+class run_stats : boost::noncopyable {
+  public:
+    run_stats() : start_ns_(detail::now_ns()), period_ns_(0), last_callback_ns_(0),
+                  periods_(0), callbacks_(0), underflows_(0), flushed_(0) {}
+
+    //! \brief How often the callback ought to be called.  Set it before the
+    //! device is unpaused.
+    void period_ns(uint64_t ns) { period_ns_ = ns; }
+
+    //! \name Producer thread (or the callback with --pull)
+    //@{
+
+    //! \brief A period was calculated from \p start_ns (from now_ns()) to now.
+    void generated(uint64_t start_ns) {
+      generation_us_.record((detail::now_ns() - start_ns) / 1000);
+      periods_.fetch_add(1, para::memory_order_relaxed);
+    }
+    //@}
+
+    //! \name Audio callback only
+    //@{
+
+    //! \brief Call at the start of every callback.
+    void callback() {
+      const uint64_t now = detail::now_ns();
+      if (last_callback_ns_) {
+        const uint64_t interval = now - last_callback_ns_;
+        const uint64_t off = interval > period_ns_ ? interval - period_ns_ : period_ns_ - interval;
+        jitter_us_.record(off / 1000);
+      }
+      last_callback_ns_ = now;
+      callbacks_.fetch_add(1, para::memory_order_relaxed);
+    }
+
+    //! \brief Periods still queued after taking one.
+    void queued(std::size_t periods) { depth_.record(periods); }
+
+    void underflow() { underflows_.fetch_add(1, para::memory_order_relaxed); }
+
+    //! \brief A callback found only flushed periods.
+    void flushed() { flushed_.fetch_add(1, para::memory_order_relaxed); }
+    //@}
+
+    //! \name Readings
+    //@{
+    const stat_histogram &generation_us() const { return generation_us_; }
+    const stat_histogram &jitter_us() const { return jitter_us_; }
+    const stat_histogram &depth() const { return depth_; }
+    uint64_t periods() const { return periods_.load(para::memory_order_relaxed); }
+    uint64_t callbacks() const { return callbacks_.load(para::memory_order_relaxed); }
+    uint64_t underflows() const { return underflows_.load(para::memory_order_relaxed); }
+    uint64_t flushes() const { return flushed_.load(para::memory_order_relaxed); }
+    double elapsed_s() const { return (detail::now_ns() - start_ns_) / 1e9; }
+
+    //! \brief Most resident memory the process has had, in kilobytes.  0 if we
+    //! can't tell.
+    static long peak_rss_kb() {
+#ifndef _WIN32
+      rusage u;
+      if (getrusage(RUSAGE_SELF, &u) == 0) {
+#  ifdef __APPLE__
+        return u.ru_maxrss / 1024;
+#  else
+        return u.ru_maxrss;
+#  endif
+      }
+#endif
+      return 0;
+    }
+    //@}
+
+    //! \brief Human readable.
+    std::ostream &print(std::ostream &o) const {
+      o << "Statistics after " << elapsed_s() << "s:\n"
+        << "  Periods calculated: " << periods() << "\n"
+        << "  Callbacks: " << callbacks() << "\n"
+        << "  Underflows: " << underflows() << "\n"
+        << "  Flushed callbacks: " << flushes() << "\n"
+        << "  Peak RSS: " << peak_rss_kb() << "KB\n";
+      print_histogram(o, "Calculation per period", generation_us_, "us");
+      print_histogram(o, "Callback jitter", jitter_us_, "us");
+      print_histogram(o, "Queue depth", depth_, " periods");
+      return o;
+    }
+
+    //! \brief One JSON object.
+    std::ostream &write_json(std::ostream &o) const {
+      o << "{\n"
+        << "  \"elapsed_s\": " << elapsed_s() << ",\n"
+        << "  \"periods\": " << periods() << ",\n"
+        << "  \"callbacks\": " << callbacks() << ",\n"
+        << "  \"underflows\": " << underflows() << ",\n"
+        << "  \"flushed_callbacks\": " << flushes() << ",\n"
+        << "  \"peak_rss_kb\": " << peak_rss_kb() << ",\n";
+      json_histogram(o, "generation_us", generation_us_) << ",\n";
+      json_histogram(o, "callback_jitter_us", jitter_us_) << ",\n";
+      json_histogram(o, "queue_depth", depth_) << "\n";
+      return o << "}\n";
+    }
+
+  private:
+    static void print_histogram(std::ostream &o, const char *name, const stat_histogram &h,
+                                const char *unit) {
+      o << "  " << name << ": ";
+      if (! h.count()) {
+        o << "none\n";
+        return;
+      }
+      o << "mean " << h.mean() << unit << ", 50% under " << h.percentile(0.5) << unit
+        << ", 99% under " << h.percentile(0.99) << unit << ", max " << h.max() << unit << "\n";
+    }
+
+    static std::ostream &json_histogram(std::ostream &o, const char *name, const stat_histogram &h) {
+      o << "  \"" << name << "\": {\"count\": " << h.count() << ", \"mean\": " << h.mean()
+        << ", \"p50\": " << h.percentile(0.5) << ", \"p99\": " << h.percentile(0.99)
+        << ", \"max\": " << h.max() << ", \"buckets\": [";
+      // Trailing empty buckets are left off.
+      unsigned int used = stat_histogram::buckets;
+      while (used > 0 && ! h.bucket(used - 1)) --used;
+      for (unsigned int b = 0; b < used; ++b) {
+        o << (b ? ", " : "") << h.bucket(b);
+      }
+      return o << "]}";
+    }
+
+    const uint64_t start_ns_;
+    uint64_t period_ns_;
+    uint64_t last_callback_ns_;
+
+    stat_histogram generation_us_;
+    stat_histogram jitter_us_;
+    stat_histogram depth_;
+
+    para::atomic<uint64_t> periods_;
+    para::atomic<uint64_t> callbacks_;
+    para::atomic<uint64_t> underflows_;
+    para::atomic<uint64_t> flushed_;
+};
+
+#endif
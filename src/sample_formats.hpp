@@ -0,0 +1,110 @@
+/*!
+\file
+\brief Conversion of calculated samples into each of SDL's sample formats.
+
+Each format is a traits struct with:
+
+- storage_type -- the raw bits of one sample as it is laid out in the buffer.
+- source_type -- what we want from the oscillator: int16_t for full-scale Q15
+  samples, or double for samples normalised between -1 and 1.
+- convert() -- source_type to storage_type, including any byte swapping.
+
+These are used as template parameters so the conversion is inlined into
+the generator's inner loop.
+*/
+#ifndef SAMPLE_FORMATS_HPP_ow83bd2e
+#define SAMPLE_FORMATS_HPP_ow83bd2e
+
+#include "sdl.hpp"
+
+#include <cstring>
+
+#include <stdint.h>
+
+namespace sample_formats {
+  //! \brief Endianness of the machine we're running on.
+  const bool host_big_endian = (AUDIO_U16SYS == AUDIO_U16MSB);
+
+  //! \brief Swap to the other byte order if Swap is true.
+  template <bool Swap>
+  struct byte_order {
+    static uint16_t apply(uint16_t v) { return v; }
+    static uint32_t apply(uint32_t v) { return v; }
+  };
+
+  template <>
+  struct byte_order<true> {
+    static uint16_t apply(uint16_t v) {
+      return (uint16_t) ((v >> 8) | (v << 8));
+    }
+
+    static uint32_t apply(uint32_t v) {
+      return (v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) | (v << 24);
+    }
+  };
+
+  //! \brief Unsigned 8 bit; silence is 0x80.
+  struct u8 {
+    typedef uint8_t storage_type;
+    typedef int16_t source_type;
+
+    static storage_type convert(source_type s) { return (storage_type) ((s >> 8) + 0x80); }
+  };
+
+  //! \brief Signed 8 bit.
+  struct s8 {
+    typedef uint8_t storage_type;
+    typedef int16_t source_type;
+
+    static storage_type convert(source_type s) { return (storage_type) (int8_t) (s >> 8); }
+  };
+
+  //! \brief Unsigned 16 bit; silence is 0x8000.
+  template <bool BigEndian>
+  struct u16 {
+    typedef uint16_t storage_type;
+    typedef int16_t source_type;
+
+    static storage_type convert(source_type s) {
+      return byte_order<BigEndian != host_big_endian>::apply((uint16_t) (s + 0x8000));
+    }
+  };
+
+  //! \brief Signed 16 bit.  On the host's byte order this is a copy.
+  template <bool BigEndian>
+  struct s16 {
+    typedef uint16_t storage_type;
+    typedef int16_t source_type;
+
+    static storage_type convert(source_type s) {
+      return byte_order<BigEndian != host_big_endian>::apply((uint16_t) s);
+    }
+  };
+
+  //! \brief Signed 32 bit.
+  template <bool BigEndian>
+  struct s32 {
+    typedef uint32_t storage_type;
+    typedef double source_type;
+
+    static storage_type convert(source_type s) {
+      return byte_order<BigEndian != host_big_endian>::apply((uint32_t) (int32_t) (s * 2147483647.0));
+    }
+  };
+
+  //! \brief 32 bit IEEE float between -1 and 1.
+  template <bool BigEndian>
+  struct f32 {
+    typedef uint32_t storage_type;
+    typedef double source_type;
+
+    static storage_type convert(source_type s) {
+      const float f = (float) s;
+      uint32_t bits;
+      std::memcpy(&bits, &f, sizeof(bits));
+      return byte_order<BigEndian != host_big_endian>::apply(bits);
+    }
+  };
+}
+
+#endif
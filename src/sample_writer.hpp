@@ -0,0 +1,445 @@
+/*!
+\file
+\brief Streaming writer for the --dump file: WAV, RF64 or raw samples.
+
+Writes are collected in large buffers which a write_behind thread writes in
+one go, so there are a few big writes instead of one per period, and none of
+them hold up the thread producing the samples.
+
+For WAV, the header is written up front with the sizes left as zero, plus a
+JUNK chunk big enough for an RF64 ds64 chunk.  close() patches the sizes in.
+If the file turned out too big for the 32 bit RIFF sizes (about 4GB) then
+the header is turned into RF64 in place, so the samples never move.
+*/
+#ifndef SAMPLE_WRITER_HPP_f0c3tw6l
+#define SAMPLE_WRITER_HPP_f0c3tw6l
+
+#include "sdl.hpp"
+#include "period_pool.hpp"
+#include "write_behind.hpp"
+
+#include <para/atomic.hpp>
+
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <cassert>
+
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+//! \brief What is stored in the dump file.
+enum dump_container {
+  //! \brief Just the samples, as they are sent to the device.
+  container_raw,
+  //! \brief WAV, or RF64 if it's too big.
+  container_wav
+};
+
+namespace detail {
+  inline void put_le16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t) v;
+    p[1] = (uint8_t) (v >> 8);
+  }
+
+  inline void put_le32(uint8_t *p, uint32_t v) {
+    put_le16(p, (uint16_t) v);
+    put_le16(p + 2, (uint16_t) (v >> 16));
+  }
+
+  inline void put_le64(uint8_t *p, uint64_t v) {
+    put_le32(p, (uint32_t) v);
+    put_le32(p + 4, (uint32_t) (v >> 32));
+  }
+
+  //! \brief WAV fmt chunk contents for an SDL sample format.
+  struct wav_format {
+    static const uint16_t tag_pcm = 0x0001;
+    static const uint16_t tag_float = 0x0003;
+    static const uint16_t tag_extensible = 0xfffe;
+
+    //! \brief Throws std::runtime_error if WAV can't store \p spec's format.
+    explicit wav_format(const sdl::audio_spec &spec)
+    : channels(spec.channels()), rate(spec.frequency()) {
+      switch (spec.format()) {
+        // WAV's 8 bit samples are unsigned and the others are signed.
+        case AUDIO_U8:
+          tag = tag_pcm; bits = 8; break;
+        case AUDIO_S16LSB:
+          tag = tag_pcm; bits = 16; break;
+#ifdef AUDIO_S32LSB
+        case AUDIO_S32LSB:
+          tag = tag_pcm; bits = 32; break;
+#endif
+#ifdef AUDIO_F32LSB
+        case AUDIO_F32LSB:
+          tag = tag_float; bits = 32; break;
+#endif
+        default:
+          throw std::runtime_error("the sample format can't be stored in a WAV file; use --dump-format=raw");
+      }
+    }
+
+    //! \brief WAVE_FORMAT_EXTENSIBLE is needed for more than two channels or
+    //! more than 16 bits.
+    bool extensible() const { return channels > 2 || bits > 16; }
+
+    uint32_t chunk_size() const { return extensible() ? 40 : 16; }
+
+    //! \brief Write the fmt chunk's body (chunk_size() bytes) to \p p.
+    void put(uint8_t *p) const {
+      const uint16_t block_align = channels * bits / 8;
+      put_le16(p, extensible() ? tag_extensible : tag);
+      put_le16(p + 2, channels);
+      put_le32(p + 4, rate);
+      put_le32(p + 8, rate * block_align);
+      put_le16(p + 12, block_align);
+      put_le16(p + 14, bits);
+      if (extensible()) {
+        // cbSize, valid bits, channel mask (unspecified), then the sub format
+        // GUID which is the tag and the same suffix for all of them.
+        static const uint8_t guid_suffix[14] = {
+          0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71
+        };
+        put_le16(p + 16, 22);
+        put_le16(p + 18, bits);
+        put_le32(p + 20, 0);
+        put_le16(p + 24, tag);
+        std::memcpy(p + 26, guid_suffix, sizeof(guid_suffix));
+      }
+    }
+
+    uint16_t tag;
+    uint16_t channels;
+    uint32_t rate;
+    uint16_t bits;
+  };
+}
+
+//! \brief How sample_writer does its I/O.
+struct sample_writer_options {
+  //! \brief Default size of each write buffer.
+  static const std::size_t default_buffer_size = 1024 * 1024;
+  //! \brief Default number of buffers.
+  static const std::size_t default_buffers = 4;
+
+  sample_writer_options()
+  : buffer_size(default_buffer_size), buffers(default_buffers), direct(false),
+    drop_when_full(false) {}
+
+  //! \brief Bytes collected before a write.
+  std::size_t buffer_size;
+  //! \brief Buffers being filled or written at once.
+  std::size_t buffers;
+  //! \brief Write the aligned parts with O_DIRECT, bypassing the page cache.
+  bool direct;
+  //! \brief When the disk can't keep up, leave a hole of silence in the file
+  //! instead of waiting.  For playback, where waiting causes underflows.
+  bool drop_when_full;
+};
+
+//! \brief Buffered writer of samples to a file in a container.
+class sample_writer : boost::noncopyable {
+  public:
+    /*!
+    \brief Create \p filename and write the header.
+
+    \p spec gives the sample format and the period size used by dump().
+    Throws std::runtime_error if the file can't be made or the container
+    can't store the format.
+    */
+    sample_writer(const std::string &filename, dump_container container,
+                  const sdl::audio_spec &spec,
+                  const sample_writer_options &options = sample_writer_options())
+    : container_(container), period_size_(spec.buffer_size()), drop_(options.drop_when_full),
+      fd_(-1), direct_fd_(-1), data_start_(0), appended_(0), extent_(0), dropped_(0), stalls_(0),
+      current_(NULL), fill_(0), limit_(0) {
+      std::vector<uint8_t> header;
+      if (container_ == container_wav) {
+        // With O_DIRECT the samples start on an aligned offset, so the big
+        // writes from there on are too.
+        make_wav_header(header, detail::wav_format(spec), options.direct ? write_behind::alignment : 0);
+      }
+      data_start_ = header.size();
+
+      fd_ = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+      if (fd_ == -1) {
+        throw_error("could not open the --dump file");
+      }
+
+      try {
+        if (options.direct) {
+#ifdef O_DIRECT
+          direct_fd_ = ::open(filename.c_str(), O_WRONLY | O_DIRECT);
+          if (direct_fd_ == -1) {
+            throw_error("could not open the --dump file for direct I/O");
+          }
+#else
+          throw std::runtime_error("direct I/O is not supported on this system");
+#endif
+        }
+
+        if (! header.empty()) {
+          detail::pwrite_all(fd_, &header[0], header.size(), 0);
+        }
+        writer_.reset(new write_behind(fd_, direct_fd_, options.buffer_size, options.buffers));
+      }
+      catch (...) {
+        close_fds();
+        throw;
+      }
+      next_buffer();
+    }
+
+    //! \brief Calls close() but ignores any error.  Call close() yourself to
+    //! find out if the file is complete.
+    ~sample_writer() {
+      try { close(); }
+      catch (std::exception &) {}
+      writer_.reset();
+      close_fds();
+    }
+
+    //! \brief Write a whole period.
+    void dump(const period_buffer &buf) {
+      write(buf.get(), period_size_);
+    }
+
+    void dump(const shared_period &buf) {
+      write(buf.get(), period_size_);
+    }
+
+    //! \brief Append any number of bytes of samples.
+    void write(const void *data, std::size_t bytes) {
+      assert(writer_);
+      const uint8_t *p = (const uint8_t *) data;
+      while (bytes > 0) {
+        const std::size_t n = std::min(bytes, limit_ - fill_);
+        if (current_) {
+          std::memcpy(current_ + fill_, p, n);
+        }
+        fill_ += n;
+        p += n;
+        bytes -= n;
+
+        if (fill_ == limit_) {
+          submit_current();
+          next_buffer();
+        }
+      }
+    }
+
+    //! \brief Write samples at \p offset bytes from the start of the samples.
+    //! This doesn't go through the append buffer or move where write()
+    //! appends to.  Safe from several threads at once but not alongside
+    //! write().
+    void write_at(const void *data, std::size_t bytes, uint64_t offset) {
+      assert(writer_);
+      const uint8_t *p = (const uint8_t *) data;
+      while (bytes > 0) {
+        const std::size_t n = std::min(bytes, writer_->buffer_size());
+        uint8_t *b = writer_->acquire(! drop_);
+        if (b) {
+          std::memcpy(b, p, n);
+          writer_->submit(b, n, data_start_ + offset);
+        }
+        else {
+          dropped_.fetch_add(n, para::memory_order_relaxed);
+        }
+        note_extent(offset + n);
+        p += n;
+        bytes -= n;
+        offset += n;
+      }
+    }
+
+    //! \brief Send the partly filled buffer to be written now.
+    void flush() {
+      if (fill_ == 0) return;
+      submit_current();
+      next_buffer();
+    }
+
+    //! \brief Flush, wait for the writes, fill in the header and close the
+    //! file.  Does nothing the second time.
+    void close() {
+      if (! writer_) return;
+      submit_current();
+      writer_->drain();
+      stalls_ = writer_->stalls();
+      writer_.reset();
+
+      if (container_ == container_wav) {
+        finish_wav();
+      }
+
+      if (::close(fd_) == -1) {
+        fd_ = -1;
+        throw_error("closing the --dump file failed");
+      }
+      fd_ = -1;
+    }
+
+    //! \brief Bytes of samples written so far, including any dropped.
+    uint64_t data_size() const { return extent_.load(para::memory_order_relaxed); }
+
+    //! \name Backpressure
+    //@{
+
+    //! \brief Bytes which were left as a hole because the disk couldn't keep up.
+    uint64_t dropped() const { return dropped_.load(para::memory_order_relaxed); }
+
+    //! \brief Times there was no free buffer.
+    uint64_t stalls() const { return writer_ ? writer_->stalls() : stalls_; }
+    //@}
+
+  private:
+    //! \name WAV layout
+    //@{
+    static const std::size_t riff_size_offset = 4;
+    static const std::size_t ds64_offset = 12;
+    // riff size, data size, sample count and table length.
+    static const uint32_t ds64_size = 28;
+    //@}
+
+    //! \brief If \p align isn't 0, a second JUNK chunk pads the header to a
+    //! multiple of it.
+    static void make_wav_header(std::vector<uint8_t> &h, const detail::wav_format &fmt, std::size_t align) {
+      const uint32_t fmt_size = fmt.chunk_size();
+      std::size_t size = 12 + (8 + ds64_size) + (8 + fmt_size) + 8;
+      std::size_t pad = 0;
+      if (align) {
+        pad = (align - (size + 8) % align) % align;
+        size += 8 + pad;
+      }
+      h.assign(size, 0);
+      uint8_t *p = &h[0];
+
+      std::memcpy(p, "RIFF", 4);
+      std::memcpy(p + 8, "WAVE", 4);
+      p += 12;
+      // Reserved for the ds64 chunk if the file needs to be RF64.
+      std::memcpy(p, "JUNK", 4);
+      detail::put_le32(p + 4, ds64_size);
+      p += 8 + ds64_size;
+      if (align) {
+        std::memcpy(p, "JUNK", 4);
+        detail::put_le32(p + 4, (uint32_t) pad);
+        p += 8 + pad;
+      }
+      std::memcpy(p, "fmt ", 4);
+      detail::put_le32(p + 4, fmt_size);
+      fmt.put(p + 8);
+      p += 8 + fmt_size;
+      std::memcpy(p, "data", 4);
+    }
+
+    //! \brief Patch the sizes into the header.
+    void finish_wav() {
+      const uint64_t data = extent_.load(para::memory_order_relaxed);
+      // Chunks must be an even number of bytes.
+      if (data % 2) {
+        const uint8_t pad = 0;
+        detail::pwrite_all(fd_, &pad, 1, data_start_ + data);
+      }
+
+      const uint64_t riff = data_start_ + data + (data % 2) - 8;
+      uint8_t b[8];
+      if (riff <= 0xffffffffULL) {
+        detail::put_le32(b, (uint32_t) riff);
+        detail::pwrite_all(fd_, b, 4, riff_size_offset);
+        detail::put_le32(b, (uint32_t) data);
+        detail::pwrite_all(fd_, b, 4, data_start_ - 4);
+        return;
+      }
+
+      // RF64: the 32 bit sizes are all ones and the real ones are in ds64.
+      uint8_t ds64[8 + ds64_size];
+      std::memset(ds64, 0, sizeof(ds64));
+      std::memcpy(ds64, "ds64", 4);
+      detail::put_le32(ds64 + 4, ds64_size);
+      detail::put_le64(ds64 + 8, riff);
+      detail::put_le64(ds64 + 16, data);
+      // The sample count is only needed for non-PCM, and then it's frames.
+      detail::put_le64(ds64 + 24, 0);
+      detail::pwrite_all(fd_, ds64, sizeof(ds64), ds64_offset);
+
+      std::memcpy(b, "RF64", 4);
+      detail::put_le32(b + 4, 0xffffffff);
+      detail::pwrite_all(fd_, b, 8, 0);
+      detail::put_le32(b, 0xffffffff);
+      detail::pwrite_all(fd_, b, 4, data_start_ - 4);
+    }
+
+    //! \brief Hand the current buffer to the writer (or count it as dropped).
+    void submit_current() {
+      if (fill_ == 0) {
+        if (current_) writer_->release(current_);
+      }
+      else if (current_) {
+        writer_->submit(current_, fill_, data_start_ + appended_);
+      }
+      else {
+        dropped_.fetch_add(fill_, para::memory_order_relaxed);
+      }
+      current_ = NULL;
+
+      appended_ += fill_;
+      note_extent(appended_);
+      fill_ = 0;
+    }
+
+    //! \brief Start filling another buffer.  It stops short of the buffer size
+    //! if that gets the next one onto an aligned offset.
+    void next_buffer() {
+      const std::size_t size = writer_->buffer_size();
+      limit_ = size - (data_start_ + appended_) % write_behind::alignment;
+      current_ = writer_->acquire(! drop_);
+    }
+
+    //! \brief Remember the furthest byte written.
+    void note_extent(uint64_t end) {
+      uint64_t cur = extent_.load(para::memory_order_relaxed);
+      while (end > cur && ! extent_.compare_exchange_weak(cur, end, para::memory_order_relaxed)) {}
+    }
+
+    void close_fds() {
+      if (direct_fd_ != -1) ::close(direct_fd_);
+      if (fd_ != -1) ::close(fd_);
+      direct_fd_ = fd_ = -1;
+    }
+
+    static void throw_error(const char *what) {
+      throw std::runtime_error(std::string(what) + ": " + std::strerror(errno));
+    }
+
+    const dump_container container_;
+    const std::size_t period_size_;
+    const bool drop_;
+    int fd_;
+    int direct_fd_;
+
+    // Bytes of header before the samples.
+    uint64_t data_start_;
+    // Where write() appends, not counting the current buffer.
+    uint64_t appended_;
+    // End of the furthest write.
+    para::atomic<uint64_t> extent_;
+    para::atomic<uint64_t> dropped_;
+    uint64_t stalls_;
+
+    boost::scoped_ptr<write_behind> writer_;
+    // Buffer write() is filling; NULL when its data is being dropped.
+    uint8_t *current_;
+    std::size_t fill_;
+    std::size_t limit_;
+};
+
+#endif
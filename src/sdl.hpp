@@ -167,15 +167,28 @@ class audio_spec {
       spec().size = 0;
     }
 
+    //! \brief Work out size and silence like SDL_OpenAudio does.  For specs which
+    //! are never given to a device, eg when rendering to a file.
+    void calculate() {
+      spec().silence = (format() == AUDIO_U8 || format() == AUDIO_U16LSB || format() == AUDIO_U16MSB) ? 0x80 : 0;
+      spec().size = ((format() & 0xff) / 8) * channels() * buffer_samples();
+    }
+
     //! \brief Mono = 1, stereo = 2, etc.
     int channels() const { return spec().channels; }
     void channels(int n) { spec().channels = n; }
 
+    //! \brief One of the AUDIO_* sample formats.
+    int format() const { return spec().format; }
+    void format(int f) { spec().format = f; }
+
     //! \brief Size in bytes of the buffer (calculated from sizeof(data) * samples() * channels()).
     std::size_t buffer_size() const { return spec().size; }
 
     //! \brief Buffer size in samples.
     int buffer_samples() const { return spec().samples; }
+    //! \brief SDL 1.2 wants a power of two.
+    void buffer_samples(int n) { spec().samples = n; }
 
     //! \brief Audio sample rate.
     uint32_t frequency() const { return spec().freq; }
@@ -231,6 +244,18 @@ class audio_spec {
           o << "u16 big"; break;
         case AUDIO_S16MSB:
           o << "s16 big"; break;
+#ifdef AUDIO_S32LSB
+        case AUDIO_S32LSB:
+          o << "s32 little"; break;
+        case AUDIO_S32MSB:
+          o << "s32 big"; break;
+#endif
+#ifdef AUDIO_F32LSB
+        case AUDIO_F32LSB:
+          o << "f32 little"; break;
+        case AUDIO_F32MSB:
+          o << "f32 big"; break;
+#endif
         default:
           o << "(unexpected value)";
       }
@@ -42,6 +42,8 @@ void settings::parse_args(int argc, char **argv) {
   namespace po = boost::program_options;
 
   std::string root_note;
+  std::string oscillator_name;
+  std::string dump_format_name;
   po::options_description all_opts("Options");
   all_opts.add_options()
     ("help,h", "Show this help message and quit.")
@@ -50,10 +52,34 @@ void settings::parse_args(int argc, char **argv) {
     ("time,t", po::value<int>(&duration_),
      "Time for each note in milliseconds; 0 for forever.  Defaults: " DEFAULT_NOTE_DURATION_STR " unless no notes "
      "or --start specified in which case it is forever.")
+    ("cycle-error", po::value<double>(&cycle_error_),
+     "Notes which play forever are repeated from one calculated loop of the wave.  This "
+     "is how far out of tune, in cents, the note may be so the loop is short.  "
+     "Default: " DEFAULT_CYCLE_ERROR_STR)
     ("pause", po::value<int>(&pause_time_),
      "Millisecond pause time between notes.  Default: " DEFAULT_PAUSE_TIME_STR)
     ("dump,D", po::value<std::string>(&dump_file_),
-     "Dump raw samples to a file.  The file usually need to be converted to a playable format with ffmpeg(1) or similar.")
+     "Dump samples to a file.  See --dump-format.")
+    ("dump-format", po::value<std::string>(&dump_format_name),
+     "'wav' or 'raw' (headerless samples).  Default: wav if the --dump file ends with .wav, otherwise raw.")
+    ("dump-buffer", po::value<int>(&dump_buffer_kb_),
+     "Kilobytes collected before writing to the --dump file.  Default: " DEFAULT_DUMP_BUFFER_STR)
+    ("dump-buffers", po::value<int>(&dump_buffers_),
+     "Buffers of --dump-buffer size which can be waiting to be written.  Default: " DEFAULT_DUMP_BUFFERS_STR)
+    ("direct-io",
+     "Write the --dump file with O_DIRECT, bypassing the page cache.  Useful for big --offline renders.")
+    ("stats",
+     "Print how long periods took to calculate, how late the sound card's callbacks were, "
+     "the queue depth, underflows and memory use at the end.")
+    ("stats-json", po::value<std::string>(&stats_json_),
+     "Write the same as --stats to this file as JSON; - for stdout.")
+    ("trace", po::value<std::string>(&trace_file_),
+     "Record what each thread does and write the last few seconds of it to this file at "
+     "the end.  Read it with tune-trace.")
+    ("profile",
+     "Count CPU cycles, instructions, cache misses and branch misses while calculating "
+     "each note, then time each sine kernel, and report them per sample.  Every note is "
+     "calculated: the note cache is off.")
     ("start,s", po::value<std::string>(&start_note_),
      "Note name or frequency to start with.")
     ("distance,d", po::value<int>(&note_distance_),
@@ -74,6 +100,47 @@ void settings::parse_args(int argc, char **argv) {
      "Sample rate.  Default: " DEFAULT_SAMPLE_RATE_STR)
     ("channels", po::value<int>(&channels_),
      "Channels in the sample (1, for mono, 2 for stereo etc).  Default: " DEFAULT_CHANNELS_STR)
+    ("oscillator", po::value<std::string>(&oscillator_name),
+     "How to calculate the wave: 'sine' (floating point) or 'dds' (integer phase and "
+     "lookup table; constant cost and no drift on long notes).  Default: sine")
+    ("latency-target", po::value<int>(&latency_target_),
+     "Most milliseconds of sound to queue ahead.  The queue is kept as short as possible "
+     "without underflows, up to this.  Default: 10 periods.")
+    ("latency-min", po::value<int>(&latency_min_),
+     "Fewest periods the queue is cut down to.  Default: " DEFAULT_LATENCY_MIN_STR)
+    ("underflow-budget", po::value<int>(&underflow_budget_),
+     "Underflows allowed in a second before the queue is lengthened.  Default: 0")
+    ("period", po::value<int>(&period_frames_),
+     "Frames the sound card plays at a time; a power of two.  Smaller is lower latency "
+     "but harder to keep up with.  Default: " DEFAULT_PERIOD_STR ", or " LOW_LATENCY_PERIOD_STR
+     " with --low-latency.")
+    ("low-latency",
+     "Small periods, and run the producer with real-time priority, locked memory and "
+     "pinned to one CPU where that's allowed.")
+    ("cpu", po::value<int>(&cpu_),
+     "CPU to pin the producer to.  Default: the one it starts on with --low-latency, "
+     "otherwise none.")
+    ("prefill", po::value<int>(&prefill_),
+     "Periods to calculate before the sound starts.  Default: a full queue.")
+    ("early-start",
+     "Open the sound card on another thread while the first periods are calculated.  "
+     "If the card can't take the requested format, SDL converts it.")
+    ("note-cache", po::value<int>(&note_cache_mb_),
+     "Megabytes of calculated notes to keep so they can be copied when they're played "
+     "again, eg with --loop.  0 turns it off.  Default: " DEFAULT_NOTE_CACHE_STR)
+    ("cache-dir", po::value<std::string>(&cache_dir_),
+     "Also keep calculated notes in this directory, so later runs (and --offline) can "
+     "map them instead of calculating them.  It's made if it doesn't exist.")
+    ("cache-dir-limit", po::value<int>(&cache_dir_mb_),
+     "Megabytes of notes to keep in --cache-dir; the least recently used go first.  "
+     "Default: " DEFAULT_CACHE_DIR_STR)
+    ("pull",
+     "Calculate samples in the sound card's callback instead of a separate thread.  "
+     "Lowest latency, but can't be used with --dump.")
+    ("offline",
+     "Don't play anything; write --dump as fast as possible and quit.")
+    ("threads", po::value<int>(&threads_),
+     "Threads to render with in --offline mode.  Default: one per CPU.")
     ;
 
   po::variables_map vm;
@@ -99,6 +166,36 @@ void settings::parse_args(int argc, char **argv) {
     // }
   }
 
+  if (vm.count("dump-format")) {
+    if (dump_format_name == "wav") {
+      dump_format_ = dump_format_wav;
+    }
+    else if (dump_format_name == "raw") {
+      dump_format_ = dump_format_raw;
+    }
+    else {
+      throw std::runtime_error("--dump-format must be 'wav' or 'raw'");
+    }
+  }
+  else {
+    const std::string ext = ".wav";
+    const std::size_t len = dump_file_.size();
+    if (len >= ext.size() && dump_file_.compare(len - ext.size(), ext.size(), ext) == 0) {
+      dump_format_ = dump_format_wav;
+    }
+  }
+
+  if (dump_buffer_kb_ <= 0) {
+    throw std::runtime_error("--dump-buffer must be at least 1");
+  }
+
+  if (dump_buffers_ <= 0) {
+    throw std::runtime_error("--dump-buffers must be at least 1");
+  }
+
+  if (vm.count("direct-io")) { flags_[fl_direct_io] = true; }
+  if (vm.count("stats")) { flags_[fl_stats] = true; }
+
   // TODO:
   //   perfer some way of --time-forever so we don't have to do --time=0 which makes
   //   no sense.
@@ -107,6 +204,11 @@ void settings::parse_args(int argc, char **argv) {
   }
   else if (duration_ == 0) {
     std::cerr << "warning: when --time is 0 each note will play forever." << std::endl;
+    duration_ = forever;
+  }
+
+  if (cycle_error_ < 0) {
+    throw std::runtime_error("--cycle-error must be at least 0");
   }
 
   if (vm.count("volume")) {
@@ -140,6 +242,100 @@ void settings::parse_args(int argc, char **argv) {
 
   if (vm.count("loop")) { flags_[fl_loop] = true; }
 
+  if (vm.count("pull")) {
+    if (vm.count("dump")) {
+      throw std::runtime_error("--pull and --dump conflict");
+    }
+    flags_[fl_pull] = true;
+  }
+
+  if (latency_target_ < 0) {
+    throw std::runtime_error("--latency-target must be at least 0");
+  }
+
+  if (latency_min_ < 1) {
+    throw std::runtime_error("--latency-min must be at least 1");
+  }
+
+  if (underflow_budget_ < 0) {
+    throw std::runtime_error("--underflow-budget must be at least 0");
+  }
+
+  if (vm.count("low-latency")) {
+    flags_[fl_low_latency] = true;
+    if (! vm.count("period")) {
+      period_frames_ = LOW_LATENCY_PERIOD_FRAMES;
+    }
+  }
+
+  // SDL wants a power of two which fits in 16 bits.
+  if (period_frames_ < 16 || period_frames_ > 32768 || (period_frames_ & (period_frames_ - 1))) {
+    throw std::runtime_error("--period must be a power of two from 16 to 32768");
+  }
+
+  if (vm.count("cpu") && cpu_ < 0) {
+    throw std::runtime_error("--cpu must be at least 0");
+  }
+
+  if (note_cache_mb_ < 0) {
+    throw std::runtime_error("--note-cache must be at least 0");
+  }
+
+  if (cache_dir_mb_ < 1) {
+    throw std::runtime_error("--cache-dir-limit must be at least 1");
+  }
+
+  if (prefill_ < 0) {
+    throw std::runtime_error("--prefill must be at least 0");
+  }
+
+  if (vm.count("early-start")) { flags_[fl_early_start] = true; }
+
+  if (threads_ < 0) {
+    throw std::runtime_error("--threads must be at least 0");
+  }
+
+  if (vm.count("profile")) {
+    // The counters are the producer's, and a cached note isn't calculated.
+    if (vm.count("pull")) {
+      throw std::runtime_error("--profile and --pull conflict");
+    }
+    else if (vm.count("cache-dir")) {
+      throw std::runtime_error("--profile and --cache-dir conflict");
+    }
+    flags_[fl_profile] = true;
+    note_cache_mb_ = 0;
+    threads_ = 1;
+  }
+
+  if (vm.count("offline")) {
+    if (! vm.count("dump")) {
+      throw std::runtime_error("--offline needs a --dump file");
+    }
+    else if (vm.count("pull")) {
+      throw std::runtime_error("--offline and --pull conflict");
+    }
+    else if (vm.count("loop")) {
+      throw std::runtime_error("--offline and --loop conflict");
+    }
+    else if (duration_ == forever) {
+      throw std::runtime_error("--offline can't play notes forever");
+    }
+    flags_[fl_offline] = true;
+  }
+
+  if (vm.count("oscillator")) {
+    if (oscillator_name == "sine") {
+      oscillator_ = oscillator_sine;
+    }
+    else if (oscillator_name == "dds") {
+      oscillator_ = oscillator_dds;
+    }
+    else {
+      throw std::runtime_error("--oscillator must be 'sine' or 'dds'");
+    }
+  }
+
   // now loop the non-options values which are in 'parsed'
   // also note_mode_list/note_mode_start.
 
@@ -24,6 +24,8 @@
 #include <cstdlib>
 #include <cassert>
 
+#include <stdint.h>
+
 // so we can string it in the help text
 #define DEFAULT_NOTE_DURATION     2000
 #define DEFAULT_NOTE_DURATION_STR "2000"
@@ -37,6 +39,22 @@
 #define DEFAULT_PAUSE_TIME_STR    "500"
 #define DEFAULT_VOLUME_INT        75
 #define DEFAULT_VOLUME_STR        "75"
+#define DEFAULT_DUMP_BUFFER_KB    1024
+#define DEFAULT_DUMP_BUFFER_STR   "1024"
+#define DEFAULT_DUMP_BUFFERS      4
+#define DEFAULT_DUMP_BUFFERS_STR  "4"
+#define DEFAULT_PERIOD_FRAMES     1024
+#define DEFAULT_PERIOD_STR        "1024"
+#define LOW_LATENCY_PERIOD_FRAMES 128
+#define LOW_LATENCY_PERIOD_STR    "128"
+#define DEFAULT_LATENCY_MIN       2
+#define DEFAULT_LATENCY_MIN_STR   "2"
+#define DEFAULT_NOTE_CACHE_MB     32
+#define DEFAULT_NOTE_CACHE_STR    "32"
+#define DEFAULT_CYCLE_ERROR       0.01
+#define DEFAULT_CYCLE_ERROR_STR   "0.01"
+#define DEFAULT_CACHE_DIR_MB      1024
+#define DEFAULT_CACHE_DIR_STR     "1024"
 
 namespace boost {
   namespace program_options {
@@ -70,6 +88,18 @@ class settings {
       //! \brief use start_note() and note_distance().
       note_mode_start} note_mode_type;
 
+    typedef enum {
+      //! \brief sine_calculation: floating point.
+      oscillator_sine,
+      //! \brief dds_calculation: integer phase accumulator and table.
+      oscillator_dds} oscillator_type;
+
+    typedef enum {
+      //! \brief Headerless samples.
+      dump_format_raw,
+      //! \brief WAV (RF64 when it's too big).
+      dump_format_wav} dump_format_type;
+
     //! \brief Throws program_options::error subclasses or invalid_setting for validation.
     settings(int argc, char **argv) {
       set_defaults();
@@ -90,6 +120,22 @@ class settings {
 
     bool dump_to_file() const { return ! dump_file_.empty(); }
     const std::string &dump_file() const { return dump_file_; }
+    //! \brief Raw or WAV; decided from the file name unless it was given.
+    dump_format_type dump_format() const { return dump_format_; }
+    //! \brief Bytes collected before writing to the dump file.
+    std::size_t dump_buffer_size() const { return dump_buffer_kb_ * 1024; }
+    //! \brief How many dump buffers can be being written at once.
+    int dump_buffers() const { return dump_buffers_; }
+    //! \brief Bypass the page cache for the dump file.
+    bool direct_io() const { return flag(fl_direct_io); }
+    //! \brief Print the run_stats when it's done.
+    bool stats() const { return flag(fl_stats); }
+    //! \brief File to write the run_stats to as JSON; "-" for stdout.  Empty if not given.
+    const std::string &stats_json() const { return stats_json_; }
+    //! \brief File to write the event trace to at the end.  Empty if not given.
+    const std::string &trace_file() const { return trace_file_; }
+    //! \brief Count CPU events while calculating and report them per sample.
+    bool profile() const { return flag(fl_profile); }
     //@}
 
     //! \name Regadring the explicit note list.
@@ -124,6 +170,8 @@ class settings {
     bool loop() const { return flag(fl_loop); }
     //! \brief Pause between notes.
     int pause_ms() const { return pause_time_; }
+    //! \brief Cents a forever note may be retuned by so it loops seamlessly.
+    double cycle_error_cents() const { return cycle_error_; }
     //@}
 
     //! \name Regarding the sound output.
@@ -132,6 +180,36 @@ class settings {
     int channels() const { return channels_; }
     double amplitude() const { return volume_ / 100.0; }
     int volume() const { return volume_; }
+    //! \brief Which wave calculation to use.
+    oscillator_type oscillator() const { return oscillator_; }
+    //! \brief Render in the audio callback instead of queueing periods.
+    bool pull() const { return flag(fl_pull); }
+    //! \brief Only write the dump file, as fast as possible.
+    bool offline() const { return flag(fl_offline); }
+    //! \brief Most queued latency the controller may use.  0 if not given.
+    int latency_target_ms() const { return latency_target_; }
+    //! \brief Fewest periods the controller may cut the queue down to.
+    int latency_min_periods() const { return latency_min_; }
+    //! \brief Underflows a second may have before the queue grows.
+    int underflow_budget() const { return underflow_budget_; }
+    //! \brief Threads for --offline.  0 means one per CPU.
+    int threads() const { return threads_; }
+    //! \brief Frames in each period the sound card asks for.  A power of two.
+    int period_frames() const { return period_frames_; }
+    //! \brief Real-time producer, locked memory and pinning.
+    bool low_latency() const { return flag(fl_low_latency); }
+    //! \brief CPU to pin the producer to.  -1 if not given.
+    int cpu() const { return cpu_; }
+    //! \brief Periods to queue before the sound starts.  0 means a full queue.
+    int prefill() const { return prefill_; }
+    //! \brief Open the sound card on another thread while the queue fills.
+    bool early_start() const { return flag(fl_early_start); }
+    //! \brief Bytes of rendered notes to keep for playing again.  0 for none.
+    std::size_t note_cache_size() const { return (std::size_t) note_cache_mb_ * 1024 * 1024; }
+    //! \brief Directory to keep rendered notes in between runs.  Empty if not given.
+    const std::string &cache_dir() const { return cache_dir_; }
+    //! \brief Most bytes of notes to keep in cache_dir().
+    uint64_t cache_dir_limit() const { return (uint64_t) cache_dir_mb_ * 1024 * 1024; }
     //@}
 
     //! \name Regarding technicalities of music.
@@ -174,7 +252,12 @@ class settings {
       }
 
       o << "Concert pitch is: " << concert_pitch() << "hz." << std::endl;
-      o << "Notes last for: " << duration_ms() << "ms." << std::endl;
+      if (duration_ms() == forever) {
+        o << "Notes last forever." << std::endl;
+      }
+      else {
+        o << "Notes last for: " << duration_ms() << "ms." << std::endl;
+      }
       o << "Pause for: " << pause_ms() << "ms after each note." << std::endl;
       o << "Looping: " << loop() << std::endl;
       o << "Amplitude is: " << amplitude();
@@ -194,6 +277,13 @@ class settings {
 
     enum options {
       fl_loop,
+      fl_pull,
+      fl_offline,
+      fl_direct_io,
+      fl_low_latency,
+      fl_early_start,
+      fl_stats,
+      fl_profile,
       fl_size
     };
     std::bitset<fl_size> flags_;
@@ -210,14 +300,32 @@ class settings {
     int pause_time_;
     int num_increments_;
     int volume_;
+    int threads_;
+    int latency_target_;
+    int latency_min_;
+    int underflow_budget_;
+    int period_frames_;
+    int cpu_;
+    int prefill_;
+    int note_cache_mb_;
+    int cache_dir_mb_;
+    double cycle_error_;
     double concert_pitch_;
 
     std::string start_note_;
     std::string end_note_;
 
     note_mode_type note_mode_;
+    oscillator_type oscillator_;
+
+    std::string cache_dir_;
+    std::string stats_json_;
+    std::string trace_file_;
 
     std::string dump_file_;
+    dump_format_type dump_format_;
+    int dump_buffer_kb_;
+    int dump_buffers_;
 
     void set_defaults() {
       exit_status_ = no_exit;
@@ -229,7 +337,21 @@ class settings {
       verbosity_level_ = verbosity_normal;
       volume_ = DEFAULT_VOLUME_INT;
       note_mode_ = note_mode_list;
+      oscillator_ = oscillator_sine;
       num_increments_ = -1;
+      threads_ = 0;
+      latency_target_ = 0;
+      latency_min_ = DEFAULT_LATENCY_MIN;
+      underflow_budget_ = 0;
+      period_frames_ = DEFAULT_PERIOD_FRAMES;
+      cpu_ = -1;
+      prefill_ = 0;
+      note_cache_mb_ = DEFAULT_NOTE_CACHE_MB;
+      cache_dir_mb_ = DEFAULT_CACHE_DIR_MB;
+      cycle_error_ = DEFAULT_CYCLE_ERROR;
+      dump_format_ = dump_format_raw;
+      dump_buffer_kb_ = DEFAULT_DUMP_BUFFER_KB;
+      dump_buffers_ = DEFAULT_DUMP_BUFFERS;
       concert_pitch_ = 440.0;
     }
 
@@ -0,0 +1,206 @@
+/*!
+\file
+\brief Block evaluation of sine waves, vectorised where the CPU allows it.
+
+The kernels all compute out[i] = amplitude * sin(pos + i * speed).  On x86 we
+use an SSE2 kernel (always available on x86-64) or an AVX2/FMA kernel when
+the CPU reports it; otherwise we fall back to calling libm per sample.
+*/
+#ifndef SINE_KERNELS_HPP_c2mf8w1q
+#define SINE_KERNELS_HPP_c2mf8w1q
+
+#include <vector>
+#include <cstddef>
+#include <cmath>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#  define TUNE_SINE_KERNELS_X86
+#  include <immintrin.h>
+#endif
+
+namespace sine_kernels {
+  namespace detail {
+    //! \name Cody-Waite split of pi for the range reduction.
+    //@{
+    const double pi_1 = 3.14159250259399414062;
+    const double pi_2 = 1.50995788317231926907e-7;
+    const double pi_3 = 1.07806057163162381058e-14;
+    //@}
+
+    //! \name Taylor coefficients of sin(r); accurate to ~1e-12 over [-pi/2, pi/2].
+    //@{
+    const double s3  = -1.0 / 6.0;
+    const double s5  =  1.0 / 120.0;
+    const double s7  = -1.0 / 5040.0;
+    const double s9  =  1.0 / 362880.0;
+    const double s11 = -1.0 / 39916800.0;
+    const double s13 =  1.0 / 6227020800.0;
+    const double s15 = -1.0 / 1307674368000.0;
+    //@}
+
+    //! \brief Scalar version of the vector kernels; used for the tail of a block.
+    inline double reduced_sin(double x) {
+      const double q = nearbyint(x * M_1_PI);
+      const double r = ((x - q * pi_1) - q * pi_2) - q * pi_3;
+      const double r2 = r * r;
+      double p = s15;
+      p = p * r2 + s13;
+      p = p * r2 + s11;
+      p = p * r2 + s9;
+      p = p * r2 + s7;
+      p = p * r2 + s5;
+      p = p * r2 + s3;
+      const double s = r + r * r2 * p;
+      return (static_cast<long long>(q) & 1) ? -s : s;
+    }
+  }
+
+  //! \brief Signature of all the kernels.
+  typedef void (*kernel_type)(double *out, std::size_t n, double pos, double speed, double amplitude);
+
+  //! \brief Fallback: libm per sample.
+  inline void scalar(double *out, std::size_t n, double pos, double speed, double amplitude) {
+    for (std::size_t i = 0; i < n; ++i) {
+      out[i] = amplitude * std::sin(pos + i * speed);
+    }
+  }
+
+#ifdef TUNE_SINE_KERNELS_X86
+  //! \brief Two lanes of double at a time.
+  inline void sse2(double *out, std::size_t n, double pos, double speed, double amplitude) {
+    const __m128d vpos = _mm_set1_pd(pos);
+    const __m128d vspeed = _mm_set1_pd(speed);
+    const __m128d vamp = _mm_set1_pd(amplitude);
+    const __m128d inv_pi = _mm_set1_pd(M_1_PI);
+    const __m128d two = _mm_set1_pd(2.0);
+    __m128d index = _mm_set_pd(1.0, 0.0);
+
+    std::size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+      const __m128d x = _mm_add_pd(vpos, _mm_mul_pd(index, vspeed));
+      index = _mm_add_pd(index, two);
+
+      const __m128i q = _mm_cvtpd_epi32(_mm_mul_pd(x, inv_pi));
+      const __m128d qd = _mm_cvtepi32_pd(q);
+      __m128d r = _mm_sub_pd(x, _mm_mul_pd(qd, _mm_set1_pd(detail::pi_1)));
+      r = _mm_sub_pd(r, _mm_mul_pd(qd, _mm_set1_pd(detail::pi_2)));
+      r = _mm_sub_pd(r, _mm_mul_pd(qd, _mm_set1_pd(detail::pi_3)));
+
+      const __m128d r2 = _mm_mul_pd(r, r);
+      __m128d p = _mm_set1_pd(detail::s15);
+      p = _mm_add_pd(_mm_mul_pd(p, r2), _mm_set1_pd(detail::s13));
+      p = _mm_add_pd(_mm_mul_pd(p, r2), _mm_set1_pd(detail::s11));
+      p = _mm_add_pd(_mm_mul_pd(p, r2), _mm_set1_pd(detail::s9));
+      p = _mm_add_pd(_mm_mul_pd(p, r2), _mm_set1_pd(detail::s7));
+      p = _mm_add_pd(_mm_mul_pd(p, r2), _mm_set1_pd(detail::s5));
+      p = _mm_add_pd(_mm_mul_pd(p, r2), _mm_set1_pd(detail::s3));
+      __m128d s = _mm_add_pd(r, _mm_mul_pd(_mm_mul_pd(r, r2), p));
+
+      // An odd multiple of pi flips the sign: move bit 0 of q to the sign bit.
+      const __m128i sign = _mm_slli_epi64(_mm_unpacklo_epi32(q, q), 63);
+      s = _mm_xor_pd(s, _mm_castsi128_pd(sign));
+
+      _mm_storeu_pd(out + i, _mm_mul_pd(s, vamp));
+    }
+
+    for (; i < n; ++i) {
+      out[i] = amplitude * detail::reduced_sin(pos + i * speed);
+    }
+  }
+
+  //! \brief Four lanes of double at a time using FMA for the polynomial.
+  __attribute__((target("avx2,fma")))
+  inline void avx2(double *out, std::size_t n, double pos, double speed, double amplitude) {
+    const __m256d vpos = _mm256_set1_pd(pos);
+    const __m256d vspeed = _mm256_set1_pd(speed);
+    const __m256d vamp = _mm256_set1_pd(amplitude);
+    const __m256d inv_pi = _mm256_set1_pd(M_1_PI);
+    const __m256d four = _mm256_set1_pd(4.0);
+    __m256d index = _mm256_set_pd(3.0, 2.0, 1.0, 0.0);
+
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+      const __m256d x = _mm256_fmadd_pd(index, vspeed, vpos);
+      index = _mm256_add_pd(index, four);
+
+      const __m128i q = _mm256_cvtpd_epi32(_mm256_mul_pd(x, inv_pi));
+      const __m256d qd = _mm256_cvtepi32_pd(q);
+      __m256d r = _mm256_fnmadd_pd(qd, _mm256_set1_pd(detail::pi_1), x);
+      r = _mm256_fnmadd_pd(qd, _mm256_set1_pd(detail::pi_2), r);
+      r = _mm256_fnmadd_pd(qd, _mm256_set1_pd(detail::pi_3), r);
+
+      const __m256d r2 = _mm256_mul_pd(r, r);
+      __m256d p = _mm256_set1_pd(detail::s15);
+      p = _mm256_fmadd_pd(p, r2, _mm256_set1_pd(detail::s13));
+      p = _mm256_fmadd_pd(p, r2, _mm256_set1_pd(detail::s11));
+      p = _mm256_fmadd_pd(p, r2, _mm256_set1_pd(detail::s9));
+      p = _mm256_fmadd_pd(p, r2, _mm256_set1_pd(detail::s7));
+      p = _mm256_fmadd_pd(p, r2, _mm256_set1_pd(detail::s5));
+      p = _mm256_fmadd_pd(p, r2, _mm256_set1_pd(detail::s3));
+      __m256d s = _mm256_fmadd_pd(_mm256_mul_pd(r, r2), p, r);
+
+      const __m256i sign = _mm256_slli_epi64(_mm256_cvtepi32_epi64(q), 63);
+      s = _mm256_xor_pd(s, _mm256_castsi256_pd(sign));
+
+      _mm256_storeu_pd(out + i, _mm256_mul_pd(s, vamp));
+    }
+
+    for (; i < n; ++i) {
+      out[i] = amplitude * detail::reduced_sin(pos + i * speed);
+    }
+  }
+#endif
+
+  //! \brief Pick the best kernel this CPU can run.
+  inline kernel_type select() {
+#ifdef TUNE_SINE_KERNELS_X86
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+      return &avx2;
+    }
+    return &sse2;
+#else
+    return &scalar;
+#endif
+  }
+
+  //! \brief Name of the kernel select() chooses, for verbose output.
+  inline const char *selected_name() {
+#ifdef TUNE_SINE_KERNELS_X86
+    kernel_type k = select();
+    if (k == &avx2) return "avx2";
+    return "sse2";
+#else
+    return "scalar";
+#endif
+  }
+
+  //! \brief A kernel and what it's called.
+  struct named_kernel {
+    const char *name;
+    kernel_type kernel;
+  };
+
+  //! \brief Every kernel this CPU can run, worst first.  For --profile.
+  inline std::vector<named_kernel> available() {
+    std::vector<named_kernel> v;
+    const named_kernel s = {"scalar", &scalar};
+    v.push_back(s);
+#ifdef TUNE_SINE_KERNELS_X86
+    const named_kernel s2 = {"sse2", &sse2};
+    v.push_back(s2);
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+      const named_kernel a = {"avx2", &avx2};
+      v.push_back(a);
+    }
+#endif
+    return v;
+  }
+
+  //! \brief out[i] = amplitude * sin(pos + i * speed) with the best kernel available.
+  inline void fill(double *out, std::size_t n, double pos, double speed, double amplitude) {
+    static const kernel_type kernel = select();
+    kernel(out, n, pos, speed, amplitude);
+  }
+}
+
+#endif
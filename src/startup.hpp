@@ -0,0 +1,180 @@
+/*!
+\file
+\brief Getting from the command line to the first sample without underflows.
+
+The device used to be unpaused before anything was calculated, so the first
+callbacks found an empty queue.  Now the producer fills the queue first and
+a prefill_gate unpauses the device when there's enough in it.
+
+Opening the sound card can take longer than calculating the first periods,
+so the device_opener can do it on another thread meanwhile.  It asks SDL for
+exactly the requested spec in that case (SDL converts it for the card if it
+has to) so the producer doesn't have to wait to find out what it got.
+
+The startup_timer measures the time to the first sample: from when it was
+constructed to the first callback which had a real period to play.
+*/
+#ifndef STARTUP_HPP_q4vj8ndc
+#define STARTUP_HPP_q4vj8ndc
+
+#include "sdl.hpp"
+#include "sync_data.hpp"
+#include "trace.hpp"
+
+#include <para/atomic.hpp>
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include <string>
+#include <cassert>
+
+#include <stdint.h>
+
+//! \brief Milestones from the start of the program to the first sample played.
+class startup_timer : boost::noncopyable {
+  public:
+    //! \brief Time starts now.
+    startup_timer() : start_(boost::get_system_time()), unpaused_us_(-1), first_sample_us_(-1) {}
+
+    //! \brief The device was unpaused.
+    void unpaused() { unpaused_us_.store(elapsed_us(), para::memory_order_relaxed); }
+
+    //! \brief The callback got a real period.  Audio thread only; just a load
+    //! after the first time.
+    void sample_played() {
+      if (first_sample_us_.load(para::memory_order_relaxed) < 0) {
+        first_sample_us_.store(elapsed_us(), para::memory_order_relaxed);
+      }
+    }
+
+    //! \name Milliseconds from the start, or negative if it hasn't happened.
+    //@{
+    double unpaused_ms() const { return unpaused_us_.load(para::memory_order_relaxed) / 1000.0; }
+    double first_sample_ms() const { return first_sample_us_.load(para::memory_order_relaxed) / 1000.0; }
+    //@}
+
+  private:
+    int64_t elapsed_us() const { return (boost::get_system_time() - start_).total_microseconds(); }
+
+    const boost::system_time start_;
+    para::atomic<int64_t> unpaused_us_;
+    para::atomic<int64_t> first_sample_us_;
+};
+
+//! \brief SDL initialisation and the device, opened now or on another thread.
+class device_opener : boost::noncopyable {
+  public:
+    /*!
+    \brief Open the device for \p desired.
+
+    In the \p background, spec() is exactly \p desired and SDL converts it if
+    the card wants something else.  Otherwise it's opened now and spec() is
+    what the card gave, like sdl::device::obtained().  Throws sdl::error when
+    it's not in the background.
+    */
+    device_opener(const sdl::audio_spec &desired, bool background)
+    : request_(desired), spec_(desired), background_(background) {
+      if (background_) {
+        spec_.calculate();
+        thread_ = boost::thread(boost::bind(&device_opener::open_exact, this));
+      }
+      else {
+        audio_.reset(new sdl::audio);
+        device_.reset(new sdl::device(*audio_, request_));
+        spec_ = device_->obtained();
+      }
+    }
+
+    //! \brief Closes the device.  Waits for the background open to finish first.
+    ~device_opener() {
+      if (thread_.joinable()) thread_.join();
+    }
+
+    //! \brief What the callback will be given.  Available straight away.
+    const sdl::audio_spec &spec() const { return spec_; }
+
+    //! \brief The device, waiting for it to open if it's in the background.
+    //! Throws sdl::error if that failed.
+    sdl::device_base &device() {
+      if (thread_.joinable()) thread_.join();
+      if (! error_.empty()) {
+        throw sdl::open_error(error_.c_str());
+      }
+      if (device_.get()) return *device_;
+      return *light_device_;
+    }
+
+    bool background() const { return background_; }
+
+  private:
+    //! \brief Thread to open with no obtained spec.
+    void open_exact() {
+      try {
+        audio_.reset(new sdl::audio);
+        light_device_.reset(new sdl::light_device(*audio_, request_));
+      }
+      catch (std::exception &e) {
+        error_ = e.what();
+      }
+    }
+
+    sdl::audio_spec request_;
+    sdl::audio_spec spec_;
+    const bool background_;
+    std::string error_;
+
+    // Declared so the device is closed before SDL_Quit().
+    boost::scoped_ptr<sdl::audio> audio_;
+    boost::scoped_ptr<sdl::device> device_;
+    boost::scoped_ptr<sdl::light_device> light_device_;
+
+    boost::thread thread_;
+};
+
+//! \brief Unpauses the device when enough periods are queued.
+class prefill_gate : boost::noncopyable {
+  public:
+    //! \brief \p target must be no more than the queue's depth, otherwise push()
+    //! would wait for ever.
+    prefill_gate(device_opener &dev, const queue_pusher &q, std::size_t target, startup_timer &timer)
+    : dev_(dev), q_(q), target_(target), timer_(timer), open_(false), prefilled_(0) {
+      assert(target <= q.controller().depth());
+    }
+
+    //! \brief Call after each push.  Producer thread only.
+    void pushed() {
+      if (! open_ && q_.size() >= target_) {
+        open();
+      }
+    }
+
+    //! \brief Unpause now, whatever is queued; eg, when the sequence is shorter
+    //! than the target.  Throws sdl::error if the device didn't open.
+    void open() {
+      if (open_) return;
+      prefilled_ = q_.size();
+      trace::event(trace::ev_unpause, prefilled_);
+      dev_.device().unpause();
+      timer_.unpaused();
+      open_ = true;
+    }
+
+    bool opened() const { return open_; }
+
+    //! \brief Periods queued when it was unpaused.
+    std::size_t prefilled() const { return prefilled_; }
+    std::size_t target() const { return target_; }
+
+  private:
+    device_opener &dev_;
+    const queue_pusher &q_;
+    const std::size_t target_;
+    startup_timer &timer_;
+    bool open_;
+    std::size_t prefilled_;
+};
+
+#endif
@@ -5,109 +5,153 @@
 #ifndef SYNC_DATA_HPP_te4d67aw
 #define SYNC_DATA_HPP_te4d67aw
 
-#include <queue>
+#include "period_pool.hpp"
+#include "latency_controller.hpp"
+#include "trace.hpp"
 
-#include <para/locking.hpp>
+#include <para/lfds/spsc_ring.hpp>
+#include <para/atomic.hpp>
 #include <boost/thread.hpp>
 
-namespace {
-  typedef para::sync_traits<
-    std::queue<void*>,
-    boost::mutex,
-    boost::mutex::scoped_lock,
-    boost::condition_variable
-  > traits;
-}
-
-typedef traits::monitor_tuple_type sync_queue_type;
-sync_queue_type queue;
+#include <stdint.h>
+
 // TODO:
-//   do something about this global.  It should be replaced with
+//   do something about these globals.  It should be replaced with
 //   monitored flag at some later date.
-bool quitting = false;
-bool terminated = false;
+//
+// The producer sets quitting once the last period is pushed; the callback
+// answers by setting terminated when it finds the queue empty.  Neither locks
+// in the callback: quit_mutex is only for the producer's wait on quit_cond.
+para::atomic<bool> quitting;
+para::atomic<bool> terminated;
 boost::mutex quit_mutex;
 boost::condition_variable quit_cond;
 
-// TODO:
-//   maybe I could put the whole lot in the a struct and then use boost
-//   bind like bind(struct::*push_predicate, *sync.data()).  If such a
-//   thing is possible, it is an important pattern which should be an
-//   example in the para lib.
-//
-//   I either put the struct in the sync type or put the sync type in the
-//   struct - not sure yet.  I guess it makes sense to put safe stuff in
-//   the struct while the unsafe stuff is hidden inside and only accessed
-//   using the sync_type.
-//
-//   This is an important design thing for para, so we'll leave it until
-//   I have finished the rest of this stuff.
-
-bool push_continue_predicate() {
-  return queue.data().size() < 10 || quitting;
-}
-bool pop_continue_predicate() {
-  return ! queue.data().empty() || quitting;
-}
-
-
-
-//! \brief Thread-safe wrapper for the queue.
-// TODO:
-//   How could I make this kind of pattern easier to use?  Monitored<T> would be
-//   a bit easier, but not much more...  Perhaps add to the synced struct.  I could
-//   even call this sync_data, no?
-template<class TupleType>
+//! \brief Default for the most periods which may be waiting in the queue.
+const std::size_t max_queued_periods = 10;
+
+//! \brief Buffers the period_pool needs so the producer never waits for one:
+//! the queue, the generator's partial period, the one being pushed, and the
+//! one the callback is copying.
+inline std::size_t pool_periods(std::size_t max_queued) { return max_queued + 3; }
+
+//! \brief Hands periods from the producer thread to the SDL callback.
+//!
+//! The periods go through a para::lfds::spsc_ring so pop(), which runs in
+//! the callback, never locks or waits.  push() is the only side which
+//! waits: it sleeps on a condition which only the producer locks.  The
+//! callback notifies it only when a flag says it's asleep, since notifying
+//! can take a lock inside Boost; otherwise it costs a fence and a load.
+//!
+//! They are shared_periods, so the callback can drop its share whether or not
+//! anything else reading the same period (the dump file) is done with it.
+//!
+//! How many periods push() lets be queued is decided by a latency_controller.
+//!
+//! Each period is tagged with the epoch it was pushed in.  flush() just
+//! starts a new epoch, and pop() drops periods from earlier ones back into
+//! the pool, so a flush is one store and takes effect at the next callback.
 class queue_pusher {
-  private:
-    typedef typename TupleType::lockable_type  mutex_type;
-    typedef typename mutex_type::scoped_lock   lock_type;
-    typedef typename TupleType::condition_type condition_type;
+  public:
+    //! \brief What pop() found.
+    enum pop_result {
+      //! \brief A period to play.
+      pop_ok,
+      //! \brief Nothing queued: an underflow unless we're quitting.
+      pop_empty,
+      //! \brief Nothing current; flushed periods were dropped.
+      pop_flushed
+    };
+
+    //! \brief The depth adapts between the bounds, deciding every \p window
+    //! periods and growing after more than \p budget underflows in one.  The
+    //! defaults are a fixed depth.
+    explicit queue_pusher(std::size_t max_queued = max_queued_periods,
+                          std::size_t min_queued = 0, std::size_t window = 1,
+                          unsigned int budget = 0)
+    : ring_(max_queued), controller_(min_queued ? min_queued : max_queued, max_queued, window, budget),
+      epoch_(0), space_waiting_(false) {}
+
+    //! \brief Discard everything queued so far.  The callback stops playing it
+    //! from its next period.  Producer thread only.
+    void flush() {
+      trace::event(trace::ev_flush);
+      epoch_.store(epoch_.load(para::memory_order_relaxed) + 1, para::memory_order_release);
+    }
 
-    typedef para::monitor<lock_type, condition_type> monitor_type;
+    //! \brief Blocking operation to push the buffer.  Producer thread only.
+    //! Returns true when the controller has just changed the depth.
+    bool push(shared_period buffer) {
+      tagged_period p;
+      p.buffer = std::move(buffer);
+      p.epoch = epoch_.load(para::memory_order_relaxed);
+
+      if (! try_push(p)) {
+        boost::mutex::scoped_lock lk(space_mutex_);
+        // Pairs with the fence in pop(): either it sees the flag or our
+        // retry sees its pop.
+        space_waiting_.store(true, para::memory_order_seq_cst);
+        while (! try_push(p)) {
+          // Timed, because the callback notifies without the lock and we might
+          // miss it.  The queue is full so there's no hurry.
+          space_cond_.timed_wait(lk, boost::get_system_time() + boost::posix_time::milliseconds(2));
+        }
+        space_waiting_.store(false, para::memory_order_relaxed);
+      }
+      trace::event(trace::ev_push, ring_.size(), controller_.depth());
+      return controller_.pushed();
+    }
 
-  public:
-    queue_pusher(TupleType &sync) : flush_(false), sync_(sync) {}
-
-    void flush_next_push() { flush_ = true; }
-
-    //! \brief Blocking operation to push the buffer.
-    void push(void *buffer) {
-      monitor_type monitor(sync_, push_continue_predicate);
-      // would be nicer if I could get this by monitor::data().
-      typename TupleType::value_type &q = sync_.data();
-      if (flush_) {
-        //TODO:
-        //  actually, it would be less skippy if we iterate the queue and pop
-        //  from the *back*, locking and unlocking each time.
-        while (! q.empty()) q.pop();
-        flush_ = false;
+    //! \brief Move the next current buffer into \p ret if there is one.  Never
+    //! blocks.  Callback thread only.
+    pop_result pop(shared_period &ret) {
+      const uint32_t epoch = epoch_.load(para::memory_order_acquire);
+      pop_result r = pop_empty;
+      tagged_period p;
+      while (ring_.pop(p)) {
+        if (p.epoch == epoch) {
+          ret = std::move(p.buffer);
+          controller_.popped(ring_.size());
+          r = pop_ok;
+          break;
+        }
+        // stale; give up our share.
+        p.buffer.release();
+        r = pop_flushed;
+      }
+      if (r != pop_empty) {
+        para::atomic_thread_fence(para::memory_order_seq_cst);
+        if (space_waiting_.load(para::memory_order_relaxed)) space_cond_.notify_one();
       }
-      q.push(buffer);
-      // trc("push finished: size = " << sync_.data().size());
-      sync_.wait_condition().notify_one();
+      return r;
     }
 
-    void *pop() {
-      monitor_type m(sync_, pop_continue_predicate);
+    //! \brief The callback had nothing to play.  Callback thread only.
+    void underflow() { controller_.underflow(); }
 
-      if (queue.data().empty()) return NULL;
+    //! \brief Periods waiting, including any which are stale.
+    std::size_t size() const { return ring_.size(); }
 
-      void *r = sync_.data().front();
-      sync_.data().pop();
-      // trc("pop finished: size = " << sync_.data().size());
-      sync_.wait_condition().notify_one();
-      return r;
-    }
+    const latency_controller &controller() const { return controller_; }
 
   private:
-    bool flush_;
-    // we could easily enouhg carry this by value, and also
-    // have the *_continue_predicates as members and use boost
-    // bind to sort it out.
-    TupleType &sync_;
+    struct tagged_period {
+      shared_period buffer;
+      uint32_t epoch;
+    };
+
+    bool try_push(tagged_period &p) { return ring_.size() < controller_.depth() && ring_.push(p); }
+
+    para::lfds::spsc_ring<tagged_period> ring_;
+    latency_controller controller_;
 
+    // Written by the producer, read by the callback.
+    para::atomic<uint32_t> epoch_;
 
+    boost::mutex space_mutex_;
+    boost::condition_variable space_cond_;
+    // Set by push() while it sleeps, so pop() only notifies when it must.
+    para::atomic<bool> space_waiting_;
 };
 
 #endif
@@ -0,0 +1,406 @@
+/*!
+\file
+\brief A flight recorder of what each thread did, for --trace.
+
+Tracing has to be cheap enough to leave on while chasing an underflow, so
+nothing is formatted while it runs.  Each event is a fixed size record: a
+timestamp, an event_id and two numbers.  Each thread writes to its own ring
+with no locks; when the ring is full the oldest records are overwritten, so
+the end of the trace is always the last few seconds before the dump.
+
+All the rings are allocated by start(), before any thread records anything.
+A thread takes a ring the first time it records an event, which is only an
+atomic add.  Threads after the first max_threads aren't traced.
+
+At the end, dump() writes the records from every ring to a file in time
+order.  The tune-trace tool reads the file and prints it as text or as JSON
+for chrome://tracing (see read(), print_text() and print_chrome()).
+
+Threads should have finished by the time dump() runs.  If one hasn't, the
+record it's writing might come out garbled.
+*/
+#ifndef TRACE_HPP_h3ua6xqm
+#define TRACE_HPP_h3ua6xqm
+
+#include "run_stats.hpp"
+
+#include <para/atomic.hpp>
+
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <ostream>
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+
+#include <stdint.h>
+
+namespace trace {
+  /*!
+  \brief What happened.
+
+  The numbers are written to trace files, so only add to the end.  Each has
+  a line in format().
+  */
+  enum event_id {
+    ev_none,
+    ev_sequence,
+    ev_sequence_end,
+    ev_note,
+    ev_note_end,
+    ev_pause,
+    ev_period_begin,
+    ev_period_end,
+    ev_push,
+    ev_unpause,
+    ev_callback_begin,
+    ev_callback_end,
+    ev_underflow,
+    ev_flush,
+    ev_key,
+    ev_stop,
+    ev_quit,
+    ev_chunk_begin,
+    ev_chunk_end,
+    ev_key_error,
+    ev_note_range,
+    ev_note_step,
+    ev_count
+  };
+
+  //! \brief What ev_callback_end's result is.
+  enum callback_result {
+    cb_played,
+    cb_underflow,
+    cb_flushed,
+    cb_quitting
+  };
+
+  //! \brief How to show an event.
+  struct event_format {
+    const char *name;
+    //! \brief 'B' starts a span, 'E' ends the thread's latest one and 'i' is
+    //! an instant, as in the chrome trace format.
+    char phase;
+    //! \brief Argument names, or NULL if it's not used.
+    const char *arg[2];
+    //! \brief 'f' for a double (see real()), 'i' for signed and 'u' for unsigned.
+    char kind[2];
+  };
+
+  //! \brief The format of \p id, or NULL if it's not an event.
+  inline const event_format *format(uint16_t id) {
+    static const event_format formats[ev_count] = {
+      {"none",          'i', {NULL, NULL},                    {0, 0}},
+      {"sequence",      'i', {NULL, NULL},                    {0, 0}},
+      {"sequence_end",  'i', {NULL, NULL},                    {0, 0}},
+      {"note",          'i', {"frequency", "ms"},             {'f', 'i'}},
+      {"note_end",      'i', {NULL, NULL},                    {0, 0}},
+      {"pause",         'i', {"ms", NULL},                    {'i', 0}},
+      {"period",        'B', {NULL, NULL},                    {0, 0}},
+      {"period_end",    'E', {NULL, NULL},                    {0, 0}},
+      {"push",          'i', {"queued", "depth"},             {'u', 'u'}},
+      {"unpause",       'i', {"queued", NULL},                {'u', 0}},
+      {"callback",      'B', {NULL, NULL},                    {0, 0}},
+      {"callback_end",  'E', {"result", "queued"},            {'u', 'u'}},
+      {"underflow",     'i', {"queued", NULL},                {'u', 0}},
+      {"flush",         'i', {NULL, NULL},                    {0, 0}},
+      {"key",           'i', {NULL, NULL},                    {0, 0}},
+      {"stop",          'i', {NULL, NULL},                    {0, 0}},
+      {"quit",          'i', {NULL, NULL},                    {0, 0}},
+      {"chunk",         'B', {"output_frame", "frames"},      {'u', 'u'}},
+      {"chunk_end",     'E', {NULL, NULL},                    {0, 0}},
+      {"key_error",     'i', {"errno", NULL},                 {'i', 0}},
+      {"note_range",    'i', {"start", "stop"},               {'i', 'i'}},
+      {"note_step",     'i', {"step", NULL},                  {'i', 0}},
+    };
+    return id < ev_count ? &formats[id] : NULL;
+  }
+
+  //! \brief One event.  32 bytes so they pack into cache lines.
+  struct record {
+    uint64_t time_ns;
+    uint64_t arg[2];
+    uint16_t id;
+    uint16_t thread;
+    uint32_t reserved;
+
+    friend bool operator<(const record &l, const record &r) { return l.time_ns < r.time_ns; }
+  };
+
+  //! \brief A double as an event argument.
+  inline uint64_t real(double d) {
+    uint64_t u;
+    std::memcpy(&u, &d, sizeof(u));
+    return u;
+  }
+
+  //! \brief One thread's records.  Only that thread may push().
+  class ring : boost::noncopyable {
+    public:
+      //! \brief \p size must be a power of two.
+      explicit ring(std::size_t size) : records_(new record[size]), mask_(size - 1), head_(0) {
+        // Touch it now so the first events don't fault.
+        std::memset(records_.get(), 0, size * sizeof(record));
+      }
+
+      void push(const record &r) {
+        const uint64_t h = head_.load(para::memory_order_relaxed);
+        records_[h & mask_] = r;
+        head_.store(h + 1, para::memory_order_release);
+      }
+
+      //! \brief Append what's in the ring, oldest first.  Returns how many were
+      //! overwritten.
+      uint64_t copy(std::vector<record> &out) const {
+        const uint64_t h = head_.load(para::memory_order_acquire);
+        const uint64_t size = mask_ + 1;
+        const uint64_t first = h > size ? h - size : 0;
+        for (uint64_t i = first; i < h; ++i) {
+          out.push_back(records_[i & mask_]);
+        }
+        return first;
+      }
+
+    private:
+      boost::scoped_array<record> records_;
+      const uint64_t mask_;
+      para::atomic<uint64_t> head_;
+  };
+
+  //! \brief Every thread's ring.
+  class log : boost::noncopyable {
+    public:
+      static const unsigned int max_threads = 8;
+      //! \brief Records kept for each thread: several seconds of small periods.
+      static const std::size_t default_records = 16384;
+
+      log() : enabled_(false), next_(0), untraced_(0) {}
+
+      //! \brief Allocate the rings and start recording.  Call once, before the
+      //! threads which will be traced are doing anything.
+      void start(std::size_t records_per_thread = default_records) {
+        for (unsigned int i = 0; i < max_threads; ++i) {
+          rings_[i].reset(new ring(records_per_thread));
+        }
+        enabled_.store(true, para::memory_order_release);
+      }
+
+      //! \brief Acquire, so a thread which sees it on also sees the rings.
+      bool enabled() const { return enabled_.load(para::memory_order_acquire); }
+
+      //! \brief A ring for a new thread, or NULL if they're all taken.
+      ring *claim(uint16_t &index) {
+        const unsigned int i = next_.fetch_add(1, para::memory_order_relaxed);
+        if (i >= max_threads) {
+          untraced_.fetch_add(1, para::memory_order_relaxed);
+          return NULL;
+        }
+        index = (uint16_t) i;
+        return rings_[i].get();
+      }
+
+      //! \brief Threads which wanted a ring but didn't get one.
+      unsigned int untraced() const { return untraced_.load(para::memory_order_relaxed); }
+
+      /*!
+      \brief Write every ring to \p file in time order.  Throws
+      std::runtime_error if it can't.
+
+      The file is a header (the magic "TUNETRC1", 0x01020304 as a uint32 to
+      give the byte order, the record size as a uint32, the number of records
+      and the number overwritten as uint64s) then the records.
+      */
+      void dump(const std::string &file) const {
+        std::vector<record> all;
+        uint64_t lost = 0;
+        const unsigned int claimed = next_.load(para::memory_order_relaxed);
+        const unsigned int used = claimed < max_threads ? claimed : max_threads;
+        for (unsigned int i = 0; i < used; ++i) {
+          lost += rings_[i]->copy(all);
+        }
+        std::stable_sort(all.begin(), all.end());
+
+        std::ofstream f(file.c_str(), std::ios::binary);
+        const uint32_t order = byte_order_mark, size = sizeof(record);
+        const uint64_t n = all.size();
+        f.write(magic(), 8);
+        f.write((const char *) &order, sizeof(order));
+        f.write((const char *) &size, sizeof(size));
+        f.write((const char *) &n, sizeof(n));
+        f.write((const char *) &lost, sizeof(lost));
+        if (n) {
+          f.write((const char *) &all[0], n * sizeof(record));
+        }
+        f.close();
+        if (! f) {
+          throw std::runtime_error("writing the --trace file failed");
+        }
+      }
+
+      static const char *magic() { return "TUNETRC1"; }
+      static const uint32_t byte_order_mark = 0x01020304;
+
+    private:
+      para::atomic<bool> enabled_;
+      para::atomic<unsigned int> next_;
+      para::atomic<unsigned int> untraced_;
+      boost::scoped_ptr<ring> rings_[max_threads];
+  };
+
+  //! \brief The process's log.
+  inline log &global() {
+    static log l;
+    return l;
+  }
+
+  //! \brief Record \p id on the calling thread's ring if tracing is on.  This is
+  //! just a load when it isn't.
+  inline void event(event_id id, uint64_t a = 0, uint64_t b = 0) {
+    log &l = global();
+    if (! l.enabled()) return;
+
+    static __thread ring *mine = NULL;
+    static __thread uint16_t index = 0;
+    static __thread bool claimed = false;
+    if (! claimed) {
+      mine = l.claim(index);
+      claimed = true;
+    }
+    if (! mine) return;
+
+    record r;
+    r.time_ns = ::detail::now_ns();
+    r.arg[0] = a;
+    r.arg[1] = b;
+    r.id = (uint16_t) id;
+    r.thread = index;
+    r.reserved = 0;
+    mine->push(r);
+  }
+
+  //! \name Reading a dump
+  //@{
+
+  /*!
+  \brief The records in \p file.  \p overwritten is set to how many were lost
+  when the rings wrapped.  Throws std::runtime_error if it isn't a trace from
+  a machine like this one.
+  */
+  inline std::vector<record> read(const std::string &file, uint64_t &overwritten) {
+    std::ifstream f(file.c_str(), std::ios::binary);
+    if (! f) {
+      throw std::runtime_error("can't open " + file);
+    }
+
+    char m[8];
+    uint32_t order = 0, size = 0;
+    uint64_t n = 0;
+    f.read(m, sizeof(m));
+    f.read((char *) &order, sizeof(order));
+    f.read((char *) &size, sizeof(size));
+    f.read((char *) &n, sizeof(n));
+    f.read((char *) &overwritten, sizeof(overwritten));
+    if (! f || std::memcmp(m, log::magic(), sizeof(m)) != 0) {
+      throw std::runtime_error(file + " is not a tune trace");
+    }
+    if (order != log::byte_order_mark || size != sizeof(record)) {
+      throw std::runtime_error(file + " was written on a different kind of machine");
+    }
+
+    std::vector<record> records(n);
+    if (n) {
+      f.read((char *) &records[0], n * sizeof(record));
+    }
+    if (! f) {
+      throw std::runtime_error(file + " is cut short");
+    }
+    return records;
+  }
+
+  namespace detail {
+    inline void print_arg(std::ostream &o, char kind, uint64_t v) {
+      if (kind == 'f') {
+        double d;
+        std::memcpy(&d, &v, sizeof(d));
+        o << d;
+      }
+      else if (kind == 'i') {
+        o << (int64_t) v;
+      }
+      else {
+        o << v;
+      }
+    }
+  }
+
+  //! \brief One line per record: seconds since the first, the thread, the event
+  //! and its arguments.
+  inline std::ostream &print_text(std::ostream &o, const std::vector<record> &records) {
+    const uint64_t start = records.empty() ? 0 : records.front().time_ns;
+    const std::ios::fmtflags flags = o.flags();
+    const std::streamsize precision = o.precision();
+    for (std::size_t i = 0; i < records.size(); ++i) {
+      const record &r = records[i];
+      const event_format *f = format(r.id);
+      o.setf(std::ios::fixed);
+      o.precision(6);
+      o << (r.time_ns - start) / 1e9;
+      o.flags(flags);
+      o.precision(precision);
+      o << " t" << r.thread << " ";
+      if (! f) {
+        o << "unknown(" << r.id << ")\n";
+        continue;
+      }
+      o << f->name;
+      for (int a = 0; a < 2; ++a) {
+        if (f->arg[a]) {
+          o << " " << f->arg[a] << "=";
+          detail::print_arg(o, f->kind[a], r.arg[a]);
+        }
+      }
+      o << "\n";
+    }
+    return o;
+  }
+
+  //! \brief The chrome://tracing JSON format.  Times are microseconds since the
+  //! first record.
+  inline std::ostream &print_chrome(std::ostream &o, const std::vector<record> &records) {
+    const uint64_t start = records.empty() ? 0 : records.front().time_ns;
+    o << "{\"traceEvents\": [";
+    bool first = true;
+    for (std::size_t i = 0; i < records.size(); ++i) {
+      const record &r = records[i];
+      const event_format *f = format(r.id);
+      if (! f) continue;
+
+      o << (first ? "\n" : ",\n") << "  {\"name\": \"" << f->name << "\", \"ph\": \"" << f->phase
+        << "\", \"ts\": " << (r.time_ns - start) / 1e3 << ", \"pid\": 1, \"tid\": " << r.thread;
+      if (f->phase == 'i') {
+        o << ", \"s\": \"t\"";
+      }
+      o << ", \"args\": {";
+      bool first_arg = true;
+      for (int a = 0; a < 2; ++a) {
+        if (f->arg[a]) {
+          o << (first_arg ? "" : ", ") << "\"" << f->arg[a] << "\": ";
+          detail::print_arg(o, f->kind[a], r.arg[a]);
+          first_arg = false;
+        }
+      }
+      o << "}}";
+      first = false;
+    }
+    return o << "\n]}\n";
+  }
+  //@}
+}
+
+#endif
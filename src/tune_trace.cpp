@@ -0,0 +1,63 @@
+/*!
+\file
+\brief tune-trace: print a file written by tune --trace.
+*/
+
+#include "trace.hpp"
+
+#include <iostream>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+  void usage(std::ostream &o) {
+    o << "Usage: tune-trace [--chrome] TRACE\n"
+         "Print a trace written by tune --trace, one event per line, or with --chrome\n"
+         "as JSON for chrome://tracing." << std::endl;
+  }
+}
+
+int main(int argc, char **argv) {
+  bool chrome = false;
+  std::string file;
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--chrome") == 0) {
+      chrome = true;
+    }
+    else if (std::strcmp(argv[i], "--help") == 0 || std::strcmp(argv[i], "-h") == 0) {
+      usage(std::cout);
+      return EXIT_SUCCESS;
+    }
+    else if (file.empty()) {
+      file = argv[i];
+    }
+    else {
+      usage(std::cerr);
+      return EXIT_FAILURE;
+    }
+  }
+  if (file.empty()) {
+    usage(std::cerr);
+    return EXIT_FAILURE;
+  }
+
+  try {
+    uint64_t overwritten = 0;
+    const std::vector<trace::record> records = trace::read(file, overwritten);
+    if (chrome) {
+      trace::print_chrome(std::cout, records);
+    }
+    else {
+      trace::print_text(std::cout, records);
+    }
+    if (overwritten) {
+      std::cerr << "note: " << overwritten << " older events were overwritten." << std::endl;
+    }
+  }
+  catch (std::exception &e) {
+    std::cerr << "error: " << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,222 @@
+/*!
+\file
+\brief Writing file data on its own thread.
+
+Whoever produces the data fills one of a fixed number of aligned buffers and
+submit()s it; a writer thread pwrite()s it and hands the buffer back.  A slow
+disk then only holds up the writer thread.  When every buffer is in flight
+the producer either waits or gets nothing, depending on what it asks for.
+*/
+#ifndef WRITE_BEHIND_HPP_m1gk5s3u
+#define WRITE_BEHIND_HPP_m1gk5s3u
+
+#include <para/lfds/mpmc_queue.hpp>
+#include <para/lfds/adaptors.hpp>
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <cassert>
+
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+namespace detail {
+  //! \brief pwrite() all of it or throw std::runtime_error.
+  inline void pwrite_all(int fd, const uint8_t *p, std::size_t bytes, uint64_t offset) {
+    while (bytes > 0) {
+      const ssize_t r = ::pwrite(fd, p, bytes, (off_t) offset);
+      if (r == -1) {
+        if (errno == EINTR) continue;
+        throw std::runtime_error("writing the --dump file failed: " + std::string(std::strerror(errno)));
+      }
+      p += r;
+      bytes -= r;
+      offset += r;
+    }
+  }
+}
+
+/*!
+\brief Fixed set of buffers written out by a background thread.
+
+Buffers move between the producers and the writer through two
+para::lfds::mpmc_queue: the jobs to write and the free buffers.  With
+--threads several render workers submit at once, and they only meet on the
+queues' indices; nobody takes a lock unless a queue is full or empty and
+they have to wait.
+*/
+class write_behind : boost::noncopyable {
+  public:
+    //! \brief Buffers, their sizes and offsets must be multiples of this for O_DIRECT.
+    static const std::size_t alignment = 4096;
+
+    /*!
+    \brief Allocate the buffers and start the thread.
+
+    \p buffer_size is rounded up to the alignment.  Writes go to \p fd, or
+    to \p direct_fd (opened with O_DIRECT) when they are aligned and it's
+    not -1.  The file descriptors stay owned by the caller.
+    */
+    write_behind(int fd, int direct_fd, std::size_t buffer_size, std::size_t buffers)
+    : fd_(fd), direct_fd_(direct_fd),
+      buffer_size_((buffer_size + alignment - 1) & ~(alignment - 1)),
+      // One more job for the stop.
+      jobs_(buffers + 1), free_(buffers), outstanding_(0), stalls_(0), failed_(false) {
+      assert(buffers > 0);
+      for (std::size_t i = 0; i < buffers; ++i) {
+        void *p = NULL;
+        if (posix_memalign(&p, alignment, buffer_size_) != 0) {
+          free_memory();
+          throw std::bad_alloc();
+        }
+        memory_.push_back((uint8_t *) p);
+        free_.push((uint8_t *) p);
+      }
+
+      thread_ = boost::thread(boost::bind(&write_behind::run, this));
+    }
+
+    //! \brief Write what's left and stop.  Errors are lost; use drain() first.
+    ~write_behind() {
+      // Everything submitted before it is written first.
+      const job stop = {NULL, 0, 0};
+      jobs_.push(stop);
+      thread_.join();
+      free_memory();
+    }
+
+    //! \brief A buffer of buffer_size() bytes to fill.  When none are free this
+    //! waits if \p wait is true, or returns NULL.  Either way it's a stall.
+    uint8_t *acquire(bool wait) {
+      uint8_t *b = NULL;
+      if (free_.try_pop(b)) {
+        return b;
+      }
+
+      stalls_.fetch_add(1, para::memory_order_relaxed);
+      if (! wait) {
+        return NULL;
+      }
+      free_.pop(b);
+      return b;
+    }
+
+    //! \brief Queue \p bytes of \p buffer to be written at \p offset.  The
+    //! buffer belongs to the writer until it's handed out again by acquire().
+    //! Throws the error from an earlier write, if there was one.
+    void submit(uint8_t *buffer, std::size_t bytes, uint64_t offset) {
+      assert(bytes <= buffer_size_);
+      check_error();
+      outstanding_.fetch_add(1, para::memory_order_relaxed);
+      const job j = {buffer, bytes, offset};
+      // Never waits: there are more job slots than buffers.
+      jobs_.push(j);
+    }
+
+    //! \brief Give back a buffer which won't be submitted.
+    void release(uint8_t *buffer) { free_.push(buffer); }
+
+    //! \brief Wait until everything submitted has been written.  Throws the
+    //! error from any write which failed.
+    void drain() {
+      {
+        boost::mutex::scoped_lock lk(drain_mutex_);
+        while (outstanding_.load(para::memory_order_acquire) > 0) {
+          drained_cond_.wait(lk);
+        }
+      }
+      check_error();
+    }
+
+    std::size_t buffer_size() const { return buffer_size_; }
+    std::size_t buffers() const { return memory_.size(); }
+
+    //! \brief Times acquire() found no free buffer.
+    uint64_t stalls() const { return stalls_.load(para::memory_order_relaxed); }
+
+  private:
+    struct job {
+      // NULL to stop.
+      uint8_t *buffer;
+      std::size_t bytes;
+      uint64_t offset;
+    };
+
+    typedef para::lfds::blocking_adaptor<para::lfds::mpmc_queue<job> > job_queue_type;
+    typedef para::lfds::blocking_adaptor<para::lfds::mpmc_queue<uint8_t *> > free_queue_type;
+
+    void run() {
+      for (;;) {
+        job j;
+        jobs_.pop(j);
+        if (! j.buffer) {
+          return;
+        }
+
+        if (! failed_.load(para::memory_order_acquire)) {
+          try { write(j); }
+          catch (std::exception &e) {
+            boost::mutex::scoped_lock lk(drain_mutex_);
+            error_ = e.what();
+            failed_.store(true, para::memory_order_release);
+          }
+        }
+
+        free_.push(j.buffer);
+        if (outstanding_.fetch_sub(1, para::memory_order_acq_rel) == 1) {
+          // drain() checks under the lock, so it's either not yet checking or
+          // waiting.
+          { boost::mutex::scoped_lock lk(drain_mutex_); }
+          drained_cond_.notify_all();
+        }
+      }
+    }
+
+    void write(const job &j) {
+      const bool aligned = j.bytes % alignment == 0 && j.offset % alignment == 0;
+      detail::pwrite_all((aligned && direct_fd_ != -1) ? direct_fd_ : fd_, j.buffer, j.bytes, j.offset);
+    }
+
+    void check_error() {
+      if (failed_.load(para::memory_order_acquire)) {
+        boost::mutex::scoped_lock lk(drain_mutex_);
+        throw std::runtime_error(error_);
+      }
+    }
+
+    void free_memory() {
+      for (std::size_t i = 0; i < memory_.size(); ++i) {
+        std::free(memory_[i]);
+      }
+    }
+
+    const int fd_;
+    const int direct_fd_;
+    const std::size_t buffer_size_;
+
+    std::vector<uint8_t *> memory_;
+
+    job_queue_type jobs_;
+    free_queue_type free_;
+    para::atomic<std::size_t> outstanding_;
+    para::atomic<uint64_t> stalls_;
+
+    // Guards error_, and lets drain() wait.
+    boost::mutex drain_mutex_;
+    boost::condition_variable drained_cond_;
+    para::atomic<bool> failed_;
+    std::string error_;
+
+    boost::thread thread_;
+};
+
+#endif
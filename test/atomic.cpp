@@ -0,0 +1,119 @@
+/*!
+\file
+\brief Test para::atomic.
+*/
+
+#include <para/atomic.hpp>
+
+#include <boost/thread.hpp>
+
+#include <cstdlib>
+#include <cassert>
+
+#include <stdint.h>
+
+namespace {
+  const unsigned int threads = 4;
+  const unsigned int adds = 100000;
+
+  void add(para::atomic<uint64_t> &counter, para::aligned_atomic<unsigned int> &cas_counter) {
+    for (unsigned int i = 0; i < adds; ++i) {
+      counter.fetch_add(1, para::memory_order_relaxed);
+
+      unsigned int cur = cas_counter.load(para::memory_order_relaxed);
+      while (! cas_counter.compare_exchange_weak(cur, cur + 1, para::memory_order_relaxed)) {}
+    }
+  }
+
+  // Message passing: the data must be there once the flag is seen.
+  int data = 0;
+  para::atomic<bool> ready;
+
+  void publish() {
+    data = 42;
+    ready.store(true, para::memory_order_release);
+  }
+}
+
+int main() {
+  // Single thread semantics.
+  {
+    para::atomic<int> a;
+    assert(a.load() == 0);
+    a.store(5, para::memory_order_relaxed);
+    assert(a == 5);
+    a = 7;
+    assert(a.exchange(9) == 7);
+    assert(a.fetch_add(2) == 9);
+    assert(a.fetch_sub(1) == 11);
+    assert(++a == 11);
+    assert(a-- == 11);
+    assert((a += 5) == 15);
+    assert(a.fetch_or(16) == 15);
+    assert(a.fetch_and(0x14) == 31);
+    assert(a.fetch_xor(0x4) == 0x14);
+    assert(a == 0x10);
+
+    int expected = 3;
+    assert(! a.compare_exchange_strong(expected, 4));
+    assert(expected == 0x10);
+    assert(a.compare_exchange_strong(expected, 4, para::memory_order_acq_rel, para::memory_order_acquire));
+    assert(a == 4);
+    assert(a.is_lock_free());
+  }
+
+  // Pointers step by objects.
+  {
+    int array[4] = {0, 1, 2, 3};
+    para::atomic<int *> p(array);
+    assert(p.fetch_add(2) == array);
+    assert(*p.load() == 2);
+    assert(--p == array + 1);
+  }
+
+  // Bool, and the aligned variant.
+  {
+    para::aligned_atomic<bool> b(true);
+    assert(b.load(para::memory_order_acquire));
+    b = false;
+    assert(! b.exchange(true));
+    assert(sizeof(b) == para::cache_line_size);
+    assert(__alignof__(b) == para::cache_line_size);
+    assert((reinterpret_cast<uintptr_t>(&b) % para::cache_line_size) == 0);
+
+    para::aligned_atomic<uint32_t> pair[2];
+    assert(reinterpret_cast<char *>(&pair[1]) - reinterpret_cast<char *>(&pair[0]) == (std::ptrdiff_t) para::cache_line_size);
+  }
+
+  // Fences compile and don't disturb anything.
+  {
+    para::atomic_thread_fence(para::memory_order_seq_cst);
+    para::atomic_thread_fence(para::memory_order_relaxed);
+    para::atomic_signal_fence(para::memory_order_acq_rel);
+  }
+
+  // No lost updates.
+  {
+    para::atomic<uint64_t> counter;
+    para::aligned_atomic<unsigned int> cas_counter;
+    boost::thread_group group;
+    for (unsigned int i = 0; i < threads; ++i) {
+      group.create_thread(boost::bind(&add, boost::ref(counter), boost::ref(cas_counter)));
+    }
+    group.join_all();
+    assert(counter.load() == (uint64_t) threads * adds);
+    assert(cas_counter.load() == threads * adds);
+  }
+
+  // Release and acquire.
+  {
+    boost::thread t(&publish);
+    while (! ready.load(para::memory_order_acquire)) {
+      boost::this_thread::yield();
+    }
+    assert(data == 42);
+    t.join();
+  }
+
+  return EXIT_SUCCESS;
+}
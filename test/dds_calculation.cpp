@@ -0,0 +1,62 @@
+/*!
+\file
+\brief Test the integer oscillator against the floating point one.
+*/
+
+#include "../src/dds.hpp"
+
+#include <cstdlib>
+#include <cassert>
+#include <cmath>
+#include <limits>
+
+template <class Phase>
+void compare_with_sine(double note_freq, double amplitude) {
+  const double frequency = 44100;
+  dds_calculation<Phase> dds(frequency, amplitude);
+  dds.reset_wave(note_freq);
+
+  const std::size_t n = 4096;
+  int16_t out[n];
+  dds.fill(out, n);
+
+  for (std::size_t i = 0; i < n; ++i) {
+    double expected = amplitude * std::sin(2 * M_PI * note_freq * i / frequency) * 32767;
+    assert(std::fabs(out[i] - expected) <= 4);
+  }
+}
+
+int main() {
+  compare_with_sine<uint32_t>(440, 0.75);
+  compare_with_sine<uint64_t>(440, 0.75);
+  compare_with_sine<uint32_t>(27.5, 1);
+  compare_with_sine<uint32_t>(4186, 0.5);
+
+  // Zero amplitude is silent.
+  {
+    dds_calculation<> dds(44100, 0);
+    dds.reset_wave(440);
+    int16_t out[500];
+    dds.fill(out, 500);
+    for (std::size_t i = 0; i < 500; ++i) {
+      assert(out[i] == 0);
+    }
+  }
+
+  // Phase wraps instead of growing, and reset_wave() puts it back to 0.
+  {
+    dds_calculation<uint32_t> dds(44100, 1);
+    dds.reset_wave(11025);
+    assert(dds.increment() == (uint32_t) 1 << 30);
+    int16_t out[5];
+    dds.fill(out, 5);
+    assert(dds.phase() == (uint32_t) 1 << 30);
+    assert(out[0] == 0 && out[2] == 0 && out[4] == 0);
+    assert(out[1] > 32700 && out[3] < -32700);
+
+    dds.reset_wave(440);
+    assert(dds.phase() == 0);
+  }
+
+  return EXIT_SUCCESS;
+}
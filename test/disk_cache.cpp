@@ -0,0 +1,149 @@
+/*!
+\file
+\brief Test of the cache directory.
+*/
+
+#include "../src/disk_cache.hpp"
+
+#include <string>
+#include <cstdlib>
+#include <cstdio>
+#include <cassert>
+
+#include <dirent.h>
+#include <unistd.h>
+
+namespace {
+  const char *const dirname = "disk_cache.test.tmp";
+
+  note_key make_key(double freq, uint32_t frames = 100) {
+    note_key k;
+    k.frequency = freq;
+    k.amplitude = 0.75;
+    k.frames = frames;
+    k.rate = 44100;
+    k.format = 0x8010;
+    k.channels = 2;
+    k.oscillator = 0;
+    return k;
+  }
+
+  std::vector<uint8_t> note(const note_key &k, uint8_t value) {
+    return std::vector<uint8_t>(k.bytes(), value);
+  }
+
+  //! \brief Empty and remove the test directory.
+  void clean() {
+    if (DIR *d = opendir(dirname)) {
+      while (struct dirent *e = readdir(d)) {
+        std::remove((std::string(dirname) + "/" + e->d_name).c_str());
+      }
+      closedir(d);
+    }
+    rmdir(dirname);
+  }
+
+  std::size_t files() {
+    std::size_t n = 0;
+    DIR *d = opendir(dirname);
+    assert(d);
+    while (struct dirent *e = readdir(d)) {
+      if (e->d_name[0] != '.') ++n;
+    }
+    closedir(d);
+    return n;
+  }
+}
+
+int main() {
+  clean();
+
+  // Stored by one, mapped by another.
+  {
+    disk_cache c(dirname, 1024 * 1024);
+    assert(! c.find(make_key(440)));
+    c.store(make_key(440), note(make_key(440), 7));
+    assert(c.stores() == 1 && files() == 1);
+
+    // Already there.
+    c.store(make_key(440), note(make_key(440), 8));
+    assert(c.stores() == 1);
+
+    // The wrong size isn't stored.
+    c.store(make_key(550), std::vector<uint8_t>(3, 1));
+    assert(c.stores() == 1 && files() == 1);
+  }
+  {
+    disk_cache c(dirname, 1024 * 1024);
+    const uint8_t *p = c.find(make_key(440));
+    assert(p && p[0] == 7 && p[make_key(440).bytes() - 1] == 7);
+    assert(c.hits() == 1);
+    assert(c.find(make_key(440)) == p);
+
+    // Every field is checked.
+    note_key other = make_key(440);
+    other.oscillator = 1;
+    assert(! c.find(other));
+    other = make_key(440, 101);
+    assert(! c.find(other));
+  }
+
+  // A file which isn't what its name says is ignored.
+  {
+    disk_cache c(dirname, 1024 * 1024);
+    DIR *d = opendir(dirname);
+    std::string path;
+    while (struct dirent *e = readdir(d)) {
+      if (e->d_name[0] != '.') path = std::string(dirname) + "/" + e->d_name;
+    }
+    closedir(d);
+    FILE *f = std::fopen(path.c_str(), "r+b");
+    assert(f);
+    std::fputc('X', f);
+    std::fclose(f);
+    assert(! c.find(make_key(440)));
+  }
+
+  // Over the limit: the least recently used go.
+  clean();
+  {
+    const std::size_t size = detail::cache_header_size + make_key(1).bytes();
+    disk_cache c(dirname, 2 * size);
+    c.store(make_key(1), note(make_key(1), 1));
+    c.store(make_key(2), note(make_key(2), 2));
+    assert(files() == 2 && c.evictions() == 0);
+
+    // Make 1 older than 2 whatever the clock's resolution is.
+    const struct timeval old[2] = {{1000, 0}, {1000, 0}};
+    DIR *d = opendir(dirname);
+    while (struct dirent *e = readdir(d)) {
+      if (e->d_name[0] == '.') continue;
+      const std::string path = std::string(dirname) + "/" + e->d_name;
+      FILE *f = std::fopen(path.c_str(), "rb");
+      assert(f);
+      std::fseek(f, detail::cache_header_size, SEEK_SET);
+      const int first = std::fgetc(f);
+      std::fclose(f);
+      if (first == 1) utimes(path.c_str(), old);
+    }
+    closedir(d);
+
+    c.store(make_key(3), note(make_key(3), 3));
+    assert(files() == 2 && c.evictions() == 1);
+    assert(! c.find(make_key(1)));
+    assert(c.find(make_key(2)) && c.find(make_key(3)));
+  }
+
+  // A later run counts what's already there when it opens the directory.
+  {
+    const std::size_t size = detail::cache_header_size + make_key(1).bytes();
+    disk_cache c(dirname, 2 * size);
+    assert(files() == 2 && c.evictions() == 0);
+    c.store(make_key(4), note(make_key(4), 4));
+    assert(files() == 2 && c.evictions() == 1);
+    assert(c.find(make_key(4)));
+  }
+
+  clean();
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,63 @@
+/*!
+\file
+\brief Test of the adaptive queue depth.
+*/
+
+#include "../src/latency_controller.hpp"
+
+#include <cstdlib>
+#include <cassert>
+
+namespace {
+  //! \brief Push a window's worth where the callback always leaves \p slack.
+  bool window(latency_controller &c, std::size_t slack) {
+    bool changed = false;
+    for (int i = 0; i < 4; ++i) {
+      c.popped(slack);
+      changed = c.pushed();
+    }
+    return changed;
+  }
+}
+
+int main() {
+  latency_controller c(2, 16, 4);
+  assert(c.depth() == 16);
+
+  // Nothing is decided until the window is done.
+  c.popped(10);
+  assert(! c.pushed() && ! c.pushed() && ! c.pushed());
+  assert(c.pushed());
+  assert(c.depth() == 15);
+
+  // Plenty of slack: shrinks one period a window down to the minimum.
+  for (int i = 0; i < 20; ++i) window(c, 5);
+  assert(c.depth() == 2);
+  assert(! window(c, 5));
+
+  // Too little slack to risk it: stays put.
+  latency_controller tight(1, 8, 4);
+  window(tight, 1);
+  assert(tight.depth() == 8);
+
+  // An underflow doubles it, but not past the maximum.
+  c.underflow();
+  assert(window(c, 0));
+  assert(c.depth() == 4);
+  c.underflow();
+  window(c, 0);
+  c.underflow();
+  window(c, 0);
+  c.underflow();
+  window(c, 0);
+  assert(c.depth() == 16);
+  assert(c.underflows() == 4);
+
+  // Underflows within the budget hold the depth.
+  latency_controller lenient(2, 16, 4, 1);
+  lenient.underflow();
+  window(lenient, 5);
+  assert(lenient.depth() == 16);
+
+  return EXIT_SUCCESS;
+}
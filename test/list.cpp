@@ -0,0 +1,141 @@
+/*!
+\file
+\brief Stress the lock-free sorted list.
+*/
+
+#include <para/lfds/list.hpp>
+
+#include <boost/thread.hpp>
+
+#include <vector>
+#include <cstdlib>
+#include <cassert>
+
+namespace {
+  const unsigned int writers = 3;
+  const unsigned int keys = 64;
+  const unsigned int rounds = 20000;
+
+  typedef para::lfds::list<unsigned int> list_type;
+
+  //! \brief Insert and erase keys in this writer's own residue class, checking
+  //! each answer against what it knows it put there.
+  void churn(list_type &l, unsigned int id) {
+    std::vector<bool> mine(keys, false);
+    unsigned int x = id * 7919 + 1;
+    for (unsigned int i = 0; i < rounds; ++i) {
+      x = x * 1103515245 + 12345;
+      const unsigned int k = ((x >> 8) % (keys / writers)) * writers + id;
+      if (mine[k]) {
+        assert(l.erase(k));
+        mine[k] = false;
+      }
+      else {
+        assert(l.insert(k));
+        mine[k] = true;
+      }
+      assert(l.contains(k) == mine[k]);
+    }
+    // Leave nothing behind.
+    for (unsigned int k = 0; k < keys; ++k) {
+      if (mine[k]) assert(l.erase(k));
+    }
+  }
+
+  struct check_sorted {
+    check_sorted(bool &ok, int &last) : ok(ok), last(last) {}
+    void operator()(unsigned int v) {
+      if ((int) v <= last) ok = false;
+      last = (int) v;
+    }
+    bool &ok;
+    int &last;
+  };
+
+  //! \brief What the audio thread would do: look, never change.
+  void scan(const list_type &l, const para::atomic<bool> &done, para::atomic<unsigned int> &scans) {
+    while (! done.load(para::memory_order_acquire)) {
+      bool ok = true;
+      int last = -1;
+      l.for_each(check_sorted(ok, last));
+      assert(ok);
+      l.contains(keys / 2);
+      scans.fetch_add(1, para::memory_order_relaxed);
+    }
+  }
+}
+
+int main() {
+  // Set semantics and order.
+  {
+    para::lfds::epoch_domain d;
+    list_type l(d);
+    assert(l.empty());
+    assert(l.insert(5));
+    assert(l.insert(1));
+    assert(l.insert(9));
+    assert(! l.insert(5));
+    assert(l.size() == 3);
+    assert(l.contains(1) && l.contains(5) && l.contains(9));
+    assert(! l.contains(4));
+
+    bool ok = true;
+    int last = -1;
+    l.for_each(check_sorted(ok, last));
+    assert(ok && last == 9);
+
+    assert(l.erase(5));
+    assert(! l.erase(5));
+    assert(! l.contains(5));
+    assert(l.size() == 2);
+  }
+
+  // Concurrent writers on disjoint keys with readers walking the whole list.
+  {
+    para::lfds::epoch_domain d;
+    list_type l(d);
+    para::atomic<bool> done(false);
+    para::atomic<unsigned int> scans(0);
+
+    boost::thread_group readers;
+    for (unsigned int r = 0; r < 2; ++r) {
+      readers.create_thread(boost::bind(&scan, boost::cref(l), boost::cref(done), boost::ref(scans)));
+    }
+
+    boost::thread_group group;
+    for (unsigned int w = 0; w < writers; ++w) {
+      group.create_thread(boost::bind(&churn, boost::ref(l), w));
+    }
+    group.join_all();
+    done.store(true, para::memory_order_release);
+    readers.join_all();
+
+    assert(l.size() == 0);
+    assert(scans.load() > 0);
+    assert(d.epoch() > 0);
+  }
+
+  // Several threads racing on the same key: exactly one insert or erase of
+  // each pair wins.
+  {
+    para::lfds::epoch_domain d;
+    list_type l(d);
+    para::atomic<int> net(0);
+    struct racer {
+      static void run(list_type &l, para::atomic<int> &net) {
+        for (unsigned int i = 0; i < rounds; ++i) {
+          if (l.insert(7)) net.fetch_add(1);
+          if (l.erase(7)) net.fetch_sub(1);
+        }
+      }
+    };
+    boost::thread_group group;
+    for (unsigned int t = 0; t < 4; ++t) {
+      group.create_thread(boost::bind(&racer::run, boost::ref(l), boost::ref(net)));
+    }
+    group.join_all();
+    assert(net.load() == (l.contains(7) ? 1 : 0));
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,155 @@
+/*!
+\file
+\brief Stress the multi-producer, multi-consumer queue and the adaptors.
+*/
+
+#include <para/lfds/mpmc_queue.hpp>
+#include <para/lfds/adaptors.hpp>
+
+#include <boost/thread.hpp>
+
+#include <vector>
+#include <cstdlib>
+#include <cassert>
+
+#include <stdint.h>
+
+namespace {
+  const unsigned int producers = 4;
+  const unsigned int consumers = 4;
+  const uint32_t per_producer = 100000;
+
+  // Producer in the high half, its sequence number in the low half.
+  uint64_t item(uint32_t producer, uint32_t n) { return ((uint64_t) producer << 32) | n; }
+
+  template <class Queue>
+  void produce(Queue &q, uint32_t id) {
+    for (uint32_t n = 0; n < per_producer; ++n) q.push(item(id, n));
+  }
+
+  //! \brief Pop its share, checking each producer's items come in order.
+  template <class Queue>
+  void consume(Queue &q, std::vector<para::atomic<uint32_t> > *counts) {
+    std::vector<int64_t> last(producers, -1);
+    for (uint32_t i = 0; i < producers * per_producer / consumers; ++i) {
+      uint64_t v = 0;
+      q.pop(v);
+      const uint32_t p = (uint32_t) (v >> 32), n = (uint32_t) v;
+      assert(p < producers);
+      assert((int64_t) n > last[p]);
+      last[p] = n;
+      (*counts)[p].fetch_add(1, para::memory_order_relaxed);
+    }
+  }
+
+  template <class Queue>
+  void stress(Queue &q) {
+    std::vector<para::atomic<uint32_t> > counts(producers);
+    boost::thread_group group;
+    for (unsigned int c = 0; c < consumers; ++c) {
+      group.create_thread(boost::bind(&consume<Queue>, boost::ref(q), &counts));
+    }
+    for (unsigned int p = 0; p < producers; ++p) {
+      group.create_thread(boost::bind(&produce<Queue>, boost::ref(q), p));
+    }
+    group.join_all();
+    for (unsigned int p = 0; p < producers; ++p) assert(counts[p].load() == per_producer);
+  }
+
+  //! \brief Spin on the lock-free queue directly.
+  struct spinning {
+    explicit spinning(std::size_t n) : q(n) {}
+    void push(uint64_t v) { while (! q.push(v)) boost::this_thread::yield(); }
+    void pop(uint64_t &v) { while (! q.pop(v)) boost::this_thread::yield(); }
+    para::lfds::mpmc_queue<uint64_t> q;
+  };
+}
+
+int main() {
+  // Capacity, full, empty and order on one thread.
+  {
+    para::lfds::mpmc_queue<int> q(3);
+    assert(q.capacity() == 4);
+    assert(q.empty());
+    int v;
+    assert(! q.pop(v));
+    for (int i = 0; i < 4; ++i) assert(q.push(i));
+    assert(! q.push(4));
+    assert(q.size() == 4);
+    for (int i = 0; i < 4; ++i) assert(q.pop(v) && v == i);
+    assert(! q.pop(v));
+
+    // Round the ring a few times.
+    for (int i = 0; i < 100; ++i) {
+      assert(q.push(i));
+      assert(q.pop(v) && v == i);
+    }
+  }
+
+  // Nothing lost or duplicated, per-producer order kept.
+  {
+    spinning q(64);
+    stress(q);
+  }
+
+  // Blocking, with a queue small enough that both sides wait a lot.
+  {
+    para::lfds::blocking_adaptor<para::lfds::mpmc_queue<uint64_t> > q(2);
+    stress(q);
+  }
+
+  // The same over a locked queue.
+  {
+    para::lfds::blocking_adaptor<para::lfds::locked_queue<uint64_t> > q(2);
+    stress(q);
+  }
+
+  // Non-blocking forms and the timeout.
+  {
+    para::lfds::blocking_adaptor<para::lfds::mpmc_queue<int> > q(2);
+    int v;
+    assert(! q.try_pop(v));
+    assert(q.try_push(1) && q.try_push(2));
+    assert(! q.try_push(3));
+    assert(q.try_pop(v) && v == 1);
+
+    const boost::system_time start = boost::get_system_time();
+    assert(q.timed_pop(v, start + boost::posix_time::milliseconds(10)) && v == 2);
+    assert(! q.timed_pop(v, start + boost::posix_time::milliseconds(10)));
+    assert(boost::get_system_time() >= start + boost::posix_time::milliseconds(10));
+  }
+
+  // Closing: pushes fail even with room, pops drain what's left then fail.
+  {
+    para::lfds::blocking_adaptor<para::lfds::mpmc_queue<int> > q(4);
+    assert(q.push(1));
+    q.close();
+    assert(q.closed());
+    assert(! q.try_push(2));
+    assert(! q.push(2));
+    const int three = 3;
+    assert(! q.push(three));
+    int v = 0;
+    assert(q.pop(v) && v == 1);
+    assert(! q.pop(v));
+  }
+
+  // A closed queue wakes a waiting popper.
+  {
+    para::lfds::blocking_adaptor<para::lfds::locked_queue<int> > q(2);
+    struct popper {
+      static void run(para::lfds::blocking_adaptor<para::lfds::locked_queue<int> > &q, bool &got) {
+        int v;
+        got = q.pop(v);
+      }
+    };
+    bool got = true;
+    boost::thread t(boost::bind(&popper::run, boost::ref(q), boost::ref(got)));
+    boost::this_thread::sleep(boost::posix_time::milliseconds(5));
+    q.close();
+    t.join();
+    assert(! got);
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,109 @@
+/*!
+\file
+\brief Test of the rendered note cache.
+*/
+
+#include "../src/note_cache.hpp"
+
+#include <cstdlib>
+#include <cassert>
+
+namespace {
+  note_cache::key make_key(double freq) {
+    note_cache::key k;
+    k.frequency = freq;
+    k.amplitude = 0.75;
+    k.frames = 100;
+    k.rate = 44100;
+    k.format = 0x8010;
+    k.channels = 2;
+    k.oscillator = 0;
+    return k;
+  }
+
+  std::vector<uint8_t> note(std::size_t bytes, uint8_t value) {
+    return std::vector<uint8_t>(bytes, value);
+  }
+
+  //! \brief Keeps everything.
+  class map_backing : public note_cache_backing {
+    public:
+      const uint8_t *find(const note_key &k) {
+        const std::map<note_key, std::vector<uint8_t> >::iterator i = notes.find(k);
+        return i == notes.end() ? NULL : &i->second[0];
+      }
+
+      void store(const note_key &k, const std::vector<uint8_t> &frames) { notes[k] = frames; }
+
+      std::map<note_key, std::vector<uint8_t> > notes;
+  };
+}
+
+int main() {
+  // Off: nothing kept.
+  {
+    note_cache c(0);
+    std::vector<uint8_t> n = note(10, 1);
+    c.insert(make_key(440), n);
+    assert(! c.find(make_key(440)));
+    assert(c.misses() == 0);
+  }
+
+  note_cache c(30);
+  assert(! c.find(make_key(440)));
+  assert(c.misses() == 1);
+
+  std::vector<uint8_t> a = note(10, 1), b = note(10, 2), d = note(10, 3);
+  c.insert(make_key(440), a);
+  c.insert(make_key(550), b);
+  c.insert(make_key(660), d);
+  assert(c.bytes() == 30 && c.notes() == 3);
+  assert(a.empty());
+
+  const uint8_t *p = c.find(make_key(440));
+  assert(p && p[0] == 1 && p[9] == 1);
+  assert(c.hits() == 1);
+
+  // Every field is in the key.
+  note_cache::key other = make_key(440);
+  other.channels = 1;
+  assert(! c.find(other));
+
+  // 550 is now the least recently used.
+  std::vector<uint8_t> e = note(10, 4);
+  c.insert(make_key(770), e);
+  assert(c.notes() == 3 && c.evictions() == 1);
+  assert(! c.find(make_key(550)));
+  assert(c.find(make_key(440)) && c.find(make_key(660)) && c.find(make_key(770)));
+
+  // Too big for the budget: ignored.
+  std::vector<uint8_t> huge = note(31, 5);
+  c.insert(make_key(880), huge);
+  assert(! c.find(make_key(880)));
+  assert(c.notes() == 3 && c.bytes() == 30);
+
+  // A big one can push out several.
+  std::vector<uint8_t> f = note(25, 6);
+  c.insert(make_key(990), f);
+  assert(c.notes() == 1 && c.bytes() == 25);
+  assert(c.find(make_key(990))[24] == 6);
+
+  // Everything goes to the backing, which is asked when memory misses.
+  {
+    map_backing b;
+    note_cache c(10, &b);
+    assert(c.enabled());
+    std::vector<uint8_t> small = note(10, 1), big = note(20, 2);
+    c.insert(make_key(440), small);
+    c.insert(make_key(550), big);
+    assert(b.notes.size() == 2 && c.notes() == 1);
+
+    const uint8_t *p = c.find(make_key(550));
+    assert(p && p[19] == 2);
+    assert(c.backing_hits() == 1 && c.hits() == 0 && c.misses() == 0);
+    assert(c.find(make_key(440)) && c.hits() == 1);
+    assert(! c.find(make_key(660)) && c.misses() == 1);
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,173 @@
+/*!
+\file
+\brief Test of rendering a sequence to a sink with --offline.
+*/
+
+#include "../src/offline_renderer.hpp"
+
+#include <boost/thread.hpp>
+
+#include <vector>
+#include <cstdlib>
+#include <cassert>
+
+//! \brief Writes the frequency it was given so we can see which note is playing.
+struct frequency_oscillator : public oscillator {
+  frequency_oscillator() : freq(0) {}
+
+  void reset_wave(double f) { freq = (int16_t) f; }
+
+  void fill(int16_t *out, std::size_t frames) {
+    std::fill(out, out + frames, freq);
+  }
+
+  void fill_normalised(double *out, std::size_t frames) {
+    std::fill(out, out + frames, freq / 32768.0);
+  }
+
+  void seek(uint64_t) {}
+
+  oscillator *clone() const { return new frequency_oscillator(*this); }
+
+  int16_t freq;
+};
+
+//! \brief Keeps everything written.
+struct vector_sink {
+  void write(const void *data, std::size_t bytes) {
+    const int16_t *s = (const int16_t *) data;
+    assert(bytes % sizeof(int16_t) == 0);
+    samples.insert(samples.end(), s, s + bytes / sizeof(int16_t));
+    ++writes;
+  }
+
+  void write_at(const void *data, std::size_t bytes, uint64_t offset) {
+    boost::mutex::scoped_lock lk(mutex);
+    const int16_t *s = (const int16_t *) data;
+    const std::size_t start = offset / sizeof(int16_t);
+    const std::size_t n = bytes / sizeof(int16_t);
+    if (samples.size() < start + n) samples.resize(start + n);
+    std::copy(s, s + n, samples.begin() + start);
+    ++writes;
+  }
+
+  boost::mutex mutex;
+
+  vector_sink() : writes(0) {}
+
+  std::vector<int16_t> samples;
+  unsigned int writes;
+};
+
+int main() {
+  using namespace sample_formats;
+
+  const uint32_t rate = 1000;
+
+  // Two notes of 5 frames with 3 frames of pause, at 1000hz, 2 frames at a time.
+  const char *argv[] = {
+    "prog", "-s", "a", "-d", "12", "-n", "2", "-t", "5", "--pause", "3"
+  };
+  settings set(sizeof(argv) / sizeof(argv[0]), (char **) argv);
+  note_sequence seq(set);
+
+  frequency_oscillator osc;
+  period_pool pool(4 * sizeof(int16_t), 1);
+  basic_sample_generator<s16<host_big_endian>, 1> gen(osc, pool, rate, 1, 4);
+  offline_renderer renderer(seq, osc, gen, set, 2);
+
+  vector_sink sink;
+  para::atomic<bool> interrupted(false);
+  assert(renderer.render(sink, interrupted));
+
+  // Exactly the frames of the notes and pauses; no padding to a period.
+  const int16_t expected[] = {
+    440, 440, 440, 440, 440, 0, 0, 0, 880, 880, 880, 880, 880, 0, 0, 0
+  };
+  const std::size_t n = sizeof(expected) / sizeof(expected[0]);
+  assert(sink.samples.size() == n);
+  assert(renderer.frames() == n);
+  for (std::size_t i = 0; i < n; ++i) assert(sink.samples[i] == expected[i]);
+  assert(sink.writes == 3 + 2 + 3 + 2);
+
+  // Stops straight away when interrupted.
+  {
+    vector_sink sink;
+    interrupted = true;
+    offline_renderer renderer(seq, osc, gen, set, 2);
+    assert(! renderer.render(sink, interrupted));
+    assert(sink.samples.empty());
+  }
+
+  // Threads and odd chunk sizes give exactly the same output.
+  {
+    const char *argv[] = {
+      "prog", "-s", "a", "-n", "3", "-t", "250", "--pause", "10"
+    };
+    settings set(sizeof(argv) / sizeof(argv[0]), (char **) argv);
+    note_sequence seq(set);
+    const uint32_t rate = 44100;
+    period_pool pool(64 * 2 * sizeof(int16_t), 5);
+    para::atomic<bool> interrupted(false);
+
+    vector_sink serial;
+    {
+      sine_calculation sine(rate);
+      basic_sample_generator<s16<host_big_endian>, 2> gen(sine, pool, rate, 2, 64);
+      offline_renderer renderer(seq, sine, gen, set);
+      assert(renderer.render(serial, interrupted));
+    }
+
+    vector_sink parallel;
+    {
+      sine_calculation sine(rate);
+      basic_sample_generator<s16<host_big_endian>, 2> gen(sine, pool, rate, 2, 64);
+      offline_renderer renderer(seq, sine, gen, set, 1001, 3);
+      assert(renderer.render(parallel, interrupted));
+      assert(renderer.frames() * 2 == serial.samples.size());
+    }
+
+    assert(parallel.samples == serial.samples);
+  }
+
+  // Cached notes are the same as calculated ones, with or without threads.
+  {
+    const char *argv[] = {
+      "prog", "-s", "a", "-n", "2", "-t", "100", "--pause", "10"
+    };
+    settings set(sizeof(argv) / sizeof(argv[0]), (char **) argv);
+    note_sequence seq(set);
+    const uint32_t rate = 44100;
+    period_pool pool(64 * 2 * sizeof(int16_t), 6);
+    sine_calculation sine(rate);
+    basic_sample_generator<s16<host_big_endian>, 2> gen(sine, pool, rate, 2, 64);
+    para::atomic<bool> interrupted(false);
+
+    note_key format;
+    format.amplitude = 1;
+    format.rate = rate;
+    format.format = 0x9010;
+    format.channels = 2;
+    format.oscillator = 0;
+
+    vector_sink plain;
+    {
+      offline_renderer renderer(seq, sine, gen, set, 1001);
+      assert(renderer.render(plain, interrupted));
+    }
+
+    for (unsigned int threads = 1; threads <= 3; threads += 2) {
+      note_cache cache(1024 * 1024);
+      vector_sink first, second;
+      offline_renderer renderer(seq, sine, gen, set, 1001, threads);
+      renderer.cache(cache, format);
+      assert(renderer.render(first, interrupted));
+      assert(cache.notes() == 2 && cache.hits() == 0);
+      assert(renderer.render(second, interrupted));
+      assert(cache.hits() == 2);
+      assert(first.samples == plain.samples && second.samples == plain.samples);
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,130 @@
+/*!
+\file
+\brief Test the period buffer pool and its handles.
+*/
+
+#include "../src/period_pool.hpp"
+
+#include <boost/thread.hpp>
+
+#include <cstdlib>
+#include <cassert>
+#include <vector>
+#include <utility>
+
+namespace {
+  const std::size_t cycles = 10000;
+
+  //! \brief Hammer acquire() on one thread while another releases.
+  void producer(period_pool &pool, std::vector<period_buffer> &handoff, boost::mutex &m) {
+    for (std::size_t i = 0; i < cycles; ++i) {
+      period_buffer b = pool.acquire();
+      *(std::size_t *) b.get() = i;
+      boost::mutex::scoped_lock lk(m);
+      handoff.push_back(std::move(b));
+    }
+  }
+
+  //! \brief Read a shared period for a bit, then let it go.
+  void hold(shared_period s) {
+    assert(*(const std::size_t *) s.get() == 0);
+    boost::this_thread::yield();
+  }
+}
+
+int main() {
+  // Buffers are distinct, aligned and come back when the handle goes.
+  {
+    period_pool pool(100, 3);
+    period_buffer a = pool.try_acquire();
+    period_buffer b = pool.try_acquire();
+    period_buffer c = pool.try_acquire();
+    assert(a && b && c);
+    assert(a.get() != b.get() && b.get() != c.get() && a.get() != c.get());
+    assert(((uintptr_t) a.get() % period_pool::alignment) == 0);
+    assert(((uintptr_t) b.get() % period_pool::alignment) == 0);
+    assert(! pool.try_acquire());
+
+    void *p = b.get();
+    b.release();
+    assert(! b);
+    period_buffer d = pool.try_acquire();
+    assert(d.get() == p);
+
+    // moving transfers ownership without releasing.
+    period_buffer e(std::move(d));
+    assert(! d && e.get() == p);
+    assert(! pool.try_acquire());
+
+    { period_buffer dropped(std::move(e)); }
+    assert(pool.try_acquire());
+  }
+
+  // Concurrent acquire and release never hands out a buffer twice.
+  {
+    period_pool pool(sizeof(std::size_t), 4);
+    std::vector<period_buffer> handoff;
+    boost::mutex m;
+    boost::thread th(producer, boost::ref(pool), boost::ref(handoff), boost::ref(m));
+
+    std::size_t expected = 0;
+    while (expected < cycles) {
+      period_buffer b;
+      {
+        boost::mutex::scoped_lock lk(m);
+        if (! handoff.empty()) {
+          b = std::move(handoff.front());
+          handoff.erase(handoff.begin());
+        }
+      }
+      if (b) {
+        assert(*(std::size_t *) b.get() == expected);
+        ++expected;
+      }
+      else {
+        boost::this_thread::yield();
+      }
+    }
+    th.join();
+  }
+
+  // A shared period goes back when the last copy does, and not before.
+  {
+    period_pool pool(16, 1);
+    period_buffer b = pool.try_acquire();
+    const void *p = b.get();
+    shared_period s(std::move(b));
+    assert(! b && s.get() == p);
+    assert(s.use_count() == 1);
+
+    shared_period t(s), u;
+    u = t;
+    assert(s.use_count() == 3 && u.get() == p);
+    s.release();
+    t = shared_period();
+    assert(u.use_count() == 1);
+    assert(! pool.try_acquire());
+
+    shared_period v(std::move(u));
+    assert(! u && v.use_count() == 1);
+    v.release();
+    assert(pool.try_acquire());
+  }
+
+  // Readers on several threads letting go in any order free it exactly once.
+  {
+    period_pool pool(16, 1);
+    for (unsigned int i = 0; i < 200; ++i) {
+      shared_period s(pool.try_acquire());
+      assert(s);
+      boost::thread_group readers;
+      for (unsigned int r = 0; r < 3; ++r) readers.create_thread(boost::bind(&hold, s));
+      s.release();
+      readers.join_all();
+      period_buffer again = pool.try_acquire();
+      assert(again);
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,294 @@
+/*!
+\file
+\brief Pipelines: order, backpressure, flush, pause, fan-out and errors.
+*/
+
+#include <para/pipe.hpp>
+
+#include <boost/thread.hpp>
+
+#include <memory>
+#include <stdexcept>
+#include <vector>
+#include <cstdlib>
+#include <cassert>
+
+namespace {
+  const int count = 20000;
+
+  //! \brief 0, 1, 2, ...
+  struct counter {
+    explicit counter(int n) : n(n) {}
+    template <class Outlet>
+    void operator()(Outlet &out) {
+      for (int i = 0; i < n; ++i) {
+        if (! out.push(i)) return;
+      }
+    }
+    int n;
+  };
+
+  //! \brief Doubles, as a move-only type so nothing is copied.
+  struct doubler {
+    template <class Outlet>
+    void operator()(int &v, Outlet &out) { out.push(std::unique_ptr<int>(new int(v * 2))); }
+  };
+
+  struct collect {
+    explicit collect(std::vector<int> *into) : into(into) {}
+    void operator()(std::unique_ptr<int> &v) { into->push_back(*v); }
+    std::vector<int> *into;
+  };
+
+  struct collect_ints {
+    explicit collect_ints(std::vector<int> *into) : into(into) {}
+    void operator()(int &v) { into->push_back(v); }
+    std::vector<int> *into;
+  };
+
+  struct slow_collect {
+    explicit slow_collect(std::vector<int> *into) : into(into) {}
+    void operator()(int &v) {
+      boost::this_thread::sleep(boost::posix_time::microseconds(50));
+      into->push_back(v);
+    }
+    std::vector<int> *into;
+  };
+
+  template <class Channel>
+  void in_order() {
+    para::pipe<int, Channel> a(4);
+    para::pipe<std::unique_ptr<int>, Channel> b(4);
+    std::vector<int> got;
+
+    para::pipeline line;
+    line.source("count", counter(count), a);
+    line.filter("double", doubler(), a, b);
+    line.sink("collect", collect(&got), b);
+    line.start();
+    line.wait();
+
+    assert(got.size() == (std::size_t) count);
+    for (int i = 0; i < count; ++i) assert(got[i] == i * 2);
+    assert(a.closed() && b.closed());
+
+    const std::vector<para::pipe_stage_stats> st = line.stats();
+    assert(st.size() == 3);
+    assert(st[0].name == "count" && st[0].in == 0 && st[0].out == (uint64_t) count);
+    assert(st[1].in == (uint64_t) count && st[1].out == (uint64_t) count);
+    assert(st[2].in == (uint64_t) count && st[2].out == 0);
+    assert(st[2].flushed == 0);
+  }
+
+  //! \brief Pushes until the pipeline is flushed, then a few more after it.
+  struct flusher {
+    flusher(para::pipeline *line, para::atomic<int> *sent_after) : line(line), sent_after(sent_after) {}
+    void operator()(para::outlet<int> &out) {
+      for (int i = 0; i < 100; ++i) out.push(i);
+      line->flush();
+      for (int i = 1000; i < 1010; ++i) {
+        out.push(i);
+        sent_after->fetch_add(1);
+      }
+    }
+    para::pipeline *line;
+    para::atomic<int> *sent_after;
+  };
+
+  struct count_flushes {
+    explicit count_flushes(para::atomic<int> *n) : n(n) {}
+    void operator()() { n->fetch_add(1); }
+    para::atomic<int> *n;
+  };
+
+  //! \brief Counts copies, which a branch should never make.
+  struct payload {
+    static para::atomic<int> copies;
+    explicit payload(int v) : value(v) {}
+    payload(const payload &o) : value(o.value) { copies.fetch_add(1); }
+    int value;
+  };
+
+  para::atomic<int> payload::copies;
+
+  typedef std::shared_ptr<const payload> shared_payload;
+
+  struct make_payloads {
+    explicit make_payloads(int n) : n(n) {}
+    void operator()(para::outlet<shared_payload> &out) {
+      for (int i = 0; i < n; ++i) out.push(shared_payload(new payload(i)));
+    }
+    int n;
+  };
+
+  //! \brief Keeps what it's given, optionally slowly.
+  struct keep {
+    keep(std::vector<shared_payload> *into, int delay_us) : into(into), delay_us(delay_us) {}
+    void operator()(shared_payload &p) {
+      if (delay_us) boost::this_thread::sleep(boost::posix_time::microseconds(delay_us));
+      into->push_back(p);
+    }
+    std::vector<shared_payload> *into;
+    int delay_us;
+  };
+
+  struct thrower {
+    void operator()(int &v) { if (v == 10) throw std::logic_error("ten"); }
+  };
+}
+
+int main() {
+  in_order<para::spsc_channel>();
+  in_order<para::mpmc_channel>();
+  in_order<para::locked_channel<> >();
+
+  // A slow sink holds back the source through a small pipe.
+  {
+    para::pipe<int> a(2);
+    std::vector<int> got;
+    para::pipeline line;
+    line.source("count", counter(200), a);
+    line.sink("slow", slow_collect(&got), a);
+    line.run();
+    assert(got.size() == 200);
+    assert(line.stats()[0].stalled > 0);
+  }
+
+  // Flushed values are dropped, later ones arrive, and the handler runs once
+  // on the sink's thread.
+  {
+    para::pipe<int> a(256);
+    std::vector<int> got;
+    para::atomic<int> sent_after(0), flushes(0);
+    para::pipeline line;
+    line.source("flush", flusher(&line, &sent_after), a);
+    line.sink("slow", slow_collect(&got), a).on_flush(count_flushes(&flushes));
+    line.run();
+
+    assert(flushes.load() == 1);
+    assert(got.size() >= 10);
+    for (std::size_t i = got.size() - 10; i < got.size(); ++i) assert(got[i] >= 1000);
+    const para::pipe_stage_stats st = line.stats()[1];
+    assert(st.in + st.flushed == 110);
+    assert(st.in == got.size());
+  }
+
+  // A stage which keeps flushed values sees everything, even through a
+  // branch, and its handler still runs; the other branch drops them.
+  {
+    para::pipe<int> in(256), play(256), dump(256), direct(256);
+    std::vector<int> got_play, got_dump, got_direct;
+    para::atomic<int> sent_after(0), flushes(0);
+    para::pipeline line;
+    line.source("flush", flusher(&line, &sent_after), in);
+    line.branch("fan-out", in).to(play).to(dump, para::branch_block, true).to(direct);
+    line.sink("play", slow_collect(&got_play), play);
+    line.sink("dump", slow_collect(&got_dump), dump).keep_flushed().on_flush(count_flushes(&flushes));
+    // Values which got past the branch before the flush.
+    line.sink("direct", slow_collect(&got_direct), direct).keep_flushed();
+    line.run();
+
+    assert(flushes.load() == 1);
+    assert(got_dump.size() == 110);
+    for (int i = 0; i < 100; ++i) assert(got_dump[i] == i);
+    for (int i = 0; i < 10; ++i) assert(got_dump[100 + i] == 1000 + i);
+    const std::vector<para::pipe_stage_stats> st = line.stats();
+    assert(st[1].in == 110 && st[1].flushed == 0);
+    assert(st[3].in == 110 && st[3].flushed == 0);
+    assert(st[2].in == got_play.size());
+    assert(got_play.size() >= 10 && got_play.back() == 1009);
+    assert(got_direct.size() == st[2].in + st[2].flushed);
+  }
+
+  // Nothing is processed while paused.
+  {
+    para::pipe<int> a(2);
+    std::vector<int> got;
+    para::pipeline line;
+    line.source("count", counter(100000), a);
+    line.sink("collect", slow_collect(&got), a);
+    line.start();
+    boost::this_thread::sleep(boost::posix_time::milliseconds(5));
+    line.pause();
+    const uint64_t in = line.stats()[1].in;
+    boost::this_thread::sleep(boost::posix_time::milliseconds(20));
+    assert(line.stats()[1].in == in);
+    line.resume();
+    line.stop();
+    line.wait();
+    assert(got.size() < 100000);
+  }
+
+  // Fan-out: every blocking branch sees every value, all sharing the one
+  // object; a slow dropping branch misses some without holding up the rest.
+  {
+    const int n = 2000;
+    para::pipe<shared_payload> in(4), a(4), b(4), slow(2);
+    std::vector<shared_payload> got_a, got_b, got_slow;
+    para::pipeline line;
+    line.source("make", make_payloads(n), in);
+    para::branch_stage<shared_payload> &fan = line.branch("fan-out", in);
+    fan.to(a).to(slow, para::branch_drop).to(b);
+    line.sink("a", keep(&got_a, 0), a);
+    line.sink("b", keep(&got_b, 0), b);
+    line.sink("slow", keep(&got_slow, 200), slow);
+    line.run();
+
+    assert(payload::copies.load() == 0);
+    assert(got_a.size() == (std::size_t) n && got_b.size() == (std::size_t) n);
+    for (int i = 0; i < n; ++i) {
+      assert(got_a[i]->value == i);
+      assert(got_a[i] == got_b[i]);
+    }
+
+    assert(fan.branches() == 3);
+    assert(fan.dropped(0) == 0 && fan.dropped(2) == 0);
+    assert(fan.dropped(1) > 0);
+    assert(got_slow.size() + fan.dropped(1) == (std::size_t) n);
+    for (std::size_t i = 1; i < got_slow.size(); ++i) assert(got_slow[i - 1]->value < got_slow[i]->value);
+
+    const para::pipe_stage_stats st = line.stats()[1];
+    assert(st.in == (uint64_t) n);
+    assert(st.dropped == fan.dropped(1));
+    assert(st.out == 3 * (uint64_t) n - st.dropped);
+
+    // Only our copies are left.
+    got_slow.clear();
+    got_b.clear();
+    for (int i = 0; i < n; ++i) assert(got_a[i].use_count() == 1);
+  }
+
+  // stop() ends a source even while the sink keeps up, so its pipe is never
+  // found empty.
+  {
+    para::pipe<int> a(1024);
+    std::vector<int> got;
+    para::pipeline line;
+    line.source("count", counter(100000000), a);
+    line.sink("collect", collect_ints(&got), a);
+    line.start();
+    boost::this_thread::sleep(boost::posix_time::milliseconds(5));
+    line.stop();
+    line.wait();
+    assert(line.stats()[0].out < 100000000);
+  }
+
+  // An exception stops everything and comes out of run().
+  {
+    para::pipe<int> a(2);
+    para::pipeline line;
+    line.source("count", counter(1000000), a);
+    line.sink("throw", thrower(), a);
+    bool caught = false;
+    try {
+      line.run();
+    }
+    catch (std::logic_error &e) {
+      caught = true;
+    }
+    assert(caught);
+    assert(line.stats()[1].in == 11);
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,47 @@
+/*!
+\file
+\brief Test of --profile's counting and report.  Whether there are any
+performance counters depends on the machine, so this only relies on time.
+*/
+
+#include "../src/profiler.hpp"
+
+#include <sstream>
+#include <string>
+#include <cstdlib>
+#include <cassert>
+
+int main() {
+  perf_reading a, b;
+  a.value[perf_reading::cycles] = 10;
+  a.ns = 100;
+  b.value[perf_reading::cycles] = 4;
+  b.ns = 40;
+  const perf_reading d = a - b;
+  assert(d.value[perf_reading::cycles] == 6 && d.ns == 60);
+  b += d;
+  assert(b.value[perf_reading::cycles] == 10 && b.ns == 100);
+
+  profiler p;
+  // Either it counts or it says why not.
+  assert(p.counters().any() || ! p.counters().error().empty());
+
+  perf_reading started = p.start();
+  p.stop(started, 440, 100);
+  started = p.start();
+  p.stop(started, 440, 28);
+  started = p.start();
+  p.stop(started, 220, 50);
+  p.benchmark_kernels(1024);
+
+  std::ostringstream o;
+  p.print(o);
+  const std::string s = o.str();
+  assert(s.find("  440Hz: 128 samples") != std::string::npos);
+  assert(s.find("  220Hz: 50 samples") != std::string::npos);
+  assert(s.find("  All notes: 178 samples") != std::string::npos);
+  assert(s.find("  scalar: 1024 samples") != std::string::npos);
+  assert(s.find(std::string(sine_kernels::selected_name()) + " (used): 1024 samples") != std::string::npos);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,108 @@
+/*!
+\file
+\brief Test of the sample clock state machine used for --pull.
+*/
+
+#include "../src/pull_renderer.hpp"
+
+#include <cstdlib>
+#include <cassert>
+
+//! \brief Writes the frequency it was given so we can see which note is playing.
+struct frequency_oscillator : public oscillator {
+  frequency_oscillator() : freq(0) {}
+
+  void reset_wave(double f) { freq = (int16_t) f; }
+
+  void fill(int16_t *out, std::size_t frames) {
+    std::fill(out, out + frames, freq);
+  }
+
+  void fill_normalised(double *out, std::size_t frames) {
+    std::fill(out, out + frames, freq / 32768.0);
+  }
+
+  void seek(uint64_t) {}
+
+  oscillator *clone() const { return new frequency_oscillator(*this); }
+
+  int16_t freq;
+};
+
+int main() {
+  using namespace sample_formats;
+
+  const uint32_t rate = 1000;
+  const std::size_t frames = 16;
+
+  // Two notes of 3 frames with 2 frames of pause, at 1000hz.
+  const char *argv[] = {
+    "prog", "-s", "a", "-d", "12", "-n", "2", "-t", "3", "--pause", "2"
+  };
+  settings set(sizeof(argv) / sizeof(argv[0]), (char **) argv);
+  note_sequence seq(set);
+
+  frequency_oscillator osc;
+  period_pool pool(frames * sizeof(int16_t), 1);
+  basic_sample_generator<s16<host_big_endian>, 1> gen(osc, pool, rate, 1, frames);
+  pull_renderer renderer(seq, osc, gen, set);
+
+  int16_t stream[frames];
+  std::fill(stream, stream + frames, -1);
+  renderer.render((uint8_t *) stream, sizeof(stream));
+  const int16_t expected[frames] = {
+    440, 440, 440, 0, 0, 880, 880, 880, 0, 0, 0, 0, 0, 0, 0, 0
+  };
+  for (std::size_t i = 0; i < frames; ++i) assert(stream[i] == expected[i]);
+  assert(renderer.clock() == frames);
+
+  // Not finished until a whole callback of silence has gone.
+  assert(! renderer.finished());
+  renderer.render((uint8_t *) stream, sizeof(stream));
+  assert(renderer.finished());
+  for (std::size_t i = 0; i < frames; ++i) assert(stream[i] == 0);
+
+  // Skipping a note goes to the pause and stopping ends it.
+  {
+    note_sequence seq(set);
+    pull_renderer renderer(seq, osc, gen, set);
+    renderer.render((uint8_t *) stream, 2 * sizeof(int16_t));
+    assert(stream[0] == 440 && stream[1] == 440);
+    renderer.skip();
+    renderer.render((uint8_t *) stream, 3 * sizeof(int16_t));
+    assert(stream[0] == 0 && stream[1] == 0 && stream[2] == 880);
+    renderer.stop();
+    renderer.render((uint8_t *) stream, 2 * sizeof(int16_t));
+    assert(stream[0] == 0 && stream[1] == 0);
+    assert(renderer.finished());
+  }
+
+  // Forever notes: the loop comes from prepare(), and until it's called the
+  // callback plays silence.
+  {
+    const char *argv[] = {"prog", "-s", "a", "-d", "12", "-n", "2", "-t", "0", "--pause", "2"};
+    settings set(sizeof(argv) / sizeof(argv[0]), (char **) argv);
+    note_sequence seq(set);
+    pull_renderer renderer(seq, osc, gen, set);
+    renderer.render((uint8_t *) stream, 4 * sizeof(int16_t));
+    for (std::size_t i = 0; i < 4; ++i) assert(stream[i] == 440);
+
+    renderer.skip();
+    renderer.render((uint8_t *) stream, 4 * sizeof(int16_t));
+    for (std::size_t i = 0; i < 4; ++i) assert(stream[i] == 0);
+
+    renderer.prepare();
+    renderer.render((uint8_t *) stream, 2 * sizeof(int16_t));
+    assert(stream[0] == 880 && stream[1] == 880);
+
+    // Nothing left: finished once prepare() says so.
+    renderer.skip();
+    renderer.render((uint8_t *) stream, 2 * sizeof(int16_t));
+    renderer.prepare();
+    renderer.render((uint8_t *) stream, 2 * sizeof(int16_t));
+    renderer.render((uint8_t *) stream, 2 * sizeof(int16_t));
+    assert(renderer.finished());
+  }
+
+  return EXIT_SUCCESS;
+}
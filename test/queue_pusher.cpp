@@ -0,0 +1,61 @@
+/*!
+\file
+\brief Test of flushing the period queue by epochs.
+*/
+
+#include "../src/sync_data.hpp"
+
+#include <cstdlib>
+#include <cassert>
+
+int main() {
+  period_pool pool(16, 4);
+  queue_pusher q(4);
+  shared_period ret;
+
+  // Plain FIFO.
+  {
+    period_buffer a = pool.acquire();
+    void *const p = a.get();
+    q.push(std::move(a));
+    assert(q.size() == 1);
+    assert(q.pop(ret) == queue_pusher::pop_ok);
+    assert(ret.get() == p);
+    ret.release();
+    assert(q.pop(ret) == queue_pusher::pop_empty);
+  }
+
+  // A flush drops what was queued before it, straight back into the pool.
+  {
+    q.push(pool.acquire());
+    q.push(pool.acquire());
+    q.push(pool.acquire());
+    q.flush();
+    period_buffer fresh = pool.acquire();
+    void *const p = fresh.get();
+    q.push(std::move(fresh));
+
+    assert(q.pop(ret) == queue_pusher::pop_ok);
+    assert(ret.get() == p);
+    ret.release();
+    assert(q.size() == 0);
+
+    // Every buffer is free again.
+    period_buffer all[4];
+    for (int i = 0; i < 4; ++i) {
+      all[i] = pool.try_acquire();
+      assert(all[i]);
+    }
+  }
+
+  // Only stale periods: the callback knows it's a skip, not an underflow.
+  {
+    q.push(pool.acquire());
+    q.flush();
+    assert(q.pop(ret) == queue_pusher::pop_flushed);
+    assert(! ret);
+    assert(q.pop(ret) == queue_pusher::pop_empty);
+  }
+
+  return EXIT_SUCCESS;
+}
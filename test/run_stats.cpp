@@ -0,0 +1,64 @@
+/*!
+\file
+\brief Test of the --stats counters and histograms.
+*/
+
+#include "../src/run_stats.hpp"
+
+#include <sstream>
+#include <string>
+#include <cstdlib>
+#include <cassert>
+
+int main() {
+  // Power of two buckets.
+  {
+    stat_histogram h;
+    assert(h.count() == 0 && h.mean() == 0 && h.percentile(0.5) == 0);
+
+    h.record(0);
+    h.record(1);
+    h.record(2);
+    h.record(3);
+    h.record(100);
+    assert(h.count() == 5 && h.max() == 100);
+    assert(h.mean() == 106 / 5.0);
+    assert(h.bucket(0) == 1 && h.bucket(1) == 1 && h.bucket(2) == 2 && h.bucket(7) == 1);
+
+    // 3 of 5 are under 4; the top bucket is limited by the max.
+    assert(h.percentile(0.6) == 3);
+    assert(h.percentile(0.99) == 100);
+
+    // Anything enormous goes in the last bucket.
+    h.record(~(uint64_t) 0);
+    assert(h.bucket(stat_histogram::buckets - 1) == 1);
+  }
+
+  run_stats s;
+  s.period_ns(1000000);
+  s.callback();
+  s.callback();
+  s.queued(4);
+  s.underflow();
+  s.flushed();
+  s.generated(detail::now_ns());
+
+  // The first callback has nothing to be late against.
+  assert(s.callbacks() == 2 && s.jitter_us().count() == 1);
+  assert(s.jitter_us().max() <= 1000);
+  assert(s.depth().max() == 4);
+  assert(s.underflows() == 1 && s.flushes() == 1 && s.periods() == 1);
+
+  std::ostringstream json;
+  s.write_json(json);
+  const std::string j = json.str();
+  assert(j[0] == '{' && j[j.size() - 2] == '}');
+  assert(j.find("\"underflows\": 1,") != std::string::npos);
+  assert(j.find("\"queue_depth\": {\"count\": 1, \"mean\": 4, \"p50\": 4, \"p99\": 4, \"max\": 4, \"buckets\": [0, 0, 0, 1]}") != std::string::npos);
+
+  std::ostringstream text;
+  s.print(text);
+  assert(text.str().find("Underflows: 1\n") != std::string::npos);
+
+  return EXIT_SUCCESS;
+}
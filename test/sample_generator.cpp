@@ -1,20 +1,210 @@
 #include "../src/calculations.hpp"
 
+#include <boost/scoped_ptr.hpp>
+
 #include <cstdlib>
 #include <cassert>
+#include <vector>
+#include <cmath>
 
-// TODO:
-//   test that the time => bytes calculation is working
-//
-// TODO:
-//   test that a partial buffer gets appended to, not overwritten (for silence
-//   and for normal).  Also use a sentinel to check that no data is overrun.
-//   We prolly need to make a subclass for this stuff.
-//
 // TODO:
 //   test what happens with <= 0 ms buffer length (we need an infinite buffer
 //   somehow)
 
+//! \brief Always returns the same value so we can check the conversions.
+struct constant_oscillator : public oscillator {
+  constant_oscillator(int16_t v) : value(v) {}
+
+  void reset_wave(double) {}
+
+  void fill(int16_t *out, std::size_t frames) {
+    std::fill(out, out + frames, value);
+  }
+
+  void fill_normalised(double *out, std::size_t frames) {
+    std::fill(out, out + frames, value / 32768.0);
+  }
+
+  void seek(uint64_t) {}
+
+  oscillator *clone() const { return new constant_oscillator(*this); }
+
+  int16_t value;
+};
+
 int main() {
+  using namespace sample_formats;
+
+  const uint32_t rate = 1000;
+  const std::size_t frames = 4;
+
+  // Time => samples and partial buffers: 10ms at 1000hz is two full buffers
+  // and half of a third, which the silence then appends to.
+  {
+    constant_oscillator osc(0x1234);
+    period_pool pool(frames * 2 * sizeof(int16_t), 4);
+    basic_sample_generator<s16<host_big_endian>, 2> gen(osc, pool, rate, 2, frames);
+    assert(gen.buffer_size() == frames * 2 * sizeof(int16_t));
+
+    gen.reset_time(10);
+    period_buffer b1 = gen.get_samples();
+    period_buffer b2 = gen.get_samples();
+    assert(b1 && b2 && b1.get() != b2.get());
+    assert(! gen.get_samples());
+
+    gen.reset_time(3);
+    period_buffer b3 = gen.get_silence();
+    assert(b3);
+    int16_t *s3 = (int16_t *) b3.get();
+    for (std::size_t i = 0; i < 4; ++i) assert(s3[i] == 0x1234);
+    for (std::size_t i = 4; i < 8; ++i) assert(s3[i] == 0);
+
+    // one frame of silence left over.
+    assert(! gen.get_silence());
+  }
+
+  // Unsigned formats are offset and use their own silence.
+  {
+    constant_oscillator osc(0x1234);
+    period_pool pool(frames, 2);
+    basic_sample_generator<u8, 1> gen(osc, pool, rate, 1, frames);
+    gen.reset_time(2);
+    assert(! gen.get_samples());
+    gen.reset_time(3);
+    period_buffer p = gen.get_silence();
+    uint8_t *b = (uint8_t *) p.get();
+    assert(b[0] == 0x92 && b[1] == 0x92);
+    assert(b[2] == 0x80 && b[3] == 0x80);
+  }
+
+  // Byte order of the non-native 16 bit format is swapped.
+  {
+    constant_oscillator osc(0x1234);
+    period_pool pool(frames * sizeof(int16_t), 2);
+    basic_sample_generator<s16<! host_big_endian>, 1> gen(osc, pool, rate, 1, frames);
+    gen.reset_time(5);
+    period_buffer p = gen.get_samples();
+    uint16_t *b = (uint16_t *) p.get();
+    for (std::size_t i = 0; i < frames; ++i) assert(b[i] == 0x3412);
+  }
+
+  // Runtime channel counts fan out like the fixed ones.
+  {
+    constant_oscillator osc(-0x4000);
+    period_pool pool(frames * 3 * sizeof(float), 2);
+    basic_sample_generator<f32<host_big_endian>, 0> gen(osc, pool, rate, 3, frames);
+    gen.reset_time(5);
+    period_buffer p = gen.get_samples();
+    float *b = (float *) p.get();
+    for (std::size_t i = 0; i < frames * 3; ++i) assert(b[i] == -0.5f);
+  }
+
+  // A recorded note replays the same, across the same partial buffer.
+  {
+    constant_oscillator osc(0x1234);
+    // Enough for the four periods held here and the generator's own.
+    period_pool pool(frames * sizeof(int16_t), 6);
+    basic_sample_generator<s16<host_big_endian>, 1> gen(osc, pool, rate, 1, frames);
+
+    std::vector<uint8_t> recorded;
+    gen.reset_time(6);
+    gen.record(&recorded);
+    period_buffer first = gen.get_samples();
+    assert(first && ! gen.get_samples());
+    assert(recorded.size() == 6 * sizeof(int16_t));
+
+    // Different values so we know they were copied, not calculated.
+    osc.value = 0;
+    std::vector<uint8_t> copy(recorded);
+    ((int16_t *) &copy[0])[5] = 0x4321;
+    gen.reset_time(6);
+    gen.replay(&copy[0]);
+    period_buffer second = gen.get_samples();
+    assert(second && ! gen.get_samples());
+    const int16_t *s = (const int16_t *) second.get();
+    // two left from the first note, then the copy.
+    assert(s[0] == 0x1234 && s[1] == 0x1234 && s[2] == 0x1234 && s[3] == 0x1234);
+
+    // The rest of the copy, held back until there's more time.
+    gen.reset_time(4);
+    period_buffer third = gen.get_samples();
+    const int16_t *t = (const int16_t *) third.get();
+    assert(t[0] == 0x1234 && t[1] == 0x1234 && t[2] == 0x1234 && t[3] == 0x4321);
+
+    // reset_time() stopped the replay, so that note was calculated.
+    assert(! gen.get_samples());
+    gen.reset_time(1);
+    period_buffer fourth = gen.get_silence();
+    const int16_t *f = (const int16_t *) fourth.get();
+    assert(f[0] == 0 && f[3] == 0);
+  }
+
+  // Loop lengths: exact when there is one, otherwise close enough.
+  {
+    const wave_cycle exact = find_cycle(440, 44100, 441000, 0);
+    assert(exact.frames == 2205 && exact.frequency == 440);
+
+    const double f = 440 * std::pow(2.0, 1 / 12.0);
+    const wave_cycle near = find_cycle(f, 44100, 441000, 0.01);
+    assert(near.frames < 441000);
+    assert(std::fabs(1200 * std::log(near.frequency / f) / std::log(2.0)) <= 0.01);
+
+    // Nothing fits: the closest.
+    const wave_cycle best = find_cycle(f, 44100, 100, 0);
+    assert(best.frames <= 100);
+  }
+
+  // Forever notes loop the cycle without end.
+  {
+    constant_oscillator osc(0x1234);
+    period_pool pool(frames * sizeof(int16_t), 4);
+    basic_sample_generator<s16<host_big_endian>, 1> gen(osc, pool, rate, 1, frames);
+    gen.reset_forever(250, 0);
+    assert(gen.forever());
+    osc.value = 0;
+    for (int i = 0; i < 10; ++i) {
+      period_buffer p = gen.get_samples();
+      assert(p);
+      const int16_t *s = (const int16_t *) p.get();
+      for (std::size_t f = 0; f < frames; ++f) assert(s[f] == 0x1234);
+    }
+
+    gen.reset_time(6);
+    assert(! gen.forever());
+    period_buffer p = gen.get_samples();
+    assert(p && ((const int16_t *) p.get())[0] == 0);
+    assert(! gen.get_samples());
+  }
+
+  // Silence after a forever note (an interrupt) ends it with nothing more.
+  {
+    constant_oscillator osc(0x1234);
+    period_pool pool(frames * sizeof(int16_t), 4);
+    basic_sample_generator<s16<host_big_endian>, 1> gen(osc, pool, rate, 1, frames);
+    gen.reset_forever(250, 0);
+    assert(gen.remaining_frames() == 0);
+    period_buffer p = gen.get_samples();
+    assert(p);
+    assert(! gen.get_silence());
+    assert(! gen.forever());
+    assert(! gen.get_samples());
+  }
+
+  // The factory picks from the spec and rejects what we can't do.
+  {
+    constant_oscillator osc(0);
+    period_pool pool(frames * 2 * sizeof(int16_t), 2);
+    sdl::audio_spec spec(NULL, rate, frames, 2, AUDIO_U16MSB);
+    boost::scoped_ptr<sample_generator> gen(make_sample_generator(osc, pool, spec));
+    typedef basic_sample_generator<u16<true>, 2> expected_type;
+    assert(dynamic_cast<expected_type *>(gen.get()));
+
+    spec.format(0x1234);
+    bool reached = false;
+    try { make_sample_generator(osc, pool, spec); reached = true; }
+    catch (std::runtime_error &) {}
+    assert(! reached);
+  }
+
   return EXIT_SUCCESS;
 }
@@ -0,0 +1,163 @@
+/*!
+\file
+\brief Test of the WAV, RF64 and raw dump files.
+*/
+
+#include "../src/sample_writer.hpp"
+
+#include <fstream>
+#include <iterator>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cassert>
+
+namespace {
+  const char *const filename = "sample_writer.test.tmp";
+
+  std::vector<uint8_t> slurp(std::size_t max = 1024 * 1024) {
+    std::ifstream in(filename, std::ios::binary);
+    std::vector<uint8_t> v(max);
+    in.read((char *) &v[0], max);
+    v.resize(in.gcount());
+    return v;
+  }
+
+  uint32_t le32(const std::vector<uint8_t> &v, std::size_t i) {
+    return v[i] | (v[i + 1] << 8) | (v[i + 2] << 16) | ((uint32_t) v[i + 3] << 24);
+  }
+
+  uint64_t le64(const std::vector<uint8_t> &v, std::size_t i) {
+    return le32(v, i) | ((uint64_t) le32(v, i + 4) << 32);
+  }
+
+  bool tag_is(const std::vector<uint8_t> &v, std::size_t i, const char *tag) {
+    return std::equal(tag, tag + 4, v.begin() + i);
+  }
+}
+
+int main() {
+  const int16_t samples[] = {1, -1, 2, -2, 3, -3};
+  sdl::audio_spec spec(NULL, 8000, 4, 2, AUDIO_S16LSB);
+  spec.calculate();
+
+  // Raw is just the samples, however the writes are split over buffers.
+  {
+    sample_writer_options o;
+    o.buffer_size = 6;
+    o.buffers = 1;
+    sample_writer w(filename, container_raw, spec, o);
+    std::vector<uint8_t> big(3 * write_behind::alignment + 5);
+    for (std::size_t i = 0; i < big.size(); ++i) big[i] = (uint8_t) i;
+    w.write(samples, 4);
+    w.write(&big[0], big.size());
+    w.flush();
+    w.write(samples + 2, 8);
+    w.close();
+    assert(w.dropped() == 0);
+
+    std::vector<uint8_t> v = slurp();
+    assert(v.size() == 12 + big.size());
+    assert(std::equal(v.begin(), v.begin() + 4, (const uint8_t *) samples));
+    assert(std::equal(big.begin(), big.end(), v.begin() + 4));
+    assert(std::equal(v.begin() + 4 + big.size(), v.end(), (const uint8_t *) (samples + 2)));
+  }
+
+  // Plain 16 bit stereo WAV.
+  const std::size_t header_size = 12 + 36 + 24 + 8;
+  {
+    sample_writer w(filename, container_wav, spec);
+    w.write(samples, sizeof(samples));
+    assert(w.data_size() == 0);
+    w.close();
+    assert(w.data_size() == sizeof(samples));
+
+    std::vector<uint8_t> v = slurp();
+    assert(v.size() == header_size + sizeof(samples));
+    assert(tag_is(v, 0, "RIFF") && tag_is(v, 8, "WAVE"));
+    assert(le32(v, 4) == v.size() - 8);
+    assert(tag_is(v, 12, "JUNK") && le32(v, 16) == 28);
+    assert(tag_is(v, 48, "fmt ") && le32(v, 52) == 16);
+    assert((le32(v, 56) & 0xffff) == 1 && (le32(v, 56) >> 16) == 2);
+    assert(le32(v, 60) == 8000 && le32(v, 64) == 8000 * 4);
+    assert((le32(v, 68) & 0xffff) == 4 && (le32(v, 68) >> 16) == 16);
+    assert(tag_is(v, 72, "data") && le32(v, 76) == sizeof(samples));
+    assert(std::equal(v.begin() + header_size, v.end(), (const uint8_t *) samples));
+  }
+
+  // Odd data sizes get a pad byte which isn't counted in the data.
+  {
+    sdl::audio_spec u8_spec(NULL, 8000, 4, 1, AUDIO_U8);
+    u8_spec.calculate();
+    sample_writer w(filename, container_wav, u8_spec);
+    w.write(samples, 3);
+    w.close();
+    std::vector<uint8_t> v = slurp();
+    assert(v.size() == header_size + 4);
+    assert(le32(v, 4) == v.size() - 8);
+    assert(le32(v, 76) == 3);
+  }
+
+  // More than two channels needs WAVE_FORMAT_EXTENSIBLE.
+  {
+    sdl::audio_spec surround(NULL, 8000, 4, 6, AUDIO_S16LSB);
+    surround.calculate();
+    sample_writer w(filename, container_wav, surround);
+    w.close();
+    std::vector<uint8_t> v = slurp();
+    assert(le32(v, 52) == 40);
+    assert((le32(v, 56) & 0xffff) == 0xfffe);
+    assert((le32(v, 80) & 0xffff) == 1);
+  }
+
+  // Written out of order from threads and more than 4GB: RF64.  The file is
+  // sparse so this doesn't really use the space.
+  {
+    const uint64_t big = 0x100000000ULL;
+    sample_writer w(filename, container_wav, spec);
+    w.write_at(samples, sizeof(samples), big);
+    w.write_at(samples, sizeof(samples), 0);
+    w.close();
+    std::vector<uint8_t> v = slurp(header_size);
+    assert(tag_is(v, 0, "RF64") && le32(v, 4) == 0xffffffff);
+    assert(tag_is(v, 12, "ds64") && le32(v, 16) == 28);
+    assert(le64(v, 20) == header_size + big + sizeof(samples) - 8);
+    assert(le64(v, 28) == big + sizeof(samples));
+    assert(tag_is(v, 72, "data") && le32(v, 76) == 0xffffffff);
+  }
+
+  // With direct I/O the samples start on an aligned offset.
+  {
+    sample_writer_options o;
+    o.direct = true;
+    bool opened = false;
+    try {
+      sample_writer w(filename, container_wav, spec, o);
+      opened = true;
+      w.write(samples, sizeof(samples));
+      w.close();
+    }
+    // Not every file system can do it.
+    catch (std::runtime_error &) {}
+
+    if (opened) {
+      std::vector<uint8_t> v = slurp();
+      assert(v.size() == write_behind::alignment + sizeof(samples));
+      assert(tag_is(v, 12, "JUNK") && tag_is(v, 48, "JUNK"));
+      assert(tag_is(v, write_behind::alignment - 8, "data"));
+      assert(le32(v, 4) == v.size() - 8);
+    }
+  }
+
+  // Formats WAV can't hold.
+  {
+    sdl::audio_spec be(NULL, 8000, 4, 2, AUDIO_S16MSB);
+    bool reached = false;
+    try { sample_writer w(filename, container_wav, be); reached = true; }
+    catch (std::runtime_error &) {}
+    assert(! reached);
+  }
+
+  std::remove(filename);
+  return EXIT_SUCCESS;
+}
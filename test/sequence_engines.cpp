@@ -28,6 +28,15 @@ int main() {
     assert(count == 13);
   }
 
+  // Reset goes back to the start (for --loop).
+  {
+    detail::generated_sequence gs(440.0, 0, 2, 1);
+    while (! gs.done()) gs.next_frequency();
+    gs.reset();
+    assert(! gs.done());
+    assert(gs.next_frequency() == 440.0);
+  }
+
   // TODO:
   //   test generated sequence with start == end,
 
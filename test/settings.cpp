@@ -43,6 +43,78 @@ int main() {
     assert(! reached);
   }
 
+  // period: default, --low-latency default, and only powers of two.
+  {
+    const char *argv[] = {"prog"};
+    settings s(1, (char **) argv);
+    assert(s.period_frames() == DEFAULT_PERIOD_FRAMES);
+    assert(! s.low_latency());
+    assert(s.cpu() == -1);
+  }
+  {
+    const char *argv[] = {"prog", "--low-latency"};
+    settings s(2, (char **) argv);
+    assert(s.period_frames() == LOW_LATENCY_PERIOD_FRAMES);
+    assert(s.low_latency());
+  }
+  {
+    const char *argv[] = {"prog", "--low-latency", "--period", "64", "--cpu", "1"};
+    settings s(6, (char **) argv);
+    assert(s.period_frames() == 64);
+    assert(s.cpu() == 1);
+  }
+  {
+    const char *argv[] = {"prog", "--period", "100"};
+    bool reached = false;
+    try { settings s(3, (char **) argv); reached = true; }
+    catch (std::runtime_error &) { }
+    assert(! reached);
+  }
+
+  // The latency controller's bounds.
+  {
+    const char *argv[] = {"prog"};
+    settings s(1, (char **) argv);
+    assert(s.latency_min_periods() == DEFAULT_LATENCY_MIN);
+    assert(s.underflow_budget() == 0);
+  }
+  {
+    const char *argv[] = {"prog", "--latency-min", "4", "--underflow-budget", "3"};
+    settings s(5, (char **) argv);
+    assert(s.latency_min_periods() == 4);
+    assert(s.underflow_budget() == 3);
+  }
+  {
+    const char *argv[] = {"prog", "--latency-min", "0"};
+    bool reached = false;
+    try { settings s(3, (char **) argv); reached = true; }
+    catch (std::runtime_error &) { }
+    assert(! reached);
+  }
+
+  // --time 0 is forever.
+  {
+    const char *argv[] = {"prog", "--time", "0"};
+    settings s(3, (char **) argv);
+    assert(s.duration_ms() == settings::forever);
+  }
+
+  // --profile calculates every note on one thread, and can't with --pull.
+  {
+    const char *argv[] = {"prog", "--profile", "--threads", "4"};
+    settings s(4, (char **) argv);
+    assert(s.profile());
+    assert(s.note_cache_size() == 0);
+    assert(s.threads() == 1);
+  }
+  {
+    const char *argv[] = {"prog", "--profile", "--pull"};
+    bool reached = false;
+    try { settings s(3, (char **) argv); reached = true; }
+    catch (std::runtime_error &) { }
+    assert(! reached);
+  }
+
   // TODO:
   //   Test the following:
   //   - existing file for --dump
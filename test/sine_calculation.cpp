@@ -1,6 +1,7 @@
 #include "../src/calculations.hpp"
 
 #include <cstdlib>
+#include <vector>
 
 int main() {
   double frequency = 44100;
@@ -62,5 +63,50 @@ int main() {
     }
   }
 
+  // The block kernel agrees with next_sample() to within a unit, including
+  // across calls which leave a partial kernel block.
+  {
+    amplitude = 0.75;
+    frequency = 44100;
+    sine_calculation scalar(frequency, amplitude);
+    sine_calculation block(frequency, amplitude);
+    scalar.reset_wave(note_freq);
+    block.reset_wave(note_freq);
+
+    const std::size_t sizes[] = {1, 3, 64, 100, 1023, 4096};
+    for (std::size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+      int16_t out[4096];
+      block.fill(out, sizes[s]);
+      for (std::size_t i = 0; i < sizes[s]; ++i) {
+        int16_t expected = scalar.next_sample<int16_t>();
+        assert(std::abs(out[i] - expected) <= 1);
+      }
+    }
+  }
+
+  // Each kernel gives sin() on its own, including large positions.
+  {
+    const std::size_t n = 1001;
+    double expected[n], got[n];
+    const double pos = 12345.678, speed = 0.0627;
+    sine_kernels::scalar(expected, n, pos, speed, 1.0);
+
+    std::vector<sine_kernels::kernel_type> kernels;
+    kernels.push_back(&sine_kernels::fill);
+#ifdef TUNE_SINE_KERNELS_X86
+    kernels.push_back(&sine_kernels::sse2);
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+      kernels.push_back(&sine_kernels::avx2);
+    }
+#endif
+
+    for (std::size_t k = 0; k < kernels.size(); ++k) {
+      kernels[k](got, n, pos, speed, 1.0);
+      for (std::size_t i = 0; i < n; ++i) {
+        assert(std::fabs(got[i] - expected[i]) < 1e-9);
+      }
+    }
+  }
+
   return EXIT_SUCCESS;
 }
@@ -0,0 +1,82 @@
+/*!
+\file
+\brief Test the single-producer, single-consumer ring from para::lfds.
+*/
+
+#include <para/lfds/spsc_ring.hpp>
+
+#include <boost/thread.hpp>
+
+#include <cstdlib>
+#include <cassert>
+
+namespace {
+  typedef para::lfds::spsc_ring<std::size_t> ring_type;
+
+  const std::size_t items = 200000;
+
+  void producer(ring_type &r) {
+    for (std::size_t i = 0; i < items; ++i) {
+      while (! r.push(i)) {
+        boost::this_thread::yield();
+      }
+    }
+  }
+}
+
+int main() {
+  // Capacity, full and empty.
+  {
+    ring_type r(5);
+    assert(r.capacity() == 8);
+    assert(r.empty());
+
+    std::size_t v;
+    assert(! r.pop(v));
+    for (std::size_t i = 0; i < 8; ++i) {
+      assert(r.push(i));
+    }
+    assert(r.size() == 8);
+    assert(! r.push(99));
+
+    for (std::size_t i = 0; i < 8; ++i) {
+      assert(r.pop(v));
+      assert(v == i);
+    }
+    assert(! r.pop(v));
+    assert(r.empty());
+  }
+
+  // Indices wrap around the slots many times.
+  {
+    ring_type r(4);
+    std::size_t v;
+    for (std::size_t i = 0; i < 1000; ++i) {
+      assert(r.push(i));
+      assert(r.push(i + 1));
+      assert(r.pop(v) && v == i);
+      assert(r.pop(v) && v == i + 1);
+    }
+  }
+
+  // Everything arrives once and in order across threads.
+  {
+    ring_type r(16);
+    boost::thread th(producer, boost::ref(r));
+    std::size_t expected = 0;
+    while (expected < items) {
+      std::size_t v;
+      if (r.pop(v)) {
+        assert(v == expected);
+        ++expected;
+      }
+      else {
+        boost::this_thread::yield();
+      }
+    }
+    th.join();
+    assert(r.empty());
+  }
+
+  return EXIT_SUCCESS;
+}
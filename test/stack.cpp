@@ -0,0 +1,134 @@
+/*!
+\file
+\brief Stress the lock-free stacks and the epoch reclamation under them.
+*/
+
+#include <para/lfds/stack.hpp>
+
+#include <boost/thread.hpp>
+
+#include <vector>
+#include <cstdlib>
+#include <cassert>
+
+namespace {
+  const unsigned int threads = 4;
+  const unsigned int per_thread = 50000;
+
+  //! \brief Counts live instances so we can tell everything was freed.
+  struct counted {
+    static para::atomic<int> live;
+
+    explicit counted(unsigned int v = 0) : value(v) { live.fetch_add(1); }
+    counted(const counted &o) : value(o.value) { live.fetch_add(1); }
+    ~counted() { live.fetch_sub(1); }
+
+    counted &operator=(const counted &o) { value = o.value; return *this; }
+
+    unsigned int value;
+  };
+
+  para::atomic<int> counted::live;
+
+  typedef para::lfds::stack<counted> stack_type;
+
+  //! \brief Push distinct values and pop the same number, marking each one seen.
+  void churn(stack_type &s, unsigned int id, std::vector<para::atomic<int> > *seen) {
+    for (unsigned int i = 0; i < per_thread; ++i) {
+      s.push(counted(id * per_thread + i));
+      counted c;
+      while (! s.pop(c)) boost::this_thread::yield();
+      (*seen)[c.value].fetch_add(1);
+    }
+  }
+
+  //! \brief Take slots, scribble on them, and give them back.
+  void use_slots(para::lfds::index_stack &s, std::vector<para::atomic<int> > *owner, unsigned int id) {
+    for (unsigned int i = 0; i < per_thread; ++i) {
+      para::lfds::index_stack::index_type slot;
+      while (! s.pop(slot)) boost::this_thread::yield();
+      // Nobody else may hold it.
+      int expected = 0;
+      const bool took = (*owner)[slot].compare_exchange_strong(expected, (int) id + 1);
+      assert(took);
+      (*owner)[slot].store(0);
+      s.push(slot);
+    }
+  }
+}
+
+int main() {
+  // Order and emptiness.
+  {
+    para::lfds::epoch_domain d;
+    stack_type s(d);
+    counted c;
+    assert(s.empty());
+    assert(! s.pop(c));
+    s.push(counted(1));
+    s.push(counted(2));
+    assert(s.pop(c) && c.value == 2);
+    assert(s.pop(c) && c.value == 1);
+    assert(! s.pop(c));
+    s.push(counted(3));
+  }
+  assert(counted::live.load() == 0);
+
+  // Every value comes out exactly once and every node is freed.
+  {
+    para::lfds::epoch_domain d;
+    {
+      stack_type s(d);
+      std::vector<para::atomic<int> > seen(threads * per_thread);
+      boost::thread_group group;
+      for (unsigned int t = 0; t < threads; ++t) {
+        group.create_thread(boost::bind(&churn, boost::ref(s), t, &seen));
+      }
+      group.join_all();
+      for (std::size_t i = 0; i < seen.size(); ++i) assert(seen[i].load() == 1);
+      assert(s.empty());
+
+      // The epoch moved and the old nodes went, or the memory would grow
+      // without bound.
+      assert(d.epoch() > 0);
+      assert(counted::live.load() < (int) (threads * per_thread));
+    }
+  }
+  assert(counted::live.load() == 0);
+
+  // Index stack: full to start with, lowest first.
+  {
+    para::lfds::index_stack s(3);
+    para::lfds::index_stack::index_type i;
+    assert(s.capacity() == 3);
+    assert(s.pop(i) && i == 0);
+    assert(s.pop(i) && i == 1);
+    assert(s.pop(i) && i == 2);
+    assert(! s.pop(i));
+    assert(s.empty());
+    s.push(1);
+    assert(s.pop(i) && i == 1);
+
+    para::lfds::index_stack e(2, false);
+    assert(e.empty());
+  }
+
+  // Index stack: no slot is ever held twice.  With only a few slots the same
+  // indices are pushed over and over, which is where ABA would show up.
+  {
+    para::lfds::index_stack s(3);
+    std::vector<para::atomic<int> > owner(3);
+    boost::thread_group group;
+    for (unsigned int t = 0; t < threads; ++t) {
+      group.create_thread(boost::bind(&use_slots, boost::ref(s), &owner, t));
+    }
+    group.join_all();
+
+    para::lfds::index_stack::index_type i;
+    unsigned int n = 0;
+    while (s.pop(i)) ++n;
+    assert(n == 3);
+  }
+
+  return EXIT_SUCCESS;
+}
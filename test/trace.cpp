@@ -0,0 +1,91 @@
+/*!
+\file
+\brief Test of the event trace and reading it back.
+*/
+
+#include "../src/trace.hpp"
+
+#include <boost/thread.hpp>
+
+#include <sstream>
+#include <string>
+#include <cstdlib>
+#include <cstdio>
+#include <cassert>
+
+namespace {
+  const char *const filename = "trace.test.tmp";
+
+  void other_thread() {
+    trace::event(trace::ev_callback_begin);
+    trace::event(trace::ev_callback_end, trace::cb_underflow, 3);
+  }
+}
+
+int main() {
+  // Off: nothing recorded, and no ring taken.
+  trace::event(trace::ev_key);
+  assert(! trace::global().enabled());
+
+  trace::global().start(4);
+  trace::event(trace::ev_note_range, -3, 9);
+  trace::event(trace::ev_note, trace::real(440.5), 2000);
+  boost::thread th(other_thread);
+  th.join();
+  // Overwrites the first two.
+  trace::event(trace::ev_push, 1, 10);
+  trace::event(trace::ev_push, 2, 10);
+  trace::event(trace::ev_flush);
+  trace::event(trace::ev_quit);
+  trace::global().dump(filename);
+
+  uint64_t overwritten = 0;
+  const std::vector<trace::record> r = trace::read(filename, overwritten);
+  std::remove(filename);
+  assert(overwritten == 2);
+  assert(r.size() == 6);
+  for (std::size_t i = 1; i < r.size(); ++i) assert(r[i - 1].time_ns <= r[i].time_ns);
+  assert(r[0].id == trace::ev_callback_begin && r[0].thread == 1);
+  assert(r[5].id == trace::ev_quit && r[5].thread == 0);
+
+  std::ostringstream text;
+  trace::print_text(text, r);
+  assert(text.str().find(" t1 callback_end result=1 queued=3\n") != std::string::npos);
+  assert(text.str().find(" t0 push queued=2 depth=10\n") != std::string::npos);
+
+  // Signed and floating point arguments.
+  std::vector<trace::record> more(2);
+  more[0].time_ns = 0;
+  more[0].id = trace::ev_note_range;
+  more[0].arg[0] = (uint64_t) -3;
+  more[0].arg[1] = 9;
+  more[0].thread = 0;
+  more[1] = more[0];
+  more[1].id = trace::ev_note;
+  more[1].arg[0] = trace::real(440.5);
+  more[1].arg[1] = 2000;
+  std::ostringstream chrome;
+  trace::print_chrome(chrome, more);
+  const std::string c = chrome.str();
+  assert(c.find("{\"name\": \"note_range\", \"ph\": \"i\", \"ts\": 0, \"pid\": 1, \"tid\": 0, \"s\": \"t\", "
+                "\"args\": {\"start\": -3, \"stop\": 9}}") != std::string::npos);
+  assert(c.find("\"args\": {\"frequency\": 440.5, \"ms\": 2000}") != std::string::npos);
+
+  // Not a trace.
+  {
+    FILE *f = std::fopen(filename, "wb");
+    std::fputs("RIFF and so on", f);
+    std::fclose(f);
+    bool threw = false;
+    try {
+      trace::read(filename, overwritten);
+    }
+    catch (std::runtime_error &) {
+      threw = true;
+    }
+    std::remove(filename);
+    assert(threw);
+  }
+
+  return EXIT_SUCCESS;
+}
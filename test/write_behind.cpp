@@ -0,0 +1,67 @@
+/*!
+\file
+\brief Test of the write-behind thread's buffers and backpressure.
+*/
+
+#include "../src/write_behind.hpp"
+
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cassert>
+
+#include <fcntl.h>
+
+int main() {
+  const char *const filename = "write_behind.test.tmp";
+  const int fd = ::open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  assert(fd != -1);
+
+  {
+    write_behind w(fd, -1, 10, 2);
+    assert(w.buffer_size() == write_behind::alignment);
+    assert(w.buffers() == 2);
+
+    // Every buffer taken: don't wait, just report it.
+    uint8_t *a = w.acquire(false);
+    uint8_t *b = w.acquire(false);
+    assert(a && b && a != b);
+    assert(w.stalls() == 0);
+    assert(w.acquire(false) == NULL);
+    assert(w.stalls() == 1);
+
+    // Written in any order to their offsets.
+    std::memset(a, 'a', 4);
+    std::memset(b, 'b', 4);
+    w.submit(b, 4, 4);
+    w.submit(a, 4, 0);
+
+    // Waiting gets one back when it's written.
+    uint8_t *c = w.acquire(true);
+    assert(c == a || c == b);
+    w.release(c);
+    w.drain();
+  }
+
+  {
+    std::ifstream in(filename);
+    std::string s;
+    in >> s;
+    assert(s == "aaaabbbb");
+  }
+
+  // Errors come back from the thread.
+  {
+    write_behind w(-1, -1, 10, 1);
+    uint8_t *a = w.acquire(true);
+    w.submit(a, 1, 0);
+    bool reached = false;
+    try { w.drain(); reached = true; }
+    catch (std::runtime_error &) {}
+    assert(! reached);
+  }
+
+  ::close(fd);
+  std::remove(filename);
+  return EXIT_SUCCESS;
+}